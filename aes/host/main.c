@@ -1,13 +1,19 @@
 #include <err.h>
+#include <fcntl.h>
 #include <math.h>
 #include <openssl/conf.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 /* OP-TEE TEE client API (built by optee_client) */
 #include <tee_client_api.h>
@@ -15,11 +21,26 @@
 /* To the the UUID (found the the TA's h-file(s)) */
 #include <aes_ta.h>
 
+#include "nw_crypto.h"
+
 #define DECODE			0
 #define ENCODE			1
 
 #define CLEAR_TEXT_PATH         "clear.txt"
 #define NUM_TESTS               100
+#define BATCH_TESTS             20
+#define SLOT_MSG_SIZE           1024
+#define GCM_AAD_SIZE            16
+#define SWEEP_MIN_SIZE          16
+#define SWEEP_MAX_SIZE          (16 * 1024 * 1024)
+#define SWEEP_LARGE_SIZE        (1024 * 1024)
+#define SWEEP_LARGE_TESTS       10
+#define SHM_MIN_SIZE            1024
+#define NW_SCALING_SIZE         (16 * 1024 * 1024)
+#define CTR_MAX_SESSIONS        16
+#define CTR_PARALLEL_SIZE       (4 * 1024 * 1024)
+#define PIPE_BUFFERS            3
+#define PIPE_CHUNK_SIZE         (1024 * 1024)
 
 /* TEE resources */
 struct test_ctx {
@@ -43,6 +64,20 @@ double stdev(double* arr, int num_elements)
     return sqrt(sq_sum / num_elements - pow(avg(arr, num_elements), 2));
 }
 
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile, sorts arr in place
+double percentile(double* arr, int num_elements, double p)
+{
+    int rank = (int) ceil(p / 100.0 * num_elements);
+    qsort(arr, num_elements, sizeof(*arr), cmp_double);
+    return arr[rank > 0 ? rank - 1 : 0];
+}
+
 char* load_file(char *file_name, size_t *newLen)
 {
     FILE *fp;
@@ -79,43 +114,31 @@ void handleErrors(void)
     abort();
 }
 
-int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
-        unsigned char *iv, unsigned char *cipher_text, int key_size)
+const EVP_CIPHER *aes_cbc(int key_size)
 {
-    EVP_CIPHER_CTX *ctx;
-    int len;
-    int cipher_text_len;
-
-    // Create and initialise the context
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
-
-    // Initialise the encryption operation
     switch (key_size) {
         case 16:
-            if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv))
-                handleErrors();
-            break;
+            return EVP_aes_128_cbc();
         case 32:
-            if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-                handleErrors();
-            break;
+            return EVP_aes_256_cbc();
         default:
-            return -1;
+            return NULL;
     }
+}
 
-    // Encrypt the input text
-    if (1 != EVP_EncryptUpdate(ctx, cipher_text, &len, plain_text, plain_text_len))
-        handleErrors();
-    cipher_text_len = len;
+// Encryption through the normal world engine, which reuses keyed contexts
+int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
+        unsigned char *iv, unsigned char *cipher_text, int key_size)
+{
+    const EVP_CIPHER *cipher = aes_cbc(key_size);
+    int cipher_text_len;
 
-    // Finalise the encryption
-    if (1 != EVP_EncryptFinal_ex(ctx, cipher_text + len, &len))
+    if (!cipher)
+        return -1;
+    cipher_text_len = nw_cipher(cipher, key, iv, 1, plain_text,
+            plain_text_len, cipher_text);
+    if (cipher_text_len < 0)
         handleErrors();
-    cipher_text_len += len;
-
-    // Clean Context
-    EVP_CIPHER_CTX_free(ctx);
 
     return cipher_text_len;
 }
@@ -123,41 +146,70 @@ int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
 int decrypt(unsigned char *cipher_text, int cipher_text_len, unsigned char *key,
         unsigned char *iv, unsigned char *decrypted_text, int key_size)
 {
-    EVP_CIPHER_CTX *ctx;
-    int len;
+    const EVP_CIPHER *cipher = aes_cbc(key_size);
     int decrypted_text_len;
 
-    // Initialise context
-    if(!(ctx = EVP_CIPHER_CTX_new()))
+    if (!cipher)
+        return -1;
+    decrypted_text_len = nw_cipher(cipher, key, iv, 0, cipher_text,
+            cipher_text_len, decrypted_text);
+    if (decrypted_text_len < 0)
         handleErrors();
 
-    // Initialise cipher suite
+    return decrypted_text_len;
+}
+
+const EVP_CIPHER *aes_gcm(int key_size)
+{
     switch (key_size) {
         case 16:
-            if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv)) 
-                handleErrors();
-            break;
+            return EVP_aes_128_gcm();
         case 32:
-            if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) 
-                handleErrors();
-            break;
+            return EVP_aes_256_gcm();
         default:
-            return -1;
+            return NULL;
     }
+}
 
-    // Start decryption
-    if(1 != EVP_DecryptUpdate(ctx, decrypted_text, &len, cipher_text, cipher_text_len)) 
-        handleErrors();
-    decrypted_text_len = len;
+/*
+ * AES-GCM encryption through the normal world engine: in holds aad_len
+ * bytes of AAD followed by the payload, out receives the ciphertext
+ * followed by the tag.
+ */
+int gcm_encrypt(unsigned char *in, int aad_len, int in_len,
+        unsigned char *key, unsigned char *nonce, unsigned char *out,
+        int key_size)
+{
+    const EVP_CIPHER *cipher = aes_gcm(key_size);
+    int out_len;
 
-    // Finalise decryption
-    if(1 != EVP_DecryptFinal_ex(ctx, decrypted_text + len, &len))
+    if (!cipher)
+        return -1;
+    out_len = nw_gcm_encrypt(cipher, key, nonce, in, aad_len, in + aad_len,
+            in_len - aad_len, out, out + in_len - aad_len,
+            TA_AES_GCM_TAG_SIZE);
+    if (out_len < 0)
         handleErrors();
-    decrypted_text_len += len;
 
-    EVP_CIPHER_CTX_free(ctx);
+    return out_len + TA_AES_GCM_TAG_SIZE;
+}
 
-    return decrypted_text_len;
+/*
+ * AES-GCM decryption through the normal world engine: in holds the AAD,
+ * the ciphertext and the tag. Returns the plaintext length or -1 if the
+ * tag does not match.
+ */
+int gcm_decrypt(unsigned char *in, int aad_len, int in_len,
+        unsigned char *key, unsigned char *nonce, unsigned char *out,
+        int key_size)
+{
+    const EVP_CIPHER *cipher = aes_gcm(key_size);
+    int ct_len = in_len - aad_len - TA_AES_GCM_TAG_SIZE;
+
+    if (!cipher)
+        return -1;
+    return nw_gcm_decrypt(cipher, key, nonce, in, aad_len, in + aad_len,
+            ct_len, out, in + aad_len + ct_len, TA_AES_GCM_TAG_SIZE);
 }
 
 void prepare_tee_session(struct test_ctx *ctx)
@@ -185,7 +237,8 @@ void terminate_tee_session(struct test_ctx *ctx)
 	TEEC_FinalizeContext(&ctx->ctx);
 }
 
-double prepare_aes(struct test_ctx *ctx, int encode, int key_size)
+double prepare_aes_algo(struct test_ctx *ctx, uint32_t algo, int encode,
+        int key_size)
 {
     struct timeval t1, t2;
 	TEEC_Operation op;
@@ -198,7 +251,7 @@ double prepare_aes(struct test_ctx *ctx, int encode, int key_size)
 					 TEEC_VALUE_INPUT,
 					 TEEC_NONE);
 
-	op.params[0].value.a = TA_AES_ALGO_CTR;
+	op.params[0].value.a = algo;
 	//op.params[1].value.a = TA_AES_SIZE_128BIT;
 	op.params[1].value.a = key_size;
 	op.params[2].value.a = encode ? TA_AES_MODE_ENCODE :
@@ -214,6 +267,11 @@ double prepare_aes(struct test_ctx *ctx, int encode, int key_size)
     return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
 }
 
+double prepare_aes(struct test_ctx *ctx, int encode, int key_size)
+{
+    return prepare_aes_algo(ctx, TA_AES_ALGO_CTR, encode, key_size);
+}
+
 double set_key(struct test_ctx *ctx, char *key, size_t key_sz)
 {
     struct timeval t1, t2;
@@ -287,225 +345,1583 @@ double cipher_buffer(struct test_ctx *ctx, char *in, char *out, size_t sz)
     return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
 }
 
-int main(void)
+/*
+ * Cipher sz bytes of buf in place, with a single inout temporary reference
+ */
+double cipher_in_place(struct test_ctx *ctx, char *buf, size_t sz)
 {
-    // Initialise variables
-    struct timeval t1, t2, t3, t4, t5;
-	struct test_ctx ctx;
-    int key_sizes[] = {16, 32}; // Different AES key Sizes (in Bytes)
-    //int key_sizes[] = {16}; // Different AES key Sizes (in Bytes)
-    double enc_times_ns[2 * NUM_TESTS]; // Array to store encryption times
-    double dec_times_ns[2 * NUM_TESTS]; // Array to store decryption times
-    double enc_times_s[2 * NUM_TESTS]; // Array to store sec encryption times
-    double dec_times_s[2 * NUM_TESTS]; // Array to store sec decryption times
-    double prepare_times[4][2 * NUM_TESTS]; // Prepare times (full and InvkCMD)
-    double set_iv_times[4][2 * NUM_TESTS]; // Set IV times (full and InvkCMD)
-    double set_key_times[4][2 * NUM_TESTS]; // Set key times (full and invk)
-    double cipher_times[4][2 * NUM_TESTS]; // Cipher buffer times (full n inv)
-    size_t clear_text_len; // Clear text size, to estimate cipher text size
-
-    // Load text in clear TODO: include files with build
-    //char *clear_text = load_file(CLEAR_TEXT_PATH, &clear_text_len);
-    char clear_text[] = "Lorem ipsum dolor sit amet, consectetuer adipiscing elit. Aenean commodo ligula eget dolor. Aenean massa. Cum sociis natoque penatibus et magnis dis parturient montes, nascetur ridiculus mus. Donec quam felis, ultricies nec, pellentesque eu, pretium quis, sem. Nulla consequat massa quis enim. Donec pede justo, fringilla vel, aliquet nec, vulputate eget, arcu. In enim justo, rhoncus ut, imperdiet a, venenatis vitae, justo. Nullam dictum felis eu pede mollis pretium. Integer tincidunt. Cras dapibus. Vivamus elementum semper nisi. Aenean vulputate eleifend tellus. Aenean leo ligula, porttitor eu, consequat vitae, eleifend ac, enim. Aliquam lorem ante, dapibus in, viverra quis, feugiat a, tellus. Phasellus viverra nulla ut metus varius laoreet. Quisque rutrum. Aenean imperdiet. Etiam ultricies nisi vel augue. Curabitur ullamcorper ultricies nisi. Nam eget dui. Etiam rhoncus. Maecenas tempus, tellus eget condimentum rhoncus, sem quam semper libero, sit amet adipiscing sem neque sed ipsum. Nam quam nunc, blandit vel, luctus pulvinar, hendrerit id, lorem. Maecenas nec odio et ante tincidunt tempus. Donec vitae sapien ut libero venenatis faucibus. Nullam quis ante. Etiam sit amet orci eget eros faucibus tincidunt. Duis leo. Sed fringilla mauris sit amet nibh. Donec sodales sagittis magna. Sed consequat, leo eget bibendum sodales, augue velit cursus nunc, quis gravida magna mi a libero. Fusce vulputate eleifend sapien. Vestibulum purus quam, scelerisque ut, mollis sed, nonummy id, metus. Nullam accumsan lorem in dui. Cras ultricies mi eu turpis hendrerit fringilla. Vestibulum ante ipsum primis in faucibus orci luctus et ultrices posuere cubilia Curae; In ac dui quis mi consectetuer lacinia. Nam pretium turpis et arcu. Duis arcu tortor, suscipit eget, imperdiet nec, imperdiet iaculis, ipsum. Sed aliquam ultrices mauris. Integer ante arcu, accumsan a, consectetuer eget, posuere ut, mauris. Praesent adipiscing. Phasellus ullamcorper ipsum rutrum nunc. Nunc nonummy metus. Vestibulum volutpat pretium libero. Cras id dui. Aenean ut eros et nisl sagittis vestibulum. Nullam nulla eros, ultricies sit amet, nonummy id, imperdiet feugiat, pede. Sed lectus. Donec mollis hendrerit risus. Phasellus nec sem in justo pellentesque facilisis. Etiam imperdiet imperdiet orci. Nunc nec neque. Phasellus leo dolor, tempus non, auctor et, hendrerit quis, nisi. Curabitur ligula sapien, tincidunt non, euismod vitae, posuere imperdiet, leo. Maecenas malesuada. Praesent congue erat at massa. Sed cursus turpis vitae tortor. Donec posuere vulputate arcu. Phasellus accumsan cursus velit. Vestibulum ante ipsum primis in faucibus orci luctus et ultrices posuere cubilia Curae; Sed aliquam, nisi quis porttitor congue, elit erat euismod orci, ac placerat dolor lectus quis orci. Phasellus consectetuer vestibulum elit. Aenean tellus metus, bibendum sed, posuere ac, mattis non, nunc. Vestibulum fringilla pede sit amet augue. In turpis. Pellentesque posuere. Praesent turpis. Aenean posuere, tortor sed cursus feugiat, nunc augue blandit nunc, eu sollicitudin urna dolor sagittis lacus. Donec elit libero, sodales nec, volutpat a, suscipit non, turpis. Nullam sagittis. Suspendisse pulvinar, augue ac venenatis condimentum, sem libero volutpat nibh, nec pellentesque velit pede quis nunc. Vestibulum ante ipsum primis in faucibus orci luctus et ultrices posuere cubilia Curae; Fusce id purus. Ut varius tincidunt libero. Phasellus dolor. Maecenas vestibulum mollis diam. Pellentesque ut neque. Pellentesque habitant morbi tristique senectus et netus et malesuada fames ac turpis egestas. In dui magna, posuere eget, vestibulum et, tempor auctor, justo. In ac felis quis tortor malesuada pretium. Pellentesque auctor neque nec urna. Proin sapien ipsum, porta a, auctor quis, euismod ut, mi. Aenean viverra rhoncus pede. Pellentesque habitant morbi tristique senectus et netus et malesuada fames ac turpis egestas. Ut non enim eleifend felis pretium feugiat. Vivamus quis mi. Phasellus a est. Phasellus magna. In hac habitasse platea dictumst. Curabitur at lacus ac velit ornare lobortis. Cura";
- 
-    
-    // Prepare TEE Session
-	prepare_tee_session(&ctx);
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INOUT,
+					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = buf;
+	op.params[0].tmpref.size = sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_CIPHER,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(CIPHER) failed 0x%x origin 0x%x",
+			res, origin);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Point op at sz bytes of shared memory, in place when out is NULL
+ */
+void set_shm_params(TEEC_Operation *op, TEEC_SharedMemory *in,
+        TEEC_SharedMemory *out, size_t sz)
+{
+	memset(op, 0, sizeof(*op));
+	if (out) {
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INPUT,
+						  TEEC_MEMREF_PARTIAL_OUTPUT,
+						  TEEC_NONE, TEEC_NONE);
+		op->params[1].memref.parent = out;
+		op->params[1].memref.offset = 0;
+		op->params[1].memref.size = sz;
+	} else {
+		op->paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_PARTIAL_INOUT,
+						  TEEC_NONE, TEEC_NONE,
+						  TEEC_NONE);
+	}
+	op->params[0].memref.parent = in;
+	op->params[0].memref.offset = 0;
+	op->params[0].memref.size = sz;
+}
+
+/*
+ * Cipher sz bytes of shared memory, allocated or registered in the session
+ * context, so the buffers are not copied on invocation. in is ciphered in
+ * place when out is NULL.
+ */
+double cipher_shm(struct test_ctx *ctx, TEEC_SharedMemory *in,
+        TEEC_SharedMemory *out, size_t sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	set_shm_params(&op, in, out, sz);
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_CIPHER,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(CIPHER) failed 0x%x origin 0x%x",
+			res, origin);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+double set_slot_key(struct test_ctx *ctx, uint32_t slot, char *key,
+        size_t key_sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = slot;
+	op.params[1].tmpref.buffer = key;
+	op.params[1].tmpref.size = key_sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_SET_SLOT_KEY,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(SET_SLOT_KEY) failed 0x%x origin 0x%x",
+			res, origin);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Make SET_IV and CIPHER use the key of a slot, restarting it with iv
+ */
+double select_slot(struct test_ctx *ctx, uint32_t slot, char *iv,
+        size_t iv_sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = slot;
+	op.params[1].tmpref.buffer = iv;
+	op.params[1].tmpref.size = iv_sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_SELECT_SLOT,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(SELECT_SLOT) failed 0x%x origin 0x%x",
+			res, origin);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Cipher num_desc regions of buf in one invocation, see
+ * TA_AES_CMD_CIPHER_BATCH for the descriptor format.
+ */
+double cipher_batch(struct test_ctx *ctx, struct ta_aes_batch_desc *desc,
+        size_t num_desc, char *buf, size_t buf_sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INOUT,
+					 TEEC_VALUE_OUTPUT, TEEC_NONE);
+	op.params[0].tmpref.buffer = desc;
+	op.params[0].tmpref.size = sizeof(*desc) * num_desc;
+	op.params[1].tmpref.buffer = buf;
+	op.params[1].tmpref.size = buf_sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_CIPHER_BATCH,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(CIPHER_BATCH) failed 0x%x origin 0x%x"
+            " after %u entries", res, origin, op.params[2].value.a);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Throughput of batch_sz messages of msg_sz bytes each, ciphered with one
+ * SET_IV and CIPHER invocation per message and then with a single
+ * CIPHER_BATCH invocation over one buffer.
+ */
+int batch_benchmark(struct test_ctx *ctx)
+{
+    size_t msg_sizes[] = {256, 1024, 4096, 16384};
+    size_t batch_sizes[] = {1, 4, 16, 64};
+    const size_t num_msg_sizes = sizeof(msg_sizes) / sizeof(msg_sizes[0]);
+    const size_t num_batch_sizes = sizeof(batch_sizes) / sizeof(batch_sizes[0]);
+    double single_times[BATCH_TESTS], batch_times[BATCH_TESTS];
+    struct ta_aes_batch_desc *desc;
+    char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    char *in, *out;
+    size_t total;
+
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0xa1, sizeof(iv));
+    prepare_aes(ctx, ENCODE, TA_AES_SIZE_128BIT);
+    set_key(ctx, key, sizeof(key));
+    set_slot_key(ctx, 0, key, sizeof(key));
+
+    printf("--------------------------------------------------------------\n");
+    printf("AES 128 CTR BATCHED CIPHER BENCHMARK: %i RUNS\n", BATCH_TESTS);
+    printf("msg size\tbatch\tper msg (ms)\t\tbatched (ms)\t\tMB/s per msg"
+            "\tMB/s batched\n");
+    for (size_t i = 0; i < num_msg_sizes; i++) {
+        for (size_t j = 0; j < num_batch_sizes; j++) {
+            total = msg_sizes[i] * batch_sizes[j];
+            in = malloc(total);
+            out = malloc(total);
+            desc = calloc(batch_sizes[j], sizeof(*desc));
+            if (!in || !out || !desc)
+                errx(1, "Out of memory");
+            memset(in, 'a', total);
+            for (size_t k = 0; k < batch_sizes[j]; k++) {
+                desc[k].slot = 0;
+                desc[k].in_offset = k * msg_sizes[i];
+                desc[k].out_offset = k * msg_sizes[i];
+                desc[k].len = msg_sizes[i];
+                memcpy(desc[k].iv, iv, sizeof(iv));
+            }
+
+            for (int r = 0; r < BATCH_TESTS; r++) {
+                single_times[r] = 0.0;
+                for (size_t k = 0; k < batch_sizes[j]; k++) {
+                    single_times[r] += set_iv(ctx, iv, sizeof(iv));
+                    single_times[r] += cipher_buffer(ctx,
+                            in + k * msg_sizes[i], out + k * msg_sizes[i],
+                            msg_sizes[i]);
+                }
+                // Batched entries cipher the buffer in place
+                batch_times[r] = cipher_batch(ctx, desc, batch_sizes[j], in,
+                        total);
+            }
+
+            printf("%zu\t\t%zu\t%f %f\t%f %f\t%f\t%f\n", msg_sizes[i],
+                    batch_sizes[j], avg(single_times, BATCH_TESTS),
+                    stdev(single_times, BATCH_TESTS),
+                    avg(batch_times, BATCH_TESTS),
+                    stdev(batch_times, BATCH_TESTS),
+                    total / 1000.0 / avg(single_times, BATCH_TESTS),
+                    total / 1000.0 / avg(batch_times, BATCH_TESTS));
+            free(in);
+            free(out);
+            free(desc);
+        }
+    }
+    printf("--------------------------------------------------------------\n");
+    return 0;
+}
+
+/*
+ * Cipher NUM_TESTS messages of SLOT_MSG_SIZE bytes, using num_keys keys in
+ * turn. Each key switch is done by reallocating the operation (PREPARE +
+ * SET_KEY), by reloading the key (SET_KEY) and by selecting a pre-keyed
+ * slot (SELECT_SLOT). The times include the SET_IV and CIPHER calls.
+ */
+int slot_benchmark(struct test_ctx *ctx, int num_keys)
+{
+    double prepare_times[NUM_TESTS], set_key_times[NUM_TESTS];
+    double slot_times[NUM_TESTS];
+    char keys[TA_AES_MAX_SLOTS][TA_AES_SIZE_128BIT];
+    char iv[TA_AES_IV_SIZE];
+    char in[SLOT_MSG_SIZE], out[SLOT_MSG_SIZE];
+    int k;
+
+    if (num_keys < 1 || num_keys > TA_AES_MAX_SLOTS)
+        errx(1, "Number of keys shall be between 1 and %i", TA_AES_MAX_SLOTS);
+
+    memset(iv, 0xa1, sizeof(iv));
+    memset(in, 'a', sizeof(in));
+    for (k = 0; k < num_keys; k++)
+        memset(keys[k], 0xa0 + k, sizeof(keys[k]));
+
+    for (int j = 0; j < NUM_TESTS; j++) {
+        k = j % num_keys;
+        prepare_times[j] = prepare_aes(ctx, ENCODE, TA_AES_SIZE_128BIT);
+        prepare_times[j] += set_key(ctx, keys[k], sizeof(keys[k]));
+        prepare_times[j] += set_iv(ctx, iv, sizeof(iv));
+        prepare_times[j] += cipher_buffer(ctx, in, out, sizeof(in));
+    }
+
+    for (int j = 0; j < NUM_TESTS; j++) {
+        k = j % num_keys;
+        set_key_times[j] = set_key(ctx, keys[k], sizeof(keys[k]));
+        set_key_times[j] += set_iv(ctx, iv, sizeof(iv));
+        set_key_times[j] += cipher_buffer(ctx, in, out, sizeof(in));
+    }
+
+    // Keys are loaded once, outside of the timed loop
+    for (k = 0; k < num_keys; k++)
+        set_slot_key(ctx, k, keys[k], sizeof(keys[k]));
+    for (int j = 0; j < NUM_TESTS; j++) {
+        k = j % num_keys;
+        slot_times[j] = select_slot(ctx, k, iv, sizeof(iv));
+        slot_times[j] += cipher_buffer(ctx, in, out, sizeof(in));
+    }
+
+    printf("--------------------------------------------------------------\n");
+    printf("AES 128 CTR KEY SWITCH BENCHMARK: %i KEYS, %i B, %i RUNS\n",
+            num_keys, SLOT_MSG_SIZE, NUM_TESTS);
+    printf("prepare + set_key (ms) \t%f %f\n", avg(prepare_times, NUM_TESTS),
+            stdev(prepare_times, NUM_TESTS));
+    printf("set_key (ms) \t\t%f %f\n", avg(set_key_times, NUM_TESTS),
+            stdev(set_key_times, NUM_TESTS));
+    printf("select_slot (ms) \t%f %f\n", avg(slot_times, NUM_TESTS),
+            stdev(slot_times, NUM_TESTS));
+    printf("--------------------------------------------------------------\n");
+    return 0;
+}
+
+/*
+ * GCM encrypt (cmd TA_AES_CMD_GCM_ENCRYPT) or decrypt (TA_AES_CMD_GCM_DECRYPT)
+ * with the key of a slot. in holds aad_sz bytes of AAD followed by the rest
+ * of the message, see aes_ta.h for the layouts. *out_sz is updated with the
+ * output length.
+ */
+double gcm_buffer(struct test_ctx *ctx, uint32_t cmd, uint32_t slot,
+        char *nonce, char *in, size_t aad_sz, size_t in_sz, char *out,
+        size_t *out_sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT);
+	op.params[0].value.a = slot;
+	op.params[0].value.b = aad_sz;
+	op.params[1].tmpref.buffer = nonce;
+	op.params[1].tmpref.size = TA_AES_GCM_NONCE_SIZE;
+	op.params[2].tmpref.buffer = in;
+	op.params[2].tmpref.size = in_sz;
+	op.params[3].tmpref.buffer = out;
+	op.params[3].tmpref.size = *out_sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, cmd, &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(GCM) failed 0x%x origin 0x%x",
+			res, origin);
+    *out_sz = op.params[3].tmpref.size;
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Invoke cmd with op, *us receives the latency in microseconds. Failures
+ * are returned to the caller, as large buffers may not fit in the shared
+ * memory pool.
+ */
+TEEC_Result invoke_op(struct test_ctx *ctx, uint32_t cmd, TEEC_Operation *op,
+        double *us)
+{
+    struct timespec t1, t2;
+	uint32_t origin;
+	TEEC_Result res;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+	res = TEEC_InvokeCommand(&ctx->sess, cmd, op, &origin);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    *us = (t2.tv_sec - t1.tv_sec) * 1e6 + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+    return res;
+}
+
+/*
+ * invoke_op() with sz bytes of in and out as temporary references, the way
+ * CIPHER takes them
+ */
+TEEC_Result invoke_buffers(struct test_ctx *ctx, uint32_t cmd, char *in,
+        char *out, size_t sz, double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = in;
+	op.params[0].tmpref.size = sz;
+	op.params[1].tmpref.buffer = out;
+	op.params[1].tmpref.size = sz;
+
+    return invoke_op(ctx, cmd, &op, us);
+}
+
+/*
+ * Load key into the HMAC-SHA256 MAC slot slot
+ */
+double mac_set_key(struct test_ctx *ctx, uint32_t slot, char *key,
+        size_t key_sz)
+{
+    struct timeval t1, t2;
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = slot;
+	op.params[1].tmpref.buffer = key;
+	op.params[1].tmpref.size = key_sz;
+
+    gettimeofday(&t1, NULL);
+	res = TEEC_InvokeCommand(&ctx->sess, TA_AES_CMD_MAC_SET_KEY,
+				 &op, &origin);
+    gettimeofday(&t2, NULL);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InvokeCommand(MAC_SET_KEY) failed 0x%x origin 0x%x",
+			res, origin);
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Add sz bytes of in to the message of a MAC slot, *us receives the latency
+ * in microseconds
+ */
+TEEC_Result mac_update(struct test_ctx *ctx, uint32_t slot, char *in,
+        size_t sz, double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = slot;
+	op.params[1].tmpref.buffer = in;
+	op.params[1].tmpref.size = sz;
+
+    return invoke_op(ctx, TA_AES_CMD_MAC_UPDATE, &op, us);
+}
+
+/*
+ * Add the last sz bytes of in (sz may be 0) and get the TA_AES_MAC_SIZE
+ * bytes HMAC of a MAC slot into mac
+ */
+TEEC_Result mac_final(struct test_ctx *ctx, uint32_t slot, char *in,
+        size_t sz, unsigned char *mac, double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE);
+	op.params[0].value.a = slot;
+	op.params[1].tmpref.buffer = in;
+	op.params[1].tmpref.size = sz;
+	op.params[2].tmpref.buffer = mac;
+	op.params[2].tmpref.size = TA_AES_MAC_SIZE;
+
+    return invoke_op(ctx, TA_AES_CMD_MAC_FINAL, &op, us);
+}
+
+TEEC_Result digest_update(struct test_ctx *ctx, char *in, size_t sz,
+        double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = in;
+	op.params[0].tmpref.size = sz;
+
+    return invoke_op(ctx, TA_AES_CMD_DIGEST_UPDATE, &op, us);
+}
+
+TEEC_Result digest_final(struct test_ctx *ctx, char *in, size_t sz,
+        unsigned char *digest, double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = in;
+	op.params[0].tmpref.size = sz;
+	op.params[1].tmpref.buffer = digest;
+	op.params[1].tmpref.size = TA_AES_DIGEST_SIZE;
+
+    return invoke_op(ctx, TA_AES_CMD_DIGEST_FINAL, &op, us);
+}
+
+/*
+ * Fill out with sz / iv_sz IVs drawn one at a time from source
+ * (TA_AES_RAND_DIRECT or TA_AES_RAND_POOL) in the TA
+ */
+TEEC_Result gen_iv(struct test_ctx *ctx, uint32_t source, size_t iv_sz,
+        char *out, size_t sz, double *us)
+{
+	TEEC_Operation op;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+	op.params[0].value.a = source;
+	op.params[0].value.b = iv_sz;
+	op.params[1].tmpref.buffer = out;
+	op.params[1].tmpref.size = sz;
+
+    return invoke_op(ctx, TA_AES_CMD_GEN_IV, &op, us);
+}
+
+/*
+ * AES-128-CBC encryption of SWEEP_MIN_SIZE to SWEEP_MAX_SIZE bytes in
+ * powers of two, with OpenSSL and with one CIPHER invocation (key and IV are
+ * set once). The secure time is split into the invocation cost, measured
+ * with TRANSFER which moves the same buffers without ciphering, and the
+ * remaining cipher time. Latencies are in microseconds; clock_gettime() is
+ * used as gettimeofday() is too coarse for the small sizes.
+ */
+int sweep_benchmark(struct test_ctx *ctx)
+{
+    struct timespec t1, t2;
+    double nw_times[NUM_TESTS], sw_times[NUM_TESTS], xfer_times[NUM_TESTS];
+    unsigned char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    double nw_avg, sw_avg, sw_p50, xfer_p50;
+    bool secure = true;
+    TEEC_Result res;
+    char *in, *out;
+    int runs;
+
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0xa1, sizeof(iv));
+    // OpenSSL pads, leave room for one more block
+    in = malloc(SWEEP_MAX_SIZE);
+    out = malloc(SWEEP_MAX_SIZE + TA_AES_BLOCK_SIZE);
+    if (!in || !out)
+        errx(1, "Out of memory");
+    memset(in, 'a', SWEEP_MAX_SIZE);
+
+    prepare_aes_algo(ctx, TA_AES_ALGO_CBC, ENCODE, sizeof(key));
+    set_key(ctx, (char *) key, sizeof(key));
+    set_iv(ctx, (char *) iv, sizeof(iv));
+
+    printf("--------------------------------------------------------------\n");
+    printf("AES 128 CBC ENCRYPT PAYLOAD SWEEP (%i runs, %i above %i B)\n",
+            NUM_TESTS, SWEEP_LARGE_TESTS, SWEEP_LARGE_SIZE);
+    printf("size\tNS MB/s\tNS ns/B\tNS p50\tNS p99\t"
+            "S MB/s\tS ns/B\tS p50\tS p99\tS invoke p50\tS cipher p50\n");
+    for (size_t sz = SWEEP_MIN_SIZE; sz <= SWEEP_MAX_SIZE; sz *= 2) {
+        runs = sz > SWEEP_LARGE_SIZE ? SWEEP_LARGE_TESTS : NUM_TESTS;
+
+        for (int r = 0; r < runs; r++) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            encrypt((unsigned char *) in, sz, key, iv, (unsigned char *) out,
+                    sizeof(key));
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            nw_times[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+        }
+        nw_avg = avg(nw_times, runs);
+        printf("%zu\t%.2f\t%.2f\t%.2f\t%.2f", sz, sz / nw_avg,
+                nw_avg * 1000.0 / sz, percentile(nw_times, runs, 50),
+                percentile(nw_times, runs, 99));
+
+        for (int r = 0; secure && r < runs; r++) {
+            res = invoke_buffers(ctx, TA_AES_CMD_TRANSFER, in, out, sz,
+                    &xfer_times[r]);
+            if (res == TEEC_SUCCESS)
+                res = invoke_buffers(ctx, TA_AES_CMD_CIPHER, in, out, sz,
+                        &sw_times[r]);
+            if (res != TEEC_SUCCESS) {
+                printf("\tsecure world failed 0x%x", res);
+                secure = false;
+            }
+        }
+        if (secure) {
+            sw_avg = avg(sw_times, runs);
+            sw_p50 = percentile(sw_times, runs, 50);
+            xfer_p50 = percentile(xfer_times, runs, 50);
+            printf("\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t\t%.2f", sz / sw_avg,
+                    sw_avg * 1000.0 / sz, sw_p50,
+                    percentile(sw_times, runs, 99), xfer_p50,
+                    sw_p50 - xfer_p50);
+        }
+        printf("\n");
+    }
+    printf("--------------------------------------------------------------\n");
+
+    free(in);
+    free(out);
+    return 0;
+}
+
+/*
+ * AES-CTR over several TA sessions. Each session is a TA instance of its
+ * own, so segments are ciphered on as many secure threads as OP-TEE has
+ * (CFG_NUM_THREADS).
+ */
+struct parallel_ctr {
+    struct test_ctx sessions[CTR_MAX_SESSIONS];
+    int num_sessions;
+};
+
+struct ctr_segment {
+    struct test_ctx *ctx;
+    char iv[TA_AES_IV_SIZE];
+    char *buf;
+    size_t sz;
+    TEEC_Result res;
+};
+
+/*
+ * Open num_sessions sessions, each prepared for AES-CTR with key
+ */
+void parallel_ctr_open(struct parallel_ctr *pc, int num_sessions, char *key,
+        size_t key_sz)
+{
+    if (num_sessions < 1 || num_sessions > CTR_MAX_SESSIONS)
+        errx(1, "Number of sessions shall be between 1 and %i",
+                CTR_MAX_SESSIONS);
+    pc->num_sessions = num_sessions;
+    for (int i = 0; i < num_sessions; i++) {
+        prepare_tee_session(&pc->sessions[i]);
+        prepare_aes(&pc->sessions[i], ENCODE, key_sz);
+        set_key(&pc->sessions[i], key, key_sz);
+    }
+}
+
+void parallel_ctr_close(struct parallel_ctr *pc)
+{
+    for (int i = 0; i < pc->num_sessions; i++)
+        terminate_tee_session(&pc->sessions[i]);
+    pc->num_sessions = 0;
+}
+
+void *ctr_segment_thread(void *arg)
+{
+    struct ctr_segment *seg = arg;
+	TEEC_Operation op;
+    double us;
+
+    set_iv(seg->ctx, seg->iv, sizeof(seg->iv));
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INOUT,
+					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
+	op.params[0].tmpref.buffer = seg->buf;
+	op.params[0].tmpref.size = seg->sz;
+    // A failure is reported by the caller, large tmprefs may not fit
+    seg->res = invoke_op(seg->ctx, TA_AES_CMD_CIPHER, &op, &us);
+    return NULL;
+}
+
+/*
+ * Cipher sz bytes of buf in place with AES-CTR starting at counter iv. The
+ * buffer is split into one block aligned segment per session, each
+ * starting at the counter of its first block, and the segments are
+ * ciphered concurrently. The result is the same as one CTR pass. *ms
+ * receives the elapsed time.
+ */
+TEEC_Result parallel_ctr_cipher(struct parallel_ctr *pc, char *iv, char *buf,
+        size_t sz, double *ms)
+{
+    struct timeval t1, t2;
+    struct ctr_segment segs[CTR_MAX_SESSIONS];
+    pthread_t threads[CTR_MAX_SESSIONS];
+    size_t blocks = (sz + TA_AES_BLOCK_SIZE - 1) / TA_AES_BLOCK_SIZE;
+    size_t seg_sz, off;
+    int num_segs = 0;
+
+    seg_sz = (blocks + pc->num_sessions - 1) / pc->num_sessions
+        * TA_AES_BLOCK_SIZE;
+    for (off = 0; off < sz; off += seg_sz, num_segs++) {
+        segs[num_segs].ctx = &pc->sessions[num_segs];
+        memcpy(segs[num_segs].iv, iv, TA_AES_IV_SIZE);
+        nw_ctr_add((unsigned char *) segs[num_segs].iv,
+                off / TA_AES_BLOCK_SIZE);
+        segs[num_segs].buf = buf + off;
+        segs[num_segs].sz = sz - off < seg_sz ? sz - off : seg_sz;
+    }
+
+    gettimeofday(&t1, NULL);
+    // The calling thread takes the first segment
+    for (int i = 1; i < num_segs; i++)
+        if (pthread_create(&threads[i], NULL, ctr_segment_thread, &segs[i]))
+            errx(1, "Could not start segment thread");
+    if (num_segs)
+        ctr_segment_thread(&segs[0]);
+    for (int i = 1; i < num_segs; i++)
+        pthread_join(threads[i], NULL);
+    gettimeofday(&t2, NULL);
+
+    *ms = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+    for (int i = 0; i < num_segs; i++)
+        if (segs[i].res != TEEC_SUCCESS)
+            return segs[i].res;
+    return TEEC_SUCCESS;
+}
+
+/*
+ * AES-128-CTR over CTR_PARALLEL_SIZE bytes with 1 to max_sessions
+ * concurrent sessions. The first run of each count is checked against
+ * OpenSSL. A count whose segments the TEE cannot take as temporary
+ * references is reported and skipped.
+ */
+int parallel_ctr_benchmark(int max_sessions)
+{
+    struct parallel_ctr pc;
+    double times[SWEEP_LARGE_TESTS], base = 0.0, mean;
+    char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    char *buf, *ref;
+    TEEC_Result res = TEEC_SUCCESS;
+
+    if (max_sessions > CTR_MAX_SESSIONS)
+        max_sessions = CTR_MAX_SESSIONS;
+    memset(key, 0xa5, sizeof(key));
+    // Start close to a carry so segments have to propagate it
+    memset(iv, 0xff, sizeof(iv));
+    iv[0] = 0x01;
+    buf = malloc(CTR_PARALLEL_SIZE);
+    ref = malloc(CTR_PARALLEL_SIZE);
+    if (!buf || !ref)
+        errx(1, "Out of memory");
+    memset(buf, 'a', CTR_PARALLEL_SIZE);
+    if (nw_cipher(EVP_aes_128_ctr(), (unsigned char *) key,
+                (unsigned char *) iv, 1, (unsigned char *) buf,
+                CTR_PARALLEL_SIZE, (unsigned char *) ref) < 0)
+        errx(1, "OpenSSL CTR failed");
+
+    printf("--------------------------------------------------------------\n");
+    printf("S AES 128 CTR PARALLEL SESSIONS, %i B: %i RUNS\n",
+            CTR_PARALLEL_SIZE, SWEEP_LARGE_TESTS);
+    printf("sessions\tms avg stdev\t\tMB/s\tspeedup\n");
+    for (int n = 1; n <= max_sessions; n++) {
+        parallel_ctr_open(&pc, n, key, sizeof(key));
+        for (int r = 0; r < SWEEP_LARGE_TESTS; r++) {
+            memset(buf, 'a', CTR_PARALLEL_SIZE);
+            res = parallel_ctr_cipher(&pc, iv, buf, CTR_PARALLEL_SIZE,
+                    &times[r]);
+            if (res != TEEC_SUCCESS)
+                break;
+            if (!r && memcmp(buf, ref, CTR_PARALLEL_SIZE))
+                errx(1, "Parallel CTR with %i sessions differs from OpenSSL",
+                        n);
+        }
+        parallel_ctr_close(&pc);
+        if (res != TEEC_SUCCESS) {
+            printf("%i\t\tsecure world failed 0x%x\n", n, res);
+            continue;
+        }
+        mean = avg(times, SWEEP_LARGE_TESTS);
+        // Speedup against the smallest count that ran
+        if (!base)
+            base = mean;
+        printf("%i\t\t%f %f\t%.2f\t%.2f\n", n, mean,
+                stdev(times, SWEEP_LARGE_TESTS),
+                CTR_PARALLEL_SIZE / 1000.0 / mean, base / mean);
+    }
+    printf("--------------------------------------------------------------\n");
+
+    nw_crypto_thread_release();
+    free(buf);
+    free(ref);
+    return 0;
+}
+
+/*
+ * Streaming file encryption. Chunks rotate through PIPE_BUFFERS registered
+ * shared buffers: while the TA ciphers chunk N in place, the I/O thread
+ * writes chunk N - 1 out and reads chunk N + 1 in. The session is keyed
+ * and given its IV once, each CIPHER call continues the CTR stream of the
+ * previous one, so every chunk but the last is a multiple of the block
+ * size.
+ */
+enum pipe_state {
+    PIPE_FREE,          // owned by the I/O thread, to be read into
+    PIPE_FILLED,        // waiting for the TA
+    PIPE_DONE           // ciphered, to be written out
+};
+
+struct pipe_buf {
+    TEEC_SharedMemory shm;
+    size_t len;
+    enum pipe_state state;
+};
+
+struct file_pipe {
+    struct test_ctx *ctx;
+    struct pipe_buf bufs[PIPE_BUFFERS];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool eof;
+};
+
+// Read until sz bytes or end of file
+size_t read_full(int fd, char *buf, size_t sz)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < sz) {
+        n = read(fd, buf + done, sz - done);
+        if (n < 0)
+            err(1, "read");
+        if (!n)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+void write_full(int fd, char *buf, size_t sz)
+{
+    ssize_t n;
+
+    while (sz) {
+        n = write(fd, buf, sz);
+        if (n < 0)
+            err(1, "write");
+        buf += n;
+        sz -= n;
+    }
+}
+
+void *pipe_cipher_thread(void *arg)
+{
+    struct file_pipe *fp = arg;
+    struct pipe_buf *buf;
+
+    pthread_mutex_lock(&fp->lock);
+    for (int i = 0; ; i = (i + 1) % PIPE_BUFFERS) {
+        buf = &fp->bufs[i];
+        // Buffers are filled in order, a free one after EOF ends the file
+        while (buf->state != PIPE_FILLED && !fp->eof)
+            pthread_cond_wait(&fp->cond, &fp->lock);
+        if (buf->state != PIPE_FILLED)
+            break;
+        pthread_mutex_unlock(&fp->lock);
+
+        cipher_shm(fp->ctx, &buf->shm, NULL, buf->len);
+
+        pthread_mutex_lock(&fp->lock);
+        buf->state = PIPE_DONE;
+        pthread_cond_broadcast(&fp->cond);
+    }
+    pthread_mutex_unlock(&fp->lock);
+    return NULL;
+}
+
+/*
+ * AES-CTR encrypt in_path into out_path through the TA, pipelined or one
+ * chunk at a time. Returns the time in ms, *size receives the file size.
+ */
+double encrypt_file(struct test_ctx *ctx, const char *in_path,
+        const char *out_path, char *key, size_t key_sz, char *iv,
+        bool pipelined, size_t *size)
+{
+    struct timeval t1, t2;
+    struct file_pipe fp;
+    struct pipe_buf *buf;
+    pthread_t thread;
+    int in_fd, out_fd;
+    int rd = 0, wr = 0;
+    TEEC_Result res;
+
+    in_fd = open(in_path, O_RDONLY);
+    if (in_fd < 0)
+        err(1, "%s", in_path);
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (out_fd < 0)
+        err(1, "%s", out_path);
+
+    memset(&fp, 0, sizeof(fp));
+    fp.ctx = ctx;
+    pthread_mutex_init(&fp.lock, NULL);
+    pthread_cond_init(&fp.cond, NULL);
+    for (int i = 0; i < PIPE_BUFFERS; i++) {
+        buf = &fp.bufs[i];
+        buf->shm.buffer = malloc(PIPE_CHUNK_SIZE);
+        buf->shm.size = PIPE_CHUNK_SIZE;
+        buf->shm.flags = TEEC_MEM_INPUT | TEEC_MEM_OUTPUT;
+        if (!buf->shm.buffer)
+            errx(1, "Out of memory");
+        res = TEEC_RegisterSharedMemory(&ctx->ctx, &buf->shm);
+        if (res != TEEC_SUCCESS)
+            errx(1, "TEEC_RegisterSharedMemory failed with code 0x%x", res);
+    }
+
+    prepare_aes(ctx, ENCODE, key_sz);
+    set_key(ctx, key, key_sz);
+    set_iv(ctx, iv, TA_AES_IV_SIZE);
+    *size = 0;
+
+    gettimeofday(&t1, NULL);
+    if (!pipelined) {
+        buf = &fp.bufs[0];
+        while ((buf->len = read_full(in_fd, buf->shm.buffer,
+                        PIPE_CHUNK_SIZE))) {
+            cipher_shm(ctx, &buf->shm, NULL, buf->len);
+            write_full(out_fd, buf->shm.buffer, buf->len);
+            *size += buf->len;
+        }
+    } else {
+        if (pthread_create(&thread, NULL, pipe_cipher_thread, &fp))
+            errx(1, "Could not start cipher thread");
+        pthread_mutex_lock(&fp.lock);
+        for (;;) {
+            // Write first, it frees a buffer for the next read
+            buf = &fp.bufs[wr];
+            if (buf->state == PIPE_DONE) {
+                pthread_mutex_unlock(&fp.lock);
+                write_full(out_fd, buf->shm.buffer, buf->len);
+                *size += buf->len;
+                pthread_mutex_lock(&fp.lock);
+                buf->state = PIPE_FREE;
+                wr = (wr + 1) % PIPE_BUFFERS;
+                continue;
+            }
+            buf = &fp.bufs[rd];
+            if (!fp.eof && buf->state == PIPE_FREE) {
+                pthread_mutex_unlock(&fp.lock);
+                buf->len = read_full(in_fd, buf->shm.buffer, PIPE_CHUNK_SIZE);
+                pthread_mutex_lock(&fp.lock);
+                if (buf->len) {
+                    buf->state = PIPE_FILLED;
+                    rd = (rd + 1) % PIPE_BUFFERS;
+                }
+                // A short chunk is the last one
+                if (buf->len < PIPE_CHUNK_SIZE)
+                    fp.eof = true;
+                pthread_cond_broadcast(&fp.cond);
+                continue;
+            }
+            if (fp.eof && fp.bufs[wr].state == PIPE_FREE)
+                break;
+            pthread_cond_wait(&fp.cond, &fp.lock);
+        }
+        pthread_mutex_unlock(&fp.lock);
+        pthread_join(thread, NULL);
+    }
+    gettimeofday(&t2, NULL);
+
+    for (int i = 0; i < PIPE_BUFFERS; i++) {
+        TEEC_ReleaseSharedMemory(&fp.bufs[i].shm);
+        free(fp.bufs[i].shm.buffer);
+    }
+    pthread_mutex_destroy(&fp.lock);
+    pthread_cond_destroy(&fp.cond);
+    close(in_fd);
+    if (close(out_fd))
+        err(1, "%s", out_path);
+
+    return (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec)/1000.0;
+}
+
+/*
+ * Return true if the files at path_a and path_b have the same contents
+ */
+bool same_file_contents(const char *path_a, const char *path_b)
+{
+    char *buf_a, *buf_b;
+    ssize_t len_a, len_b;
+    bool same = true;
+    int fd_a, fd_b;
+
+    fd_a = open(path_a, O_RDONLY);
+    if (fd_a < 0)
+        err(1, "%s", path_a);
+    fd_b = open(path_b, O_RDONLY);
+    if (fd_b < 0)
+        err(1, "%s", path_b);
+    buf_a = malloc(PIPE_CHUNK_SIZE);
+    buf_b = malloc(PIPE_CHUNK_SIZE);
+    if (!buf_a || !buf_b)
+        errx(1, "Out of memory");
+
+    // Regular files: read() only returns short at the end
+    do {
+        len_a = read(fd_a, buf_a, PIPE_CHUNK_SIZE);
+        len_b = read(fd_b, buf_b, PIPE_CHUNK_SIZE);
+        if (len_a < 0 || len_b < 0)
+            err(1, "read");
+        if (len_a != len_b || memcmp(buf_a, buf_b, len_a))
+            same = false;
+    } while (same && len_a);
+
+    free(buf_a);
+    free(buf_b);
+    close(fd_a);
+    close(fd_b);
+    return same;
+}
+
+/*
+ * Encrypt a file one chunk at a time into <out>.seq and pipelined into
+ * <out>. Both outputs shall be identical, the run fails otherwise.
+ */
+int file_benchmark(struct test_ctx *ctx, const char *in_path,
+        const char *out_path)
+{
+    char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    double seq_time, pipe_time;
+    char *seq_path;
+    size_t size;
+
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0xa1, sizeof(iv));
+    seq_path = malloc(strlen(out_path) + sizeof(".seq"));
+    if (!seq_path)
+        errx(1, "Out of memory");
+    sprintf(seq_path, "%s.seq", out_path);
+
+    seq_time = encrypt_file(ctx, in_path, seq_path, key, sizeof(key), iv,
+            false, &size);
+    pipe_time = encrypt_file(ctx, in_path, out_path, key, sizeof(key), iv,
+            true, &size);
+    if (!same_file_contents(seq_path, out_path))
+        errx(1, "Pipelined output %s differs from sequential output %s",
+                out_path, seq_path);
+    unlink(seq_path);
+    free(seq_path);
+
+    printf("--------------------------------------------------------------\n");
+    printf("S AES 128 CTR FILE ENCRYPTION, %zu B in %i B chunks\n", size,
+            PIPE_CHUNK_SIZE);
+    printf("sequential (ms) \t%f\t%.2f MB/s\n", seq_time,
+            size / 1000.0 / seq_time);
+    printf("pipelined (ms) \t\t%f\t%.2f MB/s\n", pipe_time,
+            size / 1000.0 / pipe_time);
+    printf("--------------------------------------------------------------\n");
+    return 0;
+}
+
+/*
+ * Buffer passing modes of shm_benchmark()
+ */
+enum buf_mode {
+    BUF_TMPREF,
+    BUF_TMPREF_IN_PLACE,
+    BUF_ALLOCATED,
+    BUF_ALLOCATED_IN_PLACE,
+    BUF_REGISTERED,
+    BUF_REGISTERED_IN_PLACE,
+    NUM_BUF_MODES
+};
+
+const char *buf_mode_names[NUM_BUF_MODES] = {
+    "tmpref", "tmpref in place", "allocated", "allocated in place",
+    "registered", "registered in place"
+};
+
+struct buf_setup {
+    TEEC_SharedMemory shm[2];
+    int num_shm;
+    TEEC_Operation op;
+};
+
+void release_buf_mode(struct buf_setup *setup)
+{
+    for (int i = 0; i < setup->num_shm; i++)
+        TEEC_ReleaseSharedMemory(&setup->shm[i]);
+    setup->num_shm = 0;
+}
+
+/*
+ * Prepare the CIPHER operation for sz bytes of in (and out) in the given
+ * mode. Allocated shared memory is filled from in once, here, as a caller
+ * would produce its data straight into it.
+ */
+TEEC_Result setup_buf_mode(struct test_ctx *ctx, int mode, char *in,
+        char *out, size_t sz, struct buf_setup *setup)
+{
+    bool in_place = mode == BUF_ALLOCATED_IN_PLACE ||
+        mode == BUF_REGISTERED_IN_PLACE;
+    bool registered = mode == BUF_REGISTERED ||
+        mode == BUF_REGISTERED_IN_PLACE;
+    TEEC_Result res = TEEC_SUCCESS;
+    int num_shm = in_place ? 1 : 2;
+
+    memset(setup, 0, sizeof(*setup));
+    switch (mode) {
+        case BUF_TMPREF:
+            setup->op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+                    TEEC_MEMREF_TEMP_OUTPUT, TEEC_NONE, TEEC_NONE);
+            setup->op.params[0].tmpref.buffer = in;
+            setup->op.params[0].tmpref.size = sz;
+            setup->op.params[1].tmpref.buffer = out;
+            setup->op.params[1].tmpref.size = sz;
+            return TEEC_SUCCESS;
+        case BUF_TMPREF_IN_PLACE:
+            setup->op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INOUT,
+                    TEEC_NONE, TEEC_NONE, TEEC_NONE);
+            setup->op.params[0].tmpref.buffer = in;
+            setup->op.params[0].tmpref.size = sz;
+            return TEEC_SUCCESS;
+        default:
+            break;
+    }
+
+    setup->shm[0].size = sz;
+    setup->shm[0].flags = TEEC_MEM_INPUT | (in_place ? TEEC_MEM_OUTPUT : 0);
+    setup->shm[1].size = sz;
+    setup->shm[1].flags = TEEC_MEM_OUTPUT;
+    for (int i = 0; i < num_shm && res == TEEC_SUCCESS; i++) {
+        if (registered) {
+            setup->shm[i].buffer = i ? out : in;
+            res = TEEC_RegisterSharedMemory(&ctx->ctx, &setup->shm[i]);
+        } else {
+            res = TEEC_AllocateSharedMemory(&ctx->ctx, &setup->shm[i]);
+        }
+        if (res == TEEC_SUCCESS)
+            setup->num_shm++;
+    }
+    if (res != TEEC_SUCCESS) {
+        release_buf_mode(setup);
+        return res;
+    }
+    if (!registered)
+        memcpy(setup->shm[0].buffer, in, sz);
+
+    set_shm_params(&setup->op, &setup->shm[0],
+            in_place ? NULL : &setup->shm[1], sz);
+    return TEEC_SUCCESS;
+}
+
+/*
+ * CIPHER invocation latency for each buf_mode from SHM_MIN_SIZE to
+ * SWEEP_MAX_SIZE bytes. Setup is the one-off cost of allocating or
+ * registering (and releasing) the shared memory for that size.
+ */
+int shm_benchmark(struct test_ctx *ctx)
+{
+    struct timespec t1, t2;
+    double times[NUM_TESTS];
+    char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    struct buf_setup setup;
+    double setup_us, mean;
+    TEEC_Result res;
+    char *in, *out;
+    int runs, r;
+
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0xa1, sizeof(iv));
+    in = malloc(SWEEP_MAX_SIZE);
+    out = malloc(SWEEP_MAX_SIZE);
+    if (!in || !out)
+        errx(1, "Out of memory");
+    memset(in, 'a', SWEEP_MAX_SIZE);
+
+    prepare_aes(ctx, ENCODE, sizeof(key));
+    set_key(ctx, key, sizeof(key));
+    set_iv(ctx, iv, sizeof(iv));
+
+    printf("--------------------------------------------------------------\n");
+    printf("AES 128 CTR SHARED MEMORY MODES (us, %i runs, %i above %i B)\n",
+            NUM_TESTS, SWEEP_LARGE_TESTS, SWEEP_LARGE_SIZE);
+    printf("size\t\tmode\t\t\tsetup\t\tavg stdev\t\tMB/s\n");
+    for (size_t sz = SHM_MIN_SIZE; sz <= SWEEP_MAX_SIZE; sz *= 4) {
+        runs = sz > SWEEP_LARGE_SIZE ? SWEEP_LARGE_TESTS : NUM_TESTS;
+        for (int mode = 0; mode < NUM_BUF_MODES; mode++) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            res = setup_buf_mode(ctx, mode, in, out, sz, &setup);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            setup_us = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+            for (r = 0; res == TEEC_SUCCESS && r < runs; r++)
+                res = invoke_op(ctx, TA_AES_CMD_CIPHER, &setup.op,
+                        &times[r]);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            release_buf_mode(&setup);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            setup_us += (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+
+            if (res != TEEC_SUCCESS) {
+                printf("%zu\t\t%-20s\tfailed 0x%x\n", sz,
+                        buf_mode_names[mode], res);
+                continue;
+            }
+            mean = avg(times, runs);
+            printf("%zu\t\t%-20s\t%.2f\t\t%.2f %.2f\t\t%.2f\n", sz,
+                    buf_mode_names[mode], setup_us, mean,
+                    stdev(times, runs), sz / mean);
+        }
+    }
+    printf("--------------------------------------------------------------\n");
+
+    free(in);
+    free(out);
+    return 0;
+}
+
+/*
+ * Normal world engine: per call cost of a new context against a reused
+ * keyed one (AES-128-CBC), then AES-128-CTR throughput over
+ * NW_SCALING_SIZE bytes with 1 to max_threads threads.
+ */
+int nw_benchmark(int max_threads)
+{
+    struct timespec t1, t2;
+    size_t sizes[] = {16, 1024, 16384};
+    const size_t num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    double oneshot_times[NUM_TESTS], reuse_times[NUM_TESTS];
+    double times[SWEEP_LARGE_TESTS], base = 0.0, mean;
+    unsigned char key[TA_AES_SIZE_128BIT], iv[TA_AES_IV_SIZE];
+    unsigned char *in, *out;
+
+    if (max_threads < 1)
+        max_threads = 1;
+    memset(key, 0xa5, sizeof(key));
+    memset(iv, 0xa1, sizeof(iv));
+    in = malloc(NW_SCALING_SIZE);
+    out = malloc(NW_SCALING_SIZE + TA_AES_BLOCK_SIZE);
+    if (!in || !out)
+        errx(1, "Out of memory");
+    memset(in, 'a', NW_SCALING_SIZE);
+    if (nw_crypto_init(max_threads))
+        errx(1, "Could not start %i crypto threads", max_threads);
+
+    printf("--------------------------------------------------------------\n");
+    printf("NS AES 128 CBC CONTEXT REUSE (us): %i RUNS\n", NUM_TESTS);
+    printf("size\tnew context\t\treused context\n");
+    for (size_t i = 0; i < num_sizes; i++) {
+        for (int r = 0; r < NUM_TESTS; r++) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            nw_cipher_oneshot(EVP_aes_128_cbc(), key, iv, 1, in, sizes[i],
+                    out);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            oneshot_times[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            nw_cipher(EVP_aes_128_cbc(), key, iv, 1, in, sizes[i], out);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            reuse_times[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+        }
+        printf("%zu\t%f %f\t%f %f\n", sizes[i],
+                avg(oneshot_times, NUM_TESTS),
+                stdev(oneshot_times, NUM_TESTS),
+                avg(reuse_times, NUM_TESTS), stdev(reuse_times, NUM_TESTS));
+    }
+
+    printf("NS AES 128 CTR SCALING, %i B: %i RUNS\n", NW_SCALING_SIZE,
+            SWEEP_LARGE_TESTS);
+    printf("threads\tms avg stdev\t\tMB/s\tspeedup\n");
+    for (int n = 1; n <= max_threads; n++) {
+        for (int r = 0; r < SWEEP_LARGE_TESTS; r++) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (nw_cipher_parallel(EVP_aes_128_ctr(), key, iv, in,
+                        NW_SCALING_SIZE, out, n) < 0)
+                errx(1, "Parallel CTR failed");
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            times[r] = (t2.tv_sec - t1.tv_sec) * 1000.0
+                + (t2.tv_nsec - t1.tv_nsec) / 1e6;
+        }
+        mean = avg(times, SWEEP_LARGE_TESTS);
+        if (n == 1)
+            base = mean;
+        printf("%i\t%f %f\t%.2f\t%.2f\n", n, mean,
+                stdev(times, SWEEP_LARGE_TESTS),
+                NW_SCALING_SIZE / 1000.0 / mean, base / mean);
+    }
+    printf("--------------------------------------------------------------\n");
+
+    nw_crypto_release();
+    free(in);
+    free(out);
+    return 0;
+}
+
+/*
+ * Single call AES-GCM encrypt-and-tag and verify-and-decrypt in the secure
+ * world against OpenSSL in the normal world, for both key sizes and a few
+ * payload sizes. Encryption and decryption use one session each, as a
+ * session is prepared for one direction.
+ */
+int gcm_benchmark(struct test_ctx *ctx)
+{
+    struct timeval t1, t2;
+    struct test_ctx dec_ctx;
+    int key_sizes[] = {16, 32};
+    size_t payload_sizes[] = {64, 1024, 4096, 16384};
+    const size_t num_payload_sizes = sizeof(payload_sizes) /
+        sizeof(payload_sizes[0]);
+    double enc_s[NUM_TESTS], dec_s[NUM_TESTS];
+    double enc_ns[NUM_TESTS], dec_ns[NUM_TESTS];
+    char key[TA_AES_SIZE_256BIT], nonce[TA_AES_GCM_NONCE_SIZE];
+    char *msg, *sealed, *opened;
+    size_t msg_sz, sealed_sz, opened_sz;
 
-    // Start tests
+    memset(key, 0xa5, sizeof(key));
+    memset(nonce, 0xa1, sizeof(nonce));
+    prepare_tee_session(&dec_ctx);
+
+    printf("--------------------------------------------------------------\n");
+    printf("AES GCM ENCRYPT/DECRYPT BENCHMARK (%i B AAD): %i RUNS\n",
+            GCM_AAD_SIZE, NUM_TESTS);
+    printf("key\tpayload\tencrypt S\t\tencrypt NS\t\tdecrypt S\t\t"
+            "decrypt NS\n");
     for (int i = 0; i < 2; i++) {
-        printf("Starting Test Suite for Key Size of: %i\n", key_sizes[i]);
-
-        // Estimate cipher text length
-        size_t cph_len = clear_text_len + (key_sizes[i] * 8 - (clear_text_len %
-                    (key_sizes[i] * 8)));
-        // Define variables for encrypt/decrypt
-        unsigned char cipher_text[cph_len]; // Buffer for the cipher text
-        unsigned char decrypted_text[cph_len]; // Buffer for the decrypted text
-        int cipher_text_len, decrypted_text_len; // Placeholders for the length
-        
-
-        for (int j = 0; j < NUM_TESTS; j++) {
-
-            // Key and Initial Vector Random Generation
-            unsigned char key[key_sizes[i]], iv[key_sizes[0]];
-            /*
-             * TODO: generate randomness within TZ
-            if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv))) {
-                printf("Error generating the key!");
-                return 1;
+        prepare_aes_algo(ctx, TA_AES_ALGO_GCM, ENCODE, key_sizes[i]);
+        set_slot_key(ctx, 0, key, key_sizes[i]);
+        prepare_aes_algo(&dec_ctx, TA_AES_ALGO_GCM, DECODE, key_sizes[i]);
+        set_slot_key(&dec_ctx, 0, key, key_sizes[i]);
+
+        for (size_t j = 0; j < num_payload_sizes; j++) {
+            msg_sz = GCM_AAD_SIZE + payload_sizes[j];
+            msg = malloc(msg_sz);
+            sealed = malloc(msg_sz + TA_AES_GCM_TAG_SIZE);
+            opened = malloc(payload_sizes[j]);
+            if (!msg || !sealed || !opened)
+                errx(1, "Out of memory");
+            memset(msg, 'a', msg_sz);
+            // The ciphertext is sent along with the same AAD
+            memcpy(sealed, msg, GCM_AAD_SIZE);
+
+            for (int r = 0; r < NUM_TESTS; r++) {
+                sealed_sz = payload_sizes[j] + TA_AES_GCM_TAG_SIZE;
+                enc_s[r] = gcm_buffer(ctx, TA_AES_CMD_GCM_ENCRYPT, 0, nonce,
+                        msg, GCM_AAD_SIZE, msg_sz, sealed + GCM_AAD_SIZE,
+                        &sealed_sz);
+                opened_sz = payload_sizes[j];
+                dec_s[r] = gcm_buffer(&dec_ctx, TA_AES_CMD_GCM_DECRYPT, 0,
+                        nonce, sealed, GCM_AAD_SIZE,
+                        GCM_AAD_SIZE + sealed_sz, opened, &opened_sz);
+                if (memcmp(opened, msg + GCM_AAD_SIZE, payload_sizes[j]))
+                    errx(1, "GCM round trip mismatch");
+
+                gettimeofday(&t1, NULL);
+                gcm_encrypt((unsigned char *) msg, GCM_AAD_SIZE, msg_sz,
+                        (unsigned char *) key, (unsigned char *) nonce,
+                        (unsigned char *) sealed + GCM_AAD_SIZE,
+                        key_sizes[i]);
+                gettimeofday(&t2, NULL);
+                enc_ns[r] = (t2.tv_sec - t1.tv_sec) * 1000.0
+                    + (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+                gettimeofday(&t1, NULL);
+                if (gcm_decrypt((unsigned char *) sealed, GCM_AAD_SIZE,
+                            msg_sz + TA_AES_GCM_TAG_SIZE,
+                            (unsigned char *) key, (unsigned char *) nonce,
+                            (unsigned char *) opened, key_sizes[i]) < 0)
+                    errx(1, "OpenSSL GCM tag mismatch");
+                gettimeofday(&t2, NULL);
+                dec_ns[r] = (t2.tv_sec - t1.tv_sec) * 1000.0
+                    + (t2.tv_usec - t1.tv_usec) / 1000.0;
             }
-            */
-            memset(key, 0xa5, sizeof(key));
-            memset(iv, 0xa1, sizeof(iv));
-            
-            // Non-Secure Encryption
-            gettimeofday(&t1, NULL);
-            cipher_text_len = encrypt(clear_text, clear_text_len, key, iv,
-                    cipher_text, key_sizes[i]);
-            gettimeofday(&t2, NULL);
-            enc_times_ns[NUM_TESTS * i + j] = (t2.tv_sec - t1.tv_sec) * 1000.0;
-            enc_times_ns[NUM_TESTS * i + j] += (t2.tv_usec - t1.tv_usec)/1000.0;
-
-            // Non-Secure Decryption
-            gettimeofday(&t1, NULL);
-            decrypted_text_len = decrypt(cipher_text, cipher_text_len, key,
-                    iv, decrypted_text, key_sizes[i]);
-            decrypted_text[decrypted_text_len++] = '\0';
-            gettimeofday(&t2, NULL);
-            dec_times_ns[NUM_TESTS * i + j] = (t2.tv_sec - t1.tv_sec) * 1000.0;
-            dec_times_ns[NUM_TESTS * i + j] += (t2.tv_usec - t1.tv_usec)/1000.0;
-
-            // Secure Encryption
-            gettimeofday(&t1, NULL);
-	        prepare_times[1][NUM_TESTS * i + j] = prepare_aes(&ctx, ENCODE,
-                    key_sizes[i]);
-            gettimeofday(&t3, NULL);
-	        set_key_times[1][NUM_TESTS * i + j] = set_key(&ctx, (char *) key,
-                    (size_t) key_sizes[i]);
-            gettimeofday(&t4, NULL);
-	        set_iv_times[1][NUM_TESTS * i + j] = set_iv(&ctx, (char *) iv,
-                    (size_t) key_sizes[0]);
-            gettimeofday(&t5, NULL);
-	        cipher_times[1][NUM_TESTS * i + j] = cipher_buffer(&ctx,
-                    clear_text, cipher_text, cph_len);
-            gettimeofday(&t2, NULL);
-            // Update Times
-            prepare_times[0][NUM_TESTS * i + j] = (t3.tv_sec - t1.tv_sec) 
-                * 1000.0;
-            prepare_times[0][NUM_TESTS * i + j] += (t3.tv_usec - t1.tv_usec)
-                / 1000.0;
-            set_key_times[0][NUM_TESTS * i + j] = (t4.tv_sec - t3.tv_sec) 
-                * 1000.0;
-            set_key_times[0][NUM_TESTS * i + j] += (t4.tv_usec - t3.tv_usec)
-                / 1000.0;
-            set_iv_times[0][NUM_TESTS * i + j] = (t5.tv_sec - t4.tv_sec) 
-                * 1000.0;
-            set_iv_times[0][NUM_TESTS * i + j] += (t5.tv_usec - t4.tv_usec)
-                / 1000.0;
-            cipher_times[0][NUM_TESTS * i + j] = (t2.tv_sec - t5.tv_sec) 
-                * 1000.0;
-            cipher_times[0][NUM_TESTS * i + j] += (t2.tv_usec - t5.tv_usec)
-                / 1000.0;
-            enc_times_s[NUM_TESTS * i + j] = (t2.tv_sec - t1.tv_sec) 
-                * 1000.0;
-            enc_times_s[NUM_TESTS * i + j] += (t2.tv_usec - t1.tv_usec)
-                / 1000.0;
-
-            // Secure Decryption
-            gettimeofday(&t1, NULL);
-	        prepare_times[4][NUM_TESTS * i + j] = prepare_aes(&ctx, DECODE,
-                    key_sizes[i]);
-            gettimeofday(&t3, NULL);
-	        set_key_times[4][NUM_TESTS * i + j] = set_key(&ctx, (char *) key,
-                    (size_t) key_sizes[i]);
-            gettimeofday(&t4, NULL);
-	        set_iv_times[4][NUM_TESTS * i + j] = set_iv(&ctx, (char *) iv,
-                    (size_t) key_sizes[0]);
-            gettimeofday(&t5, NULL);
-	        cipher_times[4][NUM_TESTS * i + j] = cipher_buffer(&ctx,
-                    cipher_text, decrypted_text, cph_len);
-            gettimeofday(&t2, NULL);
-            prepare_times[3][NUM_TESTS * i + j] = (t3.tv_sec - t1.tv_sec) 
-                * 1000.0;
-            prepare_times[3][NUM_TESTS * i + j] += (t3.tv_usec - t1.tv_usec)
-                / 1000.0;
-            set_key_times[3][NUM_TESTS * i + j] = (t4.tv_sec - t3.tv_sec) 
-                * 1000.0;
-            set_key_times[3][NUM_TESTS * i + j] += (t4.tv_usec - t3.tv_usec)
-                / 1000.0;
-            set_iv_times[3][NUM_TESTS * i + j] = (t5.tv_sec - t4.tv_sec) 
-                * 1000.0;
-            set_iv_times[3][NUM_TESTS * i + j] += (t5.tv_usec - t4.tv_usec)
-                / 1000.0;
-            cipher_times[3][NUM_TESTS * i + j] = (t2.tv_sec - t5.tv_sec) 
-                * 1000.0;
-            cipher_times[3][NUM_TESTS * i + j] += (t2.tv_usec - t5.tv_usec)
-                / 1000.0;
-            dec_times_s[NUM_TESTS * i + j] = (t2.tv_sec - t1.tv_sec) * 1000.0;
-            dec_times_s[NUM_TESTS * i + j] += (t2.tv_usec - t1.tv_usec)/1000.0;
 
+            printf("%i\t%zu\t%f %f\t%f %f\t%f %f\t%f %f\n", key_sizes[i],
+                    payload_sizes[j], avg(enc_s, NUM_TESTS),
+                    stdev(enc_s, NUM_TESTS), avg(enc_ns, NUM_TESTS),
+                    stdev(enc_ns, NUM_TESTS), avg(dec_s, NUM_TESTS),
+                    stdev(dec_s, NUM_TESTS), avg(dec_ns, NUM_TESTS),
+                    stdev(dec_ns, NUM_TESTS));
+            free(msg);
+            free(sealed);
+            free(opened);
         }
     }
+    printf("--------------------------------------------------------------\n");
+
+    terminate_tee_session(&dec_ctx);
+    return 0;
+}
+
+/*
+ * Secure world HMAC (MAC slot 0) or SHA-256 of sz bytes of in, fed in two
+ * UPDATE invocations and closed by an empty FINAL
+ */
+TEEC_Result split_digest(struct test_ctx *ctx, bool hmac, char *in,
+        size_t sz, unsigned char *md)
+{
+    size_t half = sz / 2;
+    TEEC_Result res;
+    double us;
+
+    if (hmac) {
+        res = mac_update(ctx, 0, in, half, &us);
+        if (res == TEEC_SUCCESS)
+            res = mac_update(ctx, 0, in + half, sz - half, &us);
+        if (res == TEEC_SUCCESS)
+            res = mac_final(ctx, 0, NULL, 0, md, &us);
+    } else {
+        res = digest_update(ctx, in, half, &us);
+        if (res == TEEC_SUCCESS)
+            res = digest_update(ctx, in + half, sz - half, &us);
+        if (res == TEEC_SUCCESS)
+            res = digest_final(ctx, NULL, 0, md, &us);
+    }
+    return res;
+}
+
+/*
+ * HMAC-SHA256 and SHA-256 of SWEEP_MIN_SIZE to SWEEP_MAX_SIZE bytes in
+ * powers of two, with OpenSSL and with a single FINAL invocation on a
+ * pre-keyed MAC slot and on the session digest. The first run of each size
+ * is checked against OpenSSL, as is the same message split over several
+ * invocations. Latencies are in microseconds.
+ */
+int mac_benchmark(struct test_ctx *ctx)
+{
+    struct timespec t1, t2;
+    double ns_mac[NUM_TESTS], s_mac[NUM_TESTS];
+    double ns_sha[NUM_TESTS], s_sha[NUM_TESTS];
+    unsigned char key[32], md[TA_AES_MAC_SIZE];
+    unsigned char ref_mac[TA_AES_MAC_SIZE], ref_sha[TA_AES_DIGEST_SIZE];
+    unsigned int md_len;
+    bool secure = true;
+    TEEC_Result res;
+    char *in;
+    int runs;
+
+    memset(key, 0xa5, sizeof(key));
+    in = malloc(SWEEP_MAX_SIZE);
+    if (!in)
+        errx(1, "Out of memory");
+    memset(in, 'a', SWEEP_MAX_SIZE);
+
+    mac_set_key(ctx, 0, (char *) key, sizeof(key));
 
-    // Print times
     printf("--------------------------------------------------------------\n");
-    printf("AES 128/256 CBC ENCRYPT/DECRYPT BENCHMARK (16B vs 32B Key): %i RUNS\n"
-            , NUM_TESTS);
-    printf("Encrypt S: \t%f %f\t%f %f\n", avg(enc_times_s, NUM_TESTS),
-            stdev(enc_times_s, NUM_TESTS), avg(&enc_times_s[100], NUM_TESTS),
-            stdev(&enc_times_s[100], NUM_TESTS));
-    printf("Encrypt NS: \t%f %f\t%f %f\n", avg(enc_times_ns, NUM_TESTS),
-            stdev(enc_times_ns, NUM_TESTS), avg(&enc_times_ns[100], NUM_TESTS),
-            stdev(&enc_times_ns[100], NUM_TESTS));
-    printf("Decrypt S: \t%f %f\t%f %f\n", avg(dec_times_s, NUM_TESTS),
-            stdev(dec_times_s, NUM_TESTS), avg(&dec_times_s[100], NUM_TESTS),
-            stdev(&dec_times_s[100], NUM_TESTS));
-    printf("Decrypt NS: \t%f %f\t%f %f\n", avg(dec_times_ns, NUM_TESTS),
-            stdev(dec_times_ns, NUM_TESTS), avg(&dec_times_ns[100], NUM_TESTS),
-            stdev(&dec_times_ns[100], NUM_TESTS));
+    printf("HMAC-SHA256 / SHA-256 PAYLOAD SWEEP (%i runs, %i above %i B)\n",
+            NUM_TESTS, SWEEP_LARGE_TESTS, SWEEP_LARGE_SIZE);
+    printf("size\tHMAC NS MB/s\tHMAC S MB/s\tHMAC NS p50\tHMAC S p50\t"
+            "SHA NS MB/s\tSHA S MB/s\tSHA NS p50\tSHA S p50\n");
+    for (size_t sz = SWEEP_MIN_SIZE; sz <= SWEEP_MAX_SIZE; sz *= 2) {
+        runs = sz > SWEEP_LARGE_SIZE ? SWEEP_LARGE_TESTS : NUM_TESTS;
+
+        for (int r = 0; r < runs; r++) {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (!HMAC(EVP_sha256(), key, sizeof(key), (unsigned char *) in,
+                        sz, ref_mac, &md_len))
+                handleErrors();
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            ns_mac[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (1 != EVP_Digest(in, sz, ref_sha, &md_len, EVP_sha256(),
+                        NULL))
+                handleErrors();
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            ns_sha[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+        }
+
+        for (int r = 0; secure && r < runs; r++) {
+            res = mac_final(ctx, 0, in, sz, md, &s_mac[r]);
+            if (res == TEEC_SUCCESS && !r &&
+                    memcmp(md, ref_mac, sizeof(ref_mac)))
+                errx(1, "HMAC mismatch at %zu bytes", sz);
+            if (res == TEEC_SUCCESS)
+                res = digest_final(ctx, in, sz, md, &s_sha[r]);
+            if (res == TEEC_SUCCESS && !r &&
+                    memcmp(md, ref_sha, sizeof(ref_sha)))
+                errx(1, "SHA-256 mismatch at %zu bytes", sz);
+            if (res != TEEC_SUCCESS)
+                secure = false;
+        }
+        if (secure) {
+            res = split_digest(ctx, true, in, sz, md);
+            if (res == TEEC_SUCCESS && memcmp(md, ref_mac, sizeof(ref_mac)))
+                errx(1, "Incremental HMAC mismatch at %zu bytes", sz);
+            if (res == TEEC_SUCCESS)
+                res = split_digest(ctx, false, in, sz, md);
+            if (res == TEEC_SUCCESS && memcmp(md, ref_sha, sizeof(ref_sha)))
+                errx(1, "Incremental SHA-256 mismatch at %zu bytes", sz);
+            if (res != TEEC_SUCCESS)
+                secure = false;
+        }
+
+        if (secure)
+            printf("%zu\t%.2f\t\t%.2f\t\t%.2f\t\t%.2f\t\t"
+                    "%.2f\t\t%.2f\t\t%.2f\t\t%.2f\n", sz,
+                    sz / avg(ns_mac, runs), sz / avg(s_mac, runs),
+                    percentile(ns_mac, runs, 50),
+                    percentile(s_mac, runs, 50),
+                    sz / avg(ns_sha, runs), sz / avg(s_sha, runs),
+                    percentile(ns_sha, runs, 50),
+                    percentile(s_sha, runs, 50));
+        else
+            printf("%zu\t%.2f\t\t-\t\t%.2f\t\t-\t\t%.2f\t\t-\t\t%.2f\t\t-"
+                    "\t(secure world failed 0x%x)\n", sz,
+                    sz / avg(ns_mac, runs), percentile(ns_mac, runs, 50),
+                    sz / avg(ns_sha, runs), percentile(ns_sha, runs, 50),
+                    res);
+    }
     printf("--------------------------------------------------------------\n");
-    printf("\t\tSECURE ENCRYPT/DECRYPT TIME BREAKDOWN\n");
-    printf("\t\t\tENCRYPT (16B / 32B)\n");
-    printf("prepare_aes (All) \t%f %f\t%f %f\n", avg(prepare_times, NUM_TESTS),
-            stdev(prepare_times, NUM_TESTS), avg(&prepare_times[0][100],
-            NUM_TESTS), stdev(&prepare_times[0][100], NUM_TESTS));
-    printf("prepare_aes (Inv) \t%f %f\t%f %f\n", avg(&prepare_times[1],
-            NUM_TESTS), stdev(&prepare_times[1], NUM_TESTS), 
-            avg(&prepare_times[1][100], NUM_TESTS), 
-            stdev(&prepare_times[1][100], NUM_TESTS));
-    printf("set_iv (All) \t\t%f %f\t%f %f\n", avg(set_iv_times, NUM_TESTS),
-            stdev(set_iv_times, NUM_TESTS), avg(&set_iv_times[0][100],
-            NUM_TESTS), stdev(&set_iv_times[0][100], NUM_TESTS));
-    printf("set_iv (Inv) \t\t%f %f\t%f %f\n", avg(&set_iv_times[1],
-            NUM_TESTS), stdev(&set_iv_times[1], NUM_TESTS), 
-            avg(&set_iv_times[1][100], NUM_TESTS), 
-            stdev(&set_iv_times[1][100], NUM_TESTS));
-    printf("set_key (All) \t\t%f %f\t%f %f\n", avg(set_key_times, NUM_TESTS),
-            stdev(set_key_times, NUM_TESTS), avg(&set_key_times[0][100],
-            NUM_TESTS), stdev(&set_key_times[0][100], NUM_TESTS));
-    printf("set_key (Inv) \t\t%f %f\t%f %f\n", avg(&set_key_times[1],
-            NUM_TESTS), stdev(&set_key_times[1], NUM_TESTS), 
-            avg(&set_key_times[1][100], NUM_TESTS), 
-            stdev(&set_key_times[1][100], NUM_TESTS));
-    printf("cipher_buffer (All) \t%f %f\t%f %f\n", avg(cipher_times, NUM_TESTS),
-            stdev(cipher_times, NUM_TESTS), avg(&cipher_times[0][100],
-            NUM_TESTS), stdev(&cipher_times[0][100], NUM_TESTS));
-    printf("cipher_buffer (Inv) \t%f %f\t%f %f\n", avg(&cipher_times[1],
-            NUM_TESTS), stdev(&cipher_times[1], NUM_TESTS), 
-            avg(&cipher_times[1][100], NUM_TESTS), 
-            stdev(&cipher_times[1][100], NUM_TESTS));
-    printf("\t\t\tDECRYPT (16B / 32B)\n");
-    printf("prepare_aes (All) \t%f %f\t%f %f\n", avg(&prepare_times[3], NUM_TESTS),
-            stdev(&prepare_times[3], NUM_TESTS), avg(&prepare_times[3][100],
-            NUM_TESTS), stdev(&prepare_times[3][100], NUM_TESTS));
-    printf("prepare_aes (Inv) \t%f %f\t%f %f\n", avg(&prepare_times[4],
-            NUM_TESTS), stdev(&prepare_times[4], NUM_TESTS), 
-            avg(&prepare_times[4][100], NUM_TESTS), 
-            stdev(&prepare_times[4][100], NUM_TESTS));
-    printf("set_iv (All) \t\t%f %f\t%f %f\n", avg(&set_iv_times[3], NUM_TESTS),
-            stdev(&set_iv_times[3], NUM_TESTS), avg(&set_iv_times[3][100],
-            NUM_TESTS), stdev(&set_iv_times[3][100], NUM_TESTS));
-    printf("set_iv (Inv) \t\t%f %f\t%f %f\n", avg(&set_iv_times[4],
-            NUM_TESTS), stdev(&set_iv_times[4], NUM_TESTS), 
-            avg(&set_iv_times[4][100], NUM_TESTS), 
-            stdev(&set_iv_times[4][100], NUM_TESTS));
-    printf("set_key (All) \t\t%f %f\t%f %f\n", avg(&set_key_times[3], NUM_TESTS),
-            stdev(&set_key_times[3], NUM_TESTS), avg(&set_key_times[3][100],
-            NUM_TESTS), stdev(&set_key_times[3][100], NUM_TESTS));
-    printf("set_key (Inv) \t\t%f %f\t%f %f\n", avg(&set_key_times[4],
-            NUM_TESTS), stdev(&set_key_times[4], NUM_TESTS), 
-            avg(&set_key_times[4][100], NUM_TESTS), 
-            stdev(&set_key_times[4][100], NUM_TESTS));
-    printf("cipher_buffer (All) \t%f %f\t%f %f\n", avg(&cipher_times[3], NUM_TESTS),
-            stdev(&cipher_times[3], NUM_TESTS), avg(&cipher_times[3][100],
-            NUM_TESTS), stdev(&cipher_times[3][100], NUM_TESTS));
-    printf("cipher_buffer (Inv) \t%f %f\t%f %f\n", avg(&cipher_times[4],
-            NUM_TESTS), stdev(&cipher_times[4], NUM_TESTS), 
-            avg(&cipher_times[4][100], NUM_TESTS), 
-            stdev(&cipher_times[4][100], NUM_TESTS));
+
+    free(in);
+    return 0;
+}
+
+/*
+ * Cost of an IV drawn with one TEE_GenerateRandom() call each against one
+ * taken from the TA random pool, for a growing number of IVs per invocation
+ * so that the invocation cost fades out. OpenSSL RAND_bytes() per IV is the
+ * normal world reference. Times are in nanoseconds per IV.
+ */
+int rand_benchmark(struct test_ctx *ctx)
+{
+    struct timespec t1, t2;
+    size_t counts[] = {1, 16, 256, 4096};
+    const size_t num_counts = sizeof(counts) / sizeof(counts[0]);
+    double direct[NUM_TESTS], pooled[NUM_TESTS], nw[NUM_TESTS];
+    size_t iv_sizes[] = {TA_AES_GCM_NONCE_SIZE, TA_AES_IV_SIZE};
+    TEEC_Result res;
+    char *out;
+
+    out = malloc(counts[num_counts - 1] * TA_AES_IV_SIZE);
+    if (!out)
+        errx(1, "Out of memory");
+
+    printf("--------------------------------------------------------------\n");
+    printf("IV GENERATION, ns per IV: %i RUNS\n", NUM_TESTS);
+    printf("IV size\tIVs/call\tS direct\tS pool\t\tNS RAND_bytes\n");
+    for (size_t i = 0; i < 2; i++) {
+        for (size_t j = 0; j < num_counts; j++) {
+            size_t sz = counts[j] * iv_sizes[i];
+
+            for (int r = 0; r < NUM_TESTS; r++) {
+                res = gen_iv(ctx, TA_AES_RAND_DIRECT, iv_sizes[i], out, sz,
+                        &direct[r]);
+                if (res == TEEC_SUCCESS)
+                    res = gen_iv(ctx, TA_AES_RAND_POOL, iv_sizes[i], out, sz,
+                            &pooled[r]);
+                if (res != TEEC_SUCCESS)
+                    errx(1, "GEN_IV failed 0x%x", res);
+
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                for (size_t n = 0; n < counts[j]; n++)
+                    if (1 != RAND_bytes((unsigned char *) out +
+                                n * iv_sizes[i], iv_sizes[i]))
+                        handleErrors();
+                clock_gettime(CLOCK_MONOTONIC, &t2);
+                nw[r] = (t2.tv_sec - t1.tv_sec) * 1e6
+                    + (t2.tv_nsec - t1.tv_nsec) / 1e3;
+            }
+
+            printf("%zu\t%zu\t\t%.1f\t\t%.1f\t\t%.1f\n", iv_sizes[i],
+                    counts[j], avg(direct, NUM_TESTS) * 1000.0 / counts[j],
+                    avg(pooled, NUM_TESTS) * 1000.0 / counts[j],
+                    avg(nw, NUM_TESTS) * 1000.0 / counts[j]);
+        }
+    }
     printf("--------------------------------------------------------------\n");
 
-	terminate_tee_session(&ctx);
-	return 0;
+    free(out);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct test_ctx ctx;
+
+    // ./optee_example_aes ctr [max_sessions], opens its own sessions
+    if (argc >= 2 && !strcmp(argv[1], "ctr"))
+        return parallel_ctr_benchmark(argc == 3 ? atoi(argv[2]) :
+                sysconf(_SC_NPROCESSORS_ONLN));
+    // ./optee_example_aes nw [max_threads], no TEE session needed
+    if (argc >= 2 && !strcmp(argv[1], "nw"))
+        return nw_benchmark(argc == 3 ? atoi(argv[2]) :
+                sysconf(_SC_NPROCESSORS_ONLN));
+
+    // Prepare TEE Session
+	prepare_tee_session(&ctx);
+
+    // ./optee_example_aes batch
+    if (argc == 2 && !strcmp(argv[1], "batch"))
+        batch_benchmark(&ctx);
+    // ./optee_example_aes gcm
+    else if (argc == 2 && !strcmp(argv[1], "gcm"))
+        gcm_benchmark(&ctx);
+    // ./optee_example_aes mac
+    else if (argc == 2 && !strcmp(argv[1], "mac"))
+        mac_benchmark(&ctx);
+    // ./optee_example_aes rand
+    else if (argc == 2 && !strcmp(argv[1], "rand"))
+        rand_benchmark(&ctx);
+    // ./optee_example_aes shm
+    else if (argc == 2 && !strcmp(argv[1], "shm"))
+        shm_benchmark(&ctx);
+    // ./optee_example_aes file <in_path> <out_path>
+    else if (argc == 4 && !strcmp(argv[1], "file"))
+        file_benchmark(&ctx, argv[2], argv[3]);
+    // ./optee_example_aes slots <num_keys>
+    else if (argc == 3 && !strcmp(argv[1], "slots"))
+        slot_benchmark(&ctx, atoi(argv[2]));
+    // ./optee_example_aes
+    else
+        sweep_benchmark(&ctx);
+
+    terminate_tee_session(&ctx);
+    return 0;
 }
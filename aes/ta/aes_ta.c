@@ -30,6 +30,7 @@
 #include <tee_internal_api_extensions.h>
 
 #include <aes_ta.h>
+#include <rand_pool.h>
 
 #define AES128_KEY_BIT_SIZE		128
 #define AES128_KEY_BYTE_SIZE		(AES128_KEY_BIT_SIZE / 8)
@@ -49,6 +50,14 @@ struct aes_cipher {
 	uint32_t key_size;		/* AES key size in byte */
 	TEE_OperationHandle op_handle;	/* AES ciphering operation */
 	TEE_ObjectHandle key_handle;	/* transient object to load the key */
+	/* operations keyed by TA_AES_CMD_SET_SLOT_KEY */
+	TEE_OperationHandle slot_ops[TA_AES_MAX_SLOTS];
+	uint32_t cur_slot;		/* slot used by SET_IV and CIPHER */
+	/* HMAC operations keyed by TA_AES_CMD_MAC_SET_KEY */
+	TEE_OperationHandle mac_ops[TA_AES_MAX_MAC_SLOTS];
+	/* same, initialized once and copied to mac_ops for each message */
+	TEE_OperationHandle mac_init_ops[TA_AES_MAX_MAC_SLOTS];
+	TEE_OperationHandle digest_op;	/* SHA-256, allocated on first use */
 };
 
 /*
@@ -66,6 +75,9 @@ static TEE_Result ta2tee_algo_id(uint32_t param, uint32_t *algo)
 	case TA_AES_ALGO_CTR:
 		*algo = TEE_ALG_AES_CTR;
 		return TEE_SUCCESS;
+	case TA_AES_ALGO_GCM:
+		*algo = TEE_ALG_AES_GCM;
+		return TEE_SUCCESS;
 	default:
 		EMSG("Invalid algo %u", param);
 		return TEE_ERROR_BAD_PARAMETERS;
@@ -98,6 +110,51 @@ static TEE_Result ta2tee_mode_id(uint32_t param, uint32_t *mode)
 	}
 }
 
+static void free_slot_ops(struct aes_cipher *sess)
+{
+	size_t n;
+
+	for (n = 0; n < TA_AES_MAX_SLOTS; n++) {
+		if (sess->slot_ops[n] != TEE_HANDLE_NULL)
+			TEE_FreeOperation(sess->slot_ops[n]);
+		sess->slot_ops[n] = TEE_HANDLE_NULL;
+	}
+	sess->cur_slot = TA_AES_SLOT_SESSION;
+}
+
+/*
+ * Operation used by TA_AES_CMD_SET_IV and TA_AES_CMD_CIPHER: the session
+ * operation, or the one of the slot picked by TA_AES_CMD_SELECT_SLOT.
+ */
+static TEE_OperationHandle cur_op(struct aes_cipher *sess)
+{
+	if (sess->cur_slot == TA_AES_SLOT_SESSION)
+		return sess->op_handle;
+	return sess->slot_ops[sess->cur_slot];
+}
+
+/*
+ * Operation of a slot, or TEE_HANDLE_NULL if the slot is not loaded
+ */
+static TEE_OperationHandle slot_op(struct aes_cipher *sess, uint32_t slot)
+{
+	if (slot == TA_AES_SLOT_SESSION)
+		return sess->op_handle;
+	if (slot >= TA_AES_MAX_SLOTS)
+		return TEE_HANDLE_NULL;
+	return sess->slot_ops[slot];
+}
+
+/*
+ * SET_IV, CIPHER, SELECT_SLOT and CIPHER_BATCH drive cipher operations.
+ * Sessions prepared for GCM use the TA_AES_CMD_GCM_xxx commands instead.
+ */
+static bool cipher_ready(struct aes_cipher *sess)
+{
+	return sess->op_handle != TEE_HANDLE_NULL &&
+	       sess->algo != TEE_ALG_AES_GCM;
+}
+
 /*
  * Process command TA_AES_CMD_PREPARE. API in aes_ta.h
  *
@@ -147,9 +204,10 @@ static TEE_Result alloc_resources(void *session, uint32_t param_types,
 	 *   into the AES ciphering operation.
 	 */
 
-	/* Free potential previous operation */
+	/* Free potential previous operations, slots follow the session setup */
 	if (sess->op_handle != TEE_HANDLE_NULL)
 		TEE_FreeOperation(sess->op_handle);
+	free_slot_ops(sess);
 
 	/* Allocate operation: AES/CTR, mode and size from params */
 	res = TEE_AllocateOperation(&sess->op_handle,
@@ -285,10 +343,140 @@ static TEE_Result set_aes_key(void *session, uint32_t param_types,
 		EMSG("TEE_SetOperationKey failed %x", res);
 		return res;
 	}
+	sess->cur_slot = TA_AES_SLOT_SESSION;
 
 	return res;
 }
 
+/*
+ * Process command TA_AES_CMD_SET_SLOT_KEY. API in aes_ta.h
+ *
+ * Each slot owns an operation that is keyed once here. Using another key
+ * afterwards only takes a TEE_CipherInit() on the slot operation, instead
+ * of the reset and key load done by set_aes_key().
+ */
+static TEE_Result set_slot_key(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle key_handle;
+	TEE_OperationHandle *op;
+	struct aes_cipher *sess;
+	TEE_Attribute attr;
+	TEE_Result res;
+	uint32_t slot;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: load slot key", session);
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (sess->op_handle == TEE_HANDLE_NULL)
+		return TEE_ERROR_BAD_STATE;
+
+	slot = params[0].value.a;
+	if (slot >= TA_AES_MAX_SLOTS) {
+		EMSG("Invalid key slot %" PRIu32, slot);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (params[1].memref.size != sess->key_size) {
+		EMSG("Wrong key size %" PRIu32 ", expect %" PRIu32 " bytes",
+		     params[1].memref.size, sess->key_size);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	/*
+	 * The key object is only needed to load the key, the operation
+	 * keeps its own copy.
+	 */
+	res = TEE_AllocateTransientObject(TEE_TYPE_AES, sess->key_size * 8,
+					  &key_handle);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to allocate transient object");
+		return res;
+	}
+
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
+			     params[1].memref.buffer, params[1].memref.size);
+	res = TEE_PopulateTransientObject(key_handle, &attr, 1);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_PopulateTransientObject failed, %x", res);
+		goto out;
+	}
+
+	op = &sess->slot_ops[slot];
+	if (*op == TEE_HANDLE_NULL) {
+		res = TEE_AllocateOperation(op, sess->algo, sess->mode,
+					    sess->key_size * 8);
+		if (res != TEE_SUCCESS) {
+			EMSG("Failed to allocate operation");
+			*op = TEE_HANDLE_NULL;
+			goto out;
+		}
+	} else {
+		TEE_ResetOperation(*op);
+	}
+
+	res = TEE_SetOperationKey(*op, key_handle);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SetOperationKey failed %x", res);
+		TEE_FreeOperation(*op);
+		*op = TEE_HANDLE_NULL;
+		if (sess->cur_slot == slot)
+			sess->cur_slot = TA_AES_SLOT_SESSION;
+	}
+
+out:
+	TEE_FreeTransientObject(key_handle);
+	return res;
+}
+
+/*
+ * Process command TA_AES_CMD_SELECT_SLOT. API in aes_ta.h
+ */
+static TEE_Result select_slot(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct aes_cipher *sess;
+	uint32_t slot;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: select key slot", session);
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!cipher_ready(sess))
+		return TEE_ERROR_BAD_STATE;
+
+	slot = params[0].value.a;
+	if (slot_op(sess, slot) == TEE_HANDLE_NULL) {
+		EMSG("Key slot %" PRIu32 " is not loaded", slot);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	sess->cur_slot = slot;
+	TEE_CipherInit(cur_op(sess), params[1].memref.buffer,
+		       params[1].memref.size);
+
+	return TEE_SUCCESS;
+}
+
 /*
  * Process command TA_AES_CMD_SET_IV. API in aes_ta.h
  */
@@ -312,13 +500,16 @@ static TEE_Result reset_aes_iv(void *session, uint32_t param_types,
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
+	if (!cipher_ready(sess))
+		return TEE_ERROR_BAD_STATE;
+
 	iv = params[0].memref.buffer;
 	iv_sz = params[0].memref.size;
 
 	/*
 	 * Init cipher operation with the initialization vector.
 	 */
-	TEE_CipherInit(sess->op_handle, iv, iv_sz);
+	TEE_CipherInit(cur_op(sess), iv, iv_sz);
 
 	return TEE_SUCCESS;
 }
@@ -334,12 +525,29 @@ static TEE_Result cipher_buffer(void *session, uint32_t param_types,
 				TEE_PARAM_TYPE_MEMREF_OUTPUT,
 				TEE_PARAM_TYPE_NONE,
 				TEE_PARAM_TYPE_NONE);
+	const uint32_t inplace_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INOUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
 	struct aes_cipher *sess;
 
 	/* Get ciphering context from session ID */
 	DMSG("Session %p: cipher buffer", session);
 	sess = (struct aes_cipher *)session;
 
+	/* A single inout buffer is ciphered in place */
+	if (param_types == inplace_param_types) {
+		if (!cipher_ready(sess))
+			return TEE_ERROR_BAD_STATE;
+
+		return TEE_CipherUpdate(cur_op(sess),
+					params[0].memref.buffer,
+					params[0].memref.size,
+					params[0].memref.buffer,
+					&params[0].memref.size);
+	}
+
 	/* Safely get the invocation parameters */
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
@@ -350,17 +558,587 @@ static TEE_Result cipher_buffer(void *session, uint32_t param_types,
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (sess->op_handle == TEE_HANDLE_NULL)
+	if (!cipher_ready(sess))
 		return TEE_ERROR_BAD_STATE;
 
 	/*
 	 * Process ciphering operation on provided buffers
 	 */
-	return TEE_CipherUpdate(sess->op_handle,
+	return TEE_CipherUpdate(cur_op(sess),
 				params[0].memref.buffer, params[0].memref.size,
 				params[1].memref.buffer, &params[1].memref.size);
 }
 
+/*
+ * Process command TA_AES_CMD_TRANSFER. API in aes_ta.h
+ */
+static TEE_Result transfer_buffer(void __unused *session,
+				  uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[1].memref.size < params[0].memref.size) {
+		EMSG("Bad sizes: in %d, out %d", params[0].memref.size,
+						 params[1].memref.size);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	/* Report a full output so the client copies it back like CIPHER */
+	params[1].memref.size = params[0].memref.size;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Check that [off, off + len) lies within a buffer of size sz
+ */
+static bool region_in_buffer(uint32_t off, uint32_t len, uint32_t sz)
+{
+	return off <= sz && len <= sz - off;
+}
+
+/*
+ * Process command TA_AES_CMD_CIPHER_BATCH. API in aes_ta.h
+ *
+ * All descriptors are validated before any data is touched, so a
+ * malformed table leaves the buffer unchanged.
+ */
+static TEE_Result cipher_batch(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INOUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_NONE);
+	struct ta_aes_batch_desc *desc;
+	struct aes_cipher *sess;
+	TEE_OperationHandle op;
+	uint32_t num_desc;
+	uint32_t data_sz;
+	uint32_t out_sz;
+	uint8_t *data;
+	TEE_Result res;
+	uint32_t n;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: cipher batch", session);
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!cipher_ready(sess))
+		return TEE_ERROR_BAD_STATE;
+
+	if (params[0].memref.size % sizeof(*desc)) {
+		EMSG("Bad descriptor table size %" PRIu32,
+		     params[0].memref.size);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	/* Descriptors live in shared memory, work on a private copy */
+	num_desc = params[0].memref.size / sizeof(*desc);
+	desc = TEE_Malloc(params[0].memref.size, TEE_MALLOC_FILL_ZERO);
+	if (num_desc && !desc)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(desc, params[0].memref.buffer, params[0].memref.size);
+
+	data = params[1].memref.buffer;
+	data_sz = params[1].memref.size;
+	params[2].value.a = 0;
+
+	for (n = 0; n < num_desc; n++) {
+		struct ta_aes_batch_desc *d = desc + n;
+
+		if (!region_in_buffer(d->in_offset, d->len, data_sz) ||
+		    !region_in_buffer(d->out_offset, d->len, data_sz)) {
+			EMSG("Descriptor %" PRIu32 " out of buffer", n);
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+		if (d->in_offset != d->out_offset &&
+		    d->in_offset < d->out_offset + d->len &&
+		    d->out_offset < d->in_offset + d->len) {
+			EMSG("Descriptor %" PRIu32 " regions overlap", n);
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+		if (sess->algo != TEE_ALG_AES_CTR &&
+		    d->len % TA_AES_BLOCK_SIZE) {
+			EMSG("Descriptor %" PRIu32 " not block aligned", n);
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+		if (d->slot >= TA_AES_MAX_SLOTS ||
+		    sess->slot_ops[d->slot] == TEE_HANDLE_NULL) {
+			EMSG("Descriptor %" PRIu32 " uses empty slot", n);
+			res = TEE_ERROR_BAD_PARAMETERS;
+			goto out;
+		}
+	}
+
+	for (n = 0; n < num_desc; n++) {
+		struct ta_aes_batch_desc *d = desc + n;
+
+		op = sess->slot_ops[d->slot];
+		TEE_CipherInit(op, d->iv, sizeof(d->iv));
+
+		out_sz = d->len;
+		res = TEE_CipherUpdate(op,
+				       data + d->in_offset, d->len,
+				       data + d->out_offset, &out_sz);
+		if (res != TEE_SUCCESS) {
+			EMSG("TEE_CipherUpdate failed %x", res);
+			goto out;
+		}
+		params[2].value.a = n + 1;
+	}
+	res = TEE_SUCCESS;
+
+out:
+	TEE_Free(desc);
+	return res;
+}
+
+/*
+ * Process commands TA_AES_CMD_GCM_ENCRYPT and TA_AES_CMD_GCM_DECRYPT. API in
+ * aes_ta.h
+ *
+ * The whole message goes through TEE_AEInit(), TEE_AEUpdateAAD() and one
+ * final call, so encryption and authentication cost a single invocation.
+ */
+static TEE_Result gcm_buffer(void *session, uint32_t param_types,
+			     TEE_Param params[4], bool encrypt)
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT);
+	struct aes_cipher *sess;
+	TEE_OperationHandle op;
+	uint32_t payload_sz;
+	uint32_t out_sz;
+	uint32_t tag_sz;
+	uint32_t aad_sz;
+	uint8_t *in;
+	uint8_t *out;
+	uint8_t *plain;
+	TEE_Result res;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: GCM %s", session, encrypt ? "encrypt" : "decrypt");
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (sess->algo != TEE_ALG_AES_GCM ||
+	    sess->mode != (encrypt ? TEE_MODE_ENCRYPT : TEE_MODE_DECRYPT))
+		return TEE_ERROR_BAD_STATE;
+
+	op = slot_op(sess, params[0].value.a);
+	if (op == TEE_HANDLE_NULL) {
+		EMSG("Key slot %" PRIu32 " is not loaded", params[0].value.a);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	in = params[2].memref.buffer;
+	out = params[3].memref.buffer;
+	aad_sz = params[0].value.b;
+	tag_sz = encrypt ? 0 : TA_AES_GCM_TAG_SIZE;
+	if (params[2].memref.size < aad_sz ||
+	    params[2].memref.size - aad_sz < tag_sz) {
+		EMSG("Bad sizes: in %" PRIu32 ", AAD %" PRIu32,
+		     params[2].memref.size, aad_sz);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+	payload_sz = params[2].memref.size - aad_sz - tag_sz;
+
+	out_sz = encrypt ? payload_sz + TA_AES_GCM_TAG_SIZE : payload_sz;
+	if (params[3].memref.size < out_sz) {
+		params[3].memref.size = out_sz;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	res = TEE_AEInit(op, params[1].memref.buffer, params[1].memref.size,
+			 TA_AES_GCM_TAG_SIZE * 8, aad_sz, payload_sz);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_AEInit failed %x", res);
+		return res;
+	}
+
+	if (aad_sz)
+		TEE_AEUpdateAAD(op, in, aad_sz);
+
+	out_sz = payload_sz;
+	if (encrypt) {
+		tag_sz = TA_AES_GCM_TAG_SIZE;
+		res = TEE_AEEncryptFinal(op, in + aad_sz, payload_sz,
+					 out, &out_sz, out + payload_sz,
+					 &tag_sz);
+		if (res == TEE_SUCCESS)
+			params[3].memref.size = out_sz + tag_sz;
+	} else {
+		/*
+		 * Decrypt into TA memory: the normal world can read params[3]
+		 * while the TA writes it, so the plaintext is only copied out
+		 * once the tag has been verified.
+		 */
+		plain = TEE_Malloc(payload_sz, TEE_MALLOC_FILL_ZERO);
+		if (!plain)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		res = TEE_AEDecryptFinal(op, in + aad_sz, payload_sz,
+					 plain, &out_sz,
+					 in + aad_sz + payload_sz, tag_sz);
+		if (res == TEE_SUCCESS) {
+			TEE_MemMove(out, plain, out_sz);
+			params[3].memref.size = out_sz;
+		}
+		TEE_MemFill(plain, 0, payload_sz);
+		TEE_Free(plain);
+	}
+	if (res != TEE_SUCCESS)
+		EMSG("GCM %s failed %x", encrypt ? "encrypt" : "decrypt", res);
+
+	return res;
+}
+
+static void free_mac_ops(struct aes_cipher *sess)
+{
+	size_t n;
+
+	for (n = 0; n < TA_AES_MAX_MAC_SLOTS; n++) {
+		if (sess->mac_ops[n] != TEE_HANDLE_NULL)
+			TEE_FreeOperation(sess->mac_ops[n]);
+		if (sess->mac_init_ops[n] != TEE_HANDLE_NULL)
+			TEE_FreeOperation(sess->mac_init_ops[n]);
+		sess->mac_ops[n] = TEE_HANDLE_NULL;
+		sess->mac_init_ops[n] = TEE_HANDLE_NULL;
+	}
+}
+
+/*
+ * Operation of a MAC slot, or TEE_HANDLE_NULL if the slot is not loaded
+ */
+static TEE_OperationHandle mac_op(struct aes_cipher *sess, uint32_t slot)
+{
+	if (slot >= TA_AES_MAX_MAC_SLOTS) {
+		EMSG("Invalid MAC slot %" PRIu32, slot);
+		return TEE_HANDLE_NULL;
+	}
+	if (sess->mac_ops[slot] == TEE_HANDLE_NULL)
+		EMSG("MAC slot %" PRIu32 " is not loaded", slot);
+	return sess->mac_ops[slot];
+}
+
+/*
+ * Process command TA_AES_CMD_MAC_SET_KEY. API in aes_ta.h
+ *
+ * TEE_MACInit() hashes the key pads again on every call, so it runs once
+ * here on mac_init_ops[slot]. Each message afterwards restarts the slot
+ * operation by copying that initialized state with TEE_CopyOperation().
+ */
+static TEE_Result set_mac_key(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle key_handle;
+	TEE_OperationHandle *init_op;
+	TEE_OperationHandle *op;
+	struct aes_cipher *sess;
+	TEE_Attribute attr;
+	TEE_Result res;
+	uint32_t key_sz;
+	uint32_t slot;
+
+	/* Get ciphering context from session ID */
+	DMSG("Session %p: load MAC key", session);
+	sess = (struct aes_cipher *)session;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	slot = params[0].value.a;
+	if (slot >= TA_AES_MAX_MAC_SLOTS) {
+		EMSG("Invalid MAC slot %" PRIu32, slot);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	key_sz = params[1].memref.size;
+	if (key_sz < TA_AES_MAC_MIN_KEY_SIZE ||
+	    key_sz > TA_AES_MAC_MAX_KEY_SIZE) {
+		EMSG("Wrong MAC key size %" PRIu32, key_sz);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	res = TEE_AllocateTransientObject(TEE_TYPE_HMAC_SHA256, key_sz * 8,
+					  &key_handle);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to allocate transient object");
+		return res;
+	}
+
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE,
+			     params[1].memref.buffer, key_sz);
+	res = TEE_PopulateTransientObject(key_handle, &attr, 1);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_PopulateTransientObject failed, %x", res);
+		goto out;
+	}
+
+	/* The maximum key size is fixed at allocation, start over */
+	op = &sess->mac_ops[slot];
+	init_op = &sess->mac_init_ops[slot];
+	if (*op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(*op);
+	if (*init_op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(*init_op);
+	*op = TEE_HANDLE_NULL;
+	*init_op = TEE_HANDLE_NULL;
+	res = TEE_AllocateOperation(init_op, TEE_ALG_HMAC_SHA256, TEE_MODE_MAC,
+				    key_sz * 8);
+	if (res == TEE_SUCCESS)
+		res = TEE_AllocateOperation(op, TEE_ALG_HMAC_SHA256,
+					    TEE_MODE_MAC, key_sz * 8);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to allocate operation");
+		goto err;
+	}
+
+	res = TEE_SetOperationKey(*init_op, key_handle);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SetOperationKey failed %x", res);
+		goto err;
+	}
+	TEE_MACInit(*init_op, NULL, 0);
+	TEE_CopyOperation(*op, *init_op);
+	goto out;
+
+err:
+	if (*op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(*op);
+	if (*init_op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(*init_op);
+	*op = TEE_HANDLE_NULL;
+	*init_op = TEE_HANDLE_NULL;
+out:
+	TEE_FreeTransientObject(key_handle);
+	return res;
+}
+
+/*
+ * Process command TA_AES_CMD_MAC_UPDATE. API in aes_ta.h
+ */
+static TEE_Result mac_update(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_OperationHandle op;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	op = mac_op((struct aes_cipher *)session, params[0].value.a);
+	if (op == TEE_HANDLE_NULL)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MACUpdate(op, params[1].memref.buffer, params[1].memref.size);
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_AES_CMD_MAC_FINAL. API in aes_ta.h
+ */
+static TEE_Result mac_final(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE);
+	struct aes_cipher *sess = (struct aes_cipher *)session;
+	TEE_OperationHandle op;
+	TEE_Result res;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	op = mac_op(sess, params[0].value.a);
+	if (op == TEE_HANDLE_NULL)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[2].memref.size < TA_AES_MAC_SIZE) {
+		params[2].memref.size = TA_AES_MAC_SIZE;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	res = TEE_MACComputeFinal(op, params[1].memref.buffer,
+				  params[1].memref.size,
+				  params[2].memref.buffer,
+				  &params[2].memref.size);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_MACComputeFinal failed %x", res);
+		return res;
+	}
+
+	/* The key stays loaded, get ready for the next message */
+	TEE_CopyOperation(op, sess->mac_init_ops[params[0].value.a]);
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * SHA-256 operation of the session, allocated by the first digest command
+ */
+static TEE_Result get_digest_op(struct aes_cipher *sess,
+				TEE_OperationHandle *op)
+{
+	TEE_Result res;
+
+	if (sess->digest_op == TEE_HANDLE_NULL) {
+		res = TEE_AllocateOperation(&sess->digest_op, TEE_ALG_SHA256,
+					    TEE_MODE_DIGEST, 0);
+		if (res != TEE_SUCCESS) {
+			EMSG("Failed to allocate operation");
+			sess->digest_op = TEE_HANDLE_NULL;
+			return res;
+		}
+	}
+	*op = sess->digest_op;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_AES_CMD_DIGEST_UPDATE. API in aes_ta.h
+ */
+static TEE_Result digest_update(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_OperationHandle op;
+	TEE_Result res;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_digest_op((struct aes_cipher *)session, &op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	TEE_DigestUpdate(op, params[0].memref.buffer, params[0].memref.size);
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_AES_CMD_DIGEST_FINAL. API in aes_ta.h
+ *
+ * TEE_DigestDoFinal() leaves the operation in its initial state, ready for
+ * the next message.
+ */
+static TEE_Result digest_final(void *session, uint32_t param_types,
+				TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_OperationHandle op;
+	TEE_Result res;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = get_digest_op((struct aes_cipher *)session, &op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_DigestDoFinal(op, params[0].memref.buffer,
+				params[0].memref.size,
+				params[1].memref.buffer,
+				&params[1].memref.size);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_DigestDoFinal failed %x", res);
+
+	return res;
+}
+
+/*
+ * Process command TA_AES_CMD_GEN_IV. API in aes_ta.h
+ */
+static TEE_Result gen_iv(void __unused *session, uint32_t param_types,
+			 TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	uint32_t iv_sz;
+	uint8_t *out;
+	uint32_t off;
+
+	/* Safely get the invocation parameters */
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	iv_sz = params[0].value.b;
+	out = params[1].memref.buffer;
+
+	if (!iv_sz || params[1].memref.size % iv_sz) {
+		EMSG("Bad sizes: out %" PRIu32 ", IV %" PRIu32,
+		     params[1].memref.size, iv_sz);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	switch (params[0].value.a) {
+	case TA_AES_RAND_DIRECT:
+		for (off = 0; off < params[1].memref.size; off += iv_sz)
+			TEE_GenerateRandom(out + off, iv_sz);
+		return TEE_SUCCESS;
+	case TA_AES_RAND_POOL:
+		for (off = 0; off < params[1].memref.size; off += iv_sz)
+			rand_pool_get(out + off, iv_sz);
+		return TEE_SUCCESS;
+	default:
+		EMSG("Invalid random source %" PRIu32, params[0].value.a);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
 	/* Nothing to do */
@@ -369,7 +1147,7 @@ TEE_Result TA_CreateEntryPoint(void)
 
 void TA_DestroyEntryPoint(void)
 {
-	/* Nothing to do */
+	rand_pool_wipe();
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
@@ -377,6 +1155,7 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 					void __unused **session)
 {
 	struct aes_cipher *sess;
+	size_t n;
 
 	/*
 	 * Allocate and init ciphering materials for the session.
@@ -389,6 +1168,14 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
 
 	sess->key_handle = TEE_HANDLE_NULL;
 	sess->op_handle = TEE_HANDLE_NULL;
+	for (n = 0; n < TA_AES_MAX_SLOTS; n++)
+		sess->slot_ops[n] = TEE_HANDLE_NULL;
+	sess->cur_slot = TA_AES_SLOT_SESSION;
+	for (n = 0; n < TA_AES_MAX_MAC_SLOTS; n++) {
+		sess->mac_ops[n] = TEE_HANDLE_NULL;
+		sess->mac_init_ops[n] = TEE_HANDLE_NULL;
+	}
+	sess->digest_op = TEE_HANDLE_NULL;
 
 	*session = (void *)sess;
 	DMSG("Session %p: newly allocated", *session);
@@ -409,6 +1196,10 @@ void TA_CloseSessionEntryPoint(void *session)
 		TEE_FreeTransientObject(sess->key_handle);
 	if (sess->op_handle != TEE_HANDLE_NULL)
 		TEE_FreeOperation(sess->op_handle);
+	free_slot_ops(sess);
+	free_mac_ops(sess);
+	if (sess->digest_op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(sess->digest_op);
 	TEE_Free(sess);
 }
 
@@ -426,6 +1217,30 @@ TEE_Result TA_InvokeCommandEntryPoint(void *session,
 		return reset_aes_iv(session, param_types, params);
 	case TA_AES_CMD_CIPHER:
 		return cipher_buffer(session, param_types, params);
+	case TA_AES_CMD_SET_SLOT_KEY:
+		return set_slot_key(session, param_types, params);
+	case TA_AES_CMD_SELECT_SLOT:
+		return select_slot(session, param_types, params);
+	case TA_AES_CMD_GCM_ENCRYPT:
+		return gcm_buffer(session, param_types, params, true);
+	case TA_AES_CMD_GCM_DECRYPT:
+		return gcm_buffer(session, param_types, params, false);
+	case TA_AES_CMD_TRANSFER:
+		return transfer_buffer(session, param_types, params);
+	case TA_AES_CMD_CIPHER_BATCH:
+		return cipher_batch(session, param_types, params);
+	case TA_AES_CMD_MAC_SET_KEY:
+		return set_mac_key(session, param_types, params);
+	case TA_AES_CMD_MAC_UPDATE:
+		return mac_update(session, param_types, params);
+	case TA_AES_CMD_MAC_FINAL:
+		return mac_final(session, param_types, params);
+	case TA_AES_CMD_DIGEST_UPDATE:
+		return digest_update(session, param_types, params);
+	case TA_AES_CMD_DIGEST_FINAL:
+		return digest_final(session, param_types, params);
+	case TA_AES_CMD_GEN_IV:
+		return gen_iv(session, param_types, params);
 	default:
 		EMSG("Command ID 0x%x is not supported", cmd);
 		return TEE_ERROR_NOT_SUPPORTED;
@@ -28,6 +28,8 @@
 #ifndef __AES_TA_H__
 #define __AES_TA_H__
 
+#include <stdint.h>
+
 /* UUID of the AES example trusted application */
 #define TA_AES_UUID \
 	{ 0x5dbac793, 0xf574, 0x4871, \
@@ -45,6 +47,7 @@
 #define TA_AES_ALGO_ECB			0
 #define TA_AES_ALGO_CBC			1
 #define TA_AES_ALGO_CTR			2
+#define TA_AES_ALGO_GCM			3
 
 #define TA_AES_SIZE_128BIT		(128 / 8)
 #define TA_AES_SIZE_256BIT		(256 / 8)
@@ -72,11 +75,168 @@
 
 /*
  * TA_AES_CMD_CIPHER - Cipher input buffer into output buffer
- * param[0] (memref) input buffer
+ * param[0] (memref) input buffer, or an inout buffer ciphered in place
+ *          when param[1] is unused
  * param[1] (memref) output buffer (shall be bigger than input buffer)
  * param[2] unused
  * param[3] unused
  */
 #define TA_AES_CMD_CIPHER		3
 
+#define TA_AES_BLOCK_SIZE		16
+#define TA_AES_IV_SIZE			16
+
+/*
+ * TA_AES_CMD_SET_SLOT_KEY - Load a key into a session key slot. Each slot
+ * keeps its own keyed operation, using the algorithm, key size and mode set
+ * by TA_AES_CMD_PREPARE, which also clears all slots.
+ * param[0] (value) a: slot index, below TA_AES_MAX_SLOTS, b: unused
+ * param[1] (memref) key data, size shall equal key length
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_SET_SLOT_KEY		4
+#define TA_AES_MAX_SLOTS		8
+
+/*
+ * TA_AES_CMD_SELECT_SLOT - Make TA_AES_CMD_SET_IV and TA_AES_CMD_CIPHER use
+ * the key of a slot and reset its IV. TA_AES_SLOT_SESSION selects the key
+ * of TA_AES_CMD_SET_KEY again, as does TA_AES_CMD_SET_KEY itself.
+ * param[0] (value) a: slot index or TA_AES_SLOT_SESSION, b: unused
+ * param[1] (memref) initial vector, size shall equal block length
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_SELECT_SLOT		6
+#define TA_AES_SLOT_SESSION		0xffffffff
+
+/*
+ * TA_AES_CMD_CIPHER_BATCH - Cipher several regions of one buffer in a
+ * single invocation. Each descriptor restarts the cipher with its own key
+ * slot and IV, so entries are independent messages. For ECB and CBC the
+ * length shall be a multiple of TA_AES_BLOCK_SIZE. Input and output regions
+ * of an entry are either identical (in place) or disjoint. Entries restart
+ * the slot operations, so a slot picked by TA_AES_CMD_SELECT_SLOT needs a
+ * new IV after a batch.
+ * param[0] (memref) table of struct ta_aes_batch_desc
+ * param[1] (memref) data buffer the descriptor offsets refer to
+ * param[2] (value) a: number of descriptors processed, b: unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_CIPHER_BATCH		5
+
+struct ta_aes_batch_desc {
+	uint32_t slot;			/* key slot, see TA_AES_CMD_SET_SLOT_KEY */
+	uint32_t in_offset;		/* input offset in the data buffer */
+	uint32_t len;			/* bytes to cipher */
+	uint32_t out_offset;		/* output offset in the data buffer */
+	uint8_t iv[TA_AES_IV_SIZE];	/* initial vector for this entry */
+};
+
+/*
+ * TA_AES_CMD_GCM_ENCRYPT - Encrypt and tag a message in one invocation. The
+ * session shall be prepared with TA_AES_ALGO_GCM and TA_AES_MODE_ENCODE.
+ * param[0] (value) a: key slot or TA_AES_SLOT_SESSION, b: AAD size in bytes
+ * param[1] (memref) nonce
+ * param[2] (memref) AAD followed by the payload
+ * param[3] (memref) ciphertext followed by a TA_AES_GCM_TAG_SIZE bytes tag
+ */
+#define TA_AES_CMD_GCM_ENCRYPT		7
+
+/*
+ * TA_AES_CMD_GCM_DECRYPT - Verify and decrypt a message in one invocation.
+ * The session shall be prepared with TA_AES_ALGO_GCM and TA_AES_MODE_DECODE.
+ * Returns TEE_ERROR_MAC_INVALID, leaving the output untouched, on a tag
+ * mismatch.
+ * param[0] (value) a: key slot or TA_AES_SLOT_SESSION, b: AAD size in bytes
+ * param[1] (memref) nonce
+ * param[2] (memref) AAD, ciphertext and TA_AES_GCM_TAG_SIZE bytes tag
+ * param[3] (memref) plaintext
+ */
+#define TA_AES_CMD_GCM_DECRYPT		8
+
+#define TA_AES_GCM_TAG_SIZE		16
+#define TA_AES_GCM_NONCE_SIZE		12
+
+/*
+ * TA_AES_CMD_TRANSFER - Take the buffers of TA_AES_CMD_CIPHER without
+ * ciphering them, to measure the cost of the invocation itself
+ * param[0] (memref) input buffer
+ * param[1] (memref) output buffer (shall be bigger than input buffer)
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_TRANSFER		9
+
+/*
+ * TA_AES_CMD_MAC_SET_KEY - Load an HMAC-SHA256 key into a MAC slot. The slot
+ * operation stays keyed until the next key load or the end of the session,
+ * and is ready for a new message after TA_AES_CMD_MAC_FINAL. MAC slots do
+ * not depend on TA_AES_CMD_PREPARE.
+ * param[0] (value) a: MAC slot index, below TA_AES_MAX_MAC_SLOTS, b: unused
+ * param[1] (memref) key data, TA_AES_MAC_MIN_KEY_SIZE to
+ *          TA_AES_MAC_MAX_KEY_SIZE bytes
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_MAC_SET_KEY		10
+#define TA_AES_MAX_MAC_SLOTS		4
+#define TA_AES_MAC_MIN_KEY_SIZE		24
+#define TA_AES_MAC_MAX_KEY_SIZE		128
+#define TA_AES_MAC_SIZE			32
+
+/*
+ * TA_AES_CMD_MAC_UPDATE - Add data to the message of a MAC slot. A message
+ * may span any number of invocations.
+ * param[0] (value) a: MAC slot index, b: unused
+ * param[1] (memref) message chunk
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_MAC_UPDATE		11
+
+/*
+ * TA_AES_CMD_MAC_FINAL - Add the last chunk and return the HMAC of the
+ * message, then start a new message with the same key. Without a previous
+ * TA_AES_CMD_MAC_UPDATE this is a single invocation HMAC.
+ * param[0] (value) a: MAC slot index, b: unused
+ * param[1] (memref) last message chunk, may be empty
+ * param[2] (memref) HMAC, TA_AES_MAC_SIZE bytes
+ * param[3] unused
+ */
+#define TA_AES_CMD_MAC_FINAL		12
+
+/*
+ * TA_AES_CMD_DIGEST_UPDATE - Add data to the SHA-256 digest of the session
+ * param[0] (memref) message chunk
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_DIGEST_UPDATE	13
+
+/*
+ * TA_AES_CMD_DIGEST_FINAL - Add the last chunk and return the SHA-256 digest,
+ * the next TA_AES_CMD_DIGEST_UPDATE starts a new message
+ * param[0] (memref) last message chunk, may be empty
+ * param[1] (memref) digest, TA_AES_DIGEST_SIZE bytes
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_DIGEST_FINAL		14
+#define TA_AES_DIGEST_SIZE		32
+
+/*
+ * TA_AES_CMD_GEN_IV - Fill a buffer with IVs or nonces, each drawn by its own
+ * call to the random source, to compare the cost of one TEE_GenerateRandom()
+ * per IV against the TA random pool
+ * param[0] (value) a: TA_AES_RAND_DIRECT/_POOL, b: IV size in bytes
+ * param[1] (memref) output, its size shall be a multiple of the IV size
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_AES_CMD_GEN_IV		15
+#define TA_AES_RAND_DIRECT		0
+#define TA_AES_RAND_POOL		1
+
 #endif /* __AES_TA_H */
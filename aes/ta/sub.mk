@@ -1,2 +1,4 @@
 global-incdirs-y += include
+global-incdirs-y += ../../lib/ta/include
 srcs-y += aes_ta.c
+srcs-y += ../../lib/ta/rand_pool.c
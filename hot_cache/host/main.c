@@ -20,6 +20,8 @@
 /* TA API: UUID and command IDs */
 #include <hot_cache_ta.h>
 
+#include "nw_crypto.h"
+
 /* TEE resources */
 struct test_ctx {
 	TEEC_Context ctx;
@@ -35,6 +37,7 @@ typedef struct mqttz_client {
 #define MQTTZ_MAX_MSG_SIZE              2096
 #define AES_IV_SIZE                     16
 #define AES_KEY_SIZE                    32
+#define MQTTZ_CLI_ID_SIZE               12
 // Benchmark Parameters
 #define NUMBER_TESTS                    10
 #define NUMBER_WORLDS                   2
@@ -89,41 +92,32 @@ void handleErrors(void)
     abort();
 }
 
-// Encryption in the NS world using OpenSSL
-int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
-        unsigned char *iv, unsigned char *cipher_text, int key_size)
+const EVP_CIPHER *aes_cbc(int key_size)
 {
-    EVP_CIPHER_CTX *ctx;
-    int len;
-    int cipher_text_len;
-    // Create and initialise the context
-    if (!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
-    // Initialise the encryption operation
-    switch (key_size) 
+    switch (key_size)
     {
         case 16:
-            if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv))
-                handleErrors();
-            break;
+            return EVP_aes_128_cbc();
         case 32:
-            if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv))
-                handleErrors();
-            break;
+            return EVP_aes_256_cbc();
         default:
-            return -1;
+            return NULL;
     }
-    // Encrypt the input text
-    if (1 != EVP_EncryptUpdate(ctx, cipher_text, &len, plain_text,
-                plain_text_len))
-        handleErrors();
-    cipher_text_len = len;
-    // Finalise the encryption
-    if (1 != EVP_EncryptFinal_ex(ctx, cipher_text + len, &len))
+}
+
+// Encryption in the NS world using OpenSSL, through the engine in
+// nw_crypto.c that keeps the keyed contexts of each thread
+int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
+        unsigned char *iv, unsigned char *cipher_text, int key_size)
+{
+    const EVP_CIPHER *cipher = aes_cbc(key_size);
+    int cipher_text_len;
+    if (!cipher)
+        return -1;
+    cipher_text_len = nw_cipher(cipher, key, iv, 1, plain_text,
+            plain_text_len, cipher_text);
+    if (cipher_text_len < 0)
         handleErrors();
-    cipher_text_len += len;
-    // Clean Context
-    EVP_CIPHER_CTX_free(ctx);
     return cipher_text_len;
 }
 
@@ -131,36 +125,14 @@ int encrypt(unsigned char *plain_text, int plain_text_len, unsigned char *key,
 int decrypt(unsigned char *cipher_text, int cipher_text_len, unsigned char *key,
         unsigned char *iv, unsigned char *decrypted_text, int key_size)
 {
-    EVP_CIPHER_CTX *ctx;
-    int len;
+    const EVP_CIPHER *cipher = aes_cbc(key_size);
     int decrypted_text_len;
-    // Initialise context
-    if(!(ctx = EVP_CIPHER_CTX_new()))
-        handleErrors();
-    // Initialise cipher suite
-    switch (key_size)
-    {
-        case 16:
-            if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, key, iv)) 
-                handleErrors();
-            break;
-        case 32:
-            if(1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv)) 
-                handleErrors();
-            break;
-        default:
-            return -1;
-    }
-    // Start decryption
-    if(1 != EVP_DecryptUpdate(ctx, decrypted_text, &len, cipher_text,
-                cipher_text_len)) 
+    if (!cipher)
+        return -1;
+    decrypted_text_len = nw_cipher(cipher, key, iv, 0, cipher_text,
+            cipher_text_len, decrypted_text);
+    if (decrypted_text_len < 0)
         handleErrors();
-    decrypted_text_len = len;
-    // Finalise decryption
-    if(1 != EVP_DecryptFinal_ex(ctx, decrypted_text + len, &len))
-        handleErrors();
-    decrypted_text_len += len;
-    EVP_CIPHER_CTX_free(ctx);
     return decrypted_text_len;
 }
 
@@ -587,6 +559,616 @@ int benchmark(struct test_ctx *ctx, mqttz_client *origin, mqttz_client *dest,
     printf("MQT-TZ: Finished printing results!\n");
 }
 
+/*
+ * Store a client key in the TA. With cmd TA_SECURE_STORAGE_CMD_WRITE_RAW the
+ * key is written to secure storage before returning, with
+ * TA_HOT_CACHE_CMD_PUT_KEY it goes to the write-behind buffer.
+ */
+TEEC_Result tee_write_key(struct test_ctx *ctx, char *cli_id, char *cli_key,
+        uint32_t cmd)
+{
+    TEEC_Operation op;
+    uint32_t ori;
+
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_NONE,
+            TEEC_NONE);
+    op.params[0].tmpref.buffer = cli_id;
+    op.params[0].tmpref.size = MQTTZ_CLI_ID_SIZE;
+    op.params[1].tmpref.buffer = cli_key;
+    op.params[1].tmpref.size = AES_KEY_SIZE;
+    return TEEC_InvokeCommand(&ctx->sess, cmd, &op, &ori);
+}
+
+TEEC_Result tee_delete_key(struct test_ctx *ctx, char *cli_id)
+{
+    TEEC_Operation op;
+    uint32_t ori;
+
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_NONE,
+            TEEC_NONE,
+            TEEC_NONE);
+    op.params[0].tmpref.buffer = cli_id;
+    op.params[0].tmpref.size = MQTTZ_CLI_ID_SIZE;
+    return TEEC_InvokeCommand(&ctx->sess, TA_SECURE_STORAGE_CMD_DELETE, &op,
+            &ori);
+}
+
+TEEC_Result tee_flush_keys(struct test_ctx *ctx, uint32_t *flushed)
+{
+    TEEC_Operation op;
+    uint32_t ori;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_OUTPUT,
+            TEEC_NONE,
+            TEEC_NONE,
+            TEEC_NONE);
+    res = TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_FLUSH, &op, &ori);
+    if (flushed)
+        *flushed = op.params[0].value.a;
+    return res;
+}
+
+/*
+ * Run the deferred storage work of the TA, *applied receives the number of
+ * logged keys written to their objects
+ */
+TEEC_Result tee_idle(struct test_ctx *ctx, uint32_t *applied)
+{
+    TEEC_Operation op;
+    uint32_t ori;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_OUTPUT,
+            TEEC_NONE,
+            TEEC_NONE,
+            TEEC_NONE);
+    res = TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_IDLE, &op, &ori);
+    if (applied)
+        *applied = op.params[0].value.a;
+    return res;
+}
+
+/*
+ * Key provisioning benchmark: store num_keys keys synchronously and then
+ * through the write-behind buffer, and compare the latency seen by the
+ * caller. The buffered run includes the final flush in its total, the
+ * application of the key log to the key objects that follows is done by
+ * TA_HOT_CACHE_CMD_IDLE and reported on its own.
+ */
+int key_provisioning_benchmark(struct test_ctx *ctx, int num_keys)
+{
+    struct timeval t_ini, t_end, t_aux;
+    char cli_id[MQTTZ_CLI_ID_SIZE + 1];
+    char cli_key[AES_KEY_SIZE + 1];
+    double *sync_times, *buf_times;
+    double sync_total = 0.0, buf_total = 0.0, flush_time, idle_time;
+    uint32_t flushed, applied;
+    int i;
+
+    sync_times = malloc(sizeof *sync_times * num_keys);
+    buf_times = malloc(sizeof *buf_times * num_keys);
+    if (!sync_times || !buf_times)
+        return 1;
+    memset(cli_key, '1', AES_KEY_SIZE);
+    cli_key[AES_KEY_SIZE] = '\0';
+    prepare_tee_session(ctx);
+    for (i = 0; i < num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", i);
+        gettimeofday(&t_ini, NULL);
+        if (tee_write_key(ctx, cli_id, cli_key,
+                    TA_SECURE_STORAGE_CMD_WRITE_RAW) != TEEC_SUCCESS)
+            errx(1, "Synchronous key write failed");
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        sync_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+        sync_total += sync_times[i];
+    }
+    // Rotate the same keys again, this time through the buffer
+    memset(cli_key, '2', AES_KEY_SIZE);
+    for (i = 0; i < num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", i);
+        gettimeofday(&t_ini, NULL);
+        if (tee_write_key(ctx, cli_id, cli_key, TA_HOT_CACHE_CMD_PUT_KEY)
+                != TEEC_SUCCESS)
+            errx(1, "Buffered key write failed");
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        buf_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+        buf_total += buf_times[i];
+    }
+    gettimeofday(&t_ini, NULL);
+    if (tee_flush_keys(ctx, &flushed) != TEEC_SUCCESS)
+        errx(1, "Key flush failed");
+    gettimeofday(&t_end, NULL);
+    timersub(&t_end, &t_ini, &t_aux);
+    flush_time = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    buf_total += flush_time;
+    gettimeofday(&t_ini, NULL);
+    if (tee_idle(ctx, &applied) != TEEC_SUCCESS)
+        errx(1, "Key log compaction failed");
+    gettimeofday(&t_end, NULL);
+    timersub(&t_end, &t_ini, &t_aux);
+    idle_time = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    terminate_tee_session(ctx);
+    printf("MQT-TZ: Key provisioning of %i keys (ms)\n", num_keys);
+    printf("Per key latency (avg, stdev), Total\n");
+    printf("Synchronous: %f %f %f\n", avg(sync_times, num_keys),
+            stdev(sync_times, num_keys), sync_total);
+    printf("Buffered:    %f %f %f\n", avg(buf_times, num_keys),
+            stdev(buf_times, num_keys), buf_total);
+    printf("Final flush: %f (%u keys)\n", flush_time, flushed);
+    printf("Idle apply:  %f (%u keys)\n", idle_time, applied);
+    free(sync_times);
+    free(buf_times);
+    return 0;
+}
+
+/*
+ * Rotate num_keys keys through TA_HOT_CACHE_CMD_ROTATE_KEYS. The TA handles
+ * a bounded number of keys per call, so the per call latency is the longest
+ * a re-encryption waits behind the rotation.
+ */
+int key_rotation_benchmark(struct test_ctx *ctx, int num_keys)
+{
+    struct timeval t_ini, t_end, t_aux;
+    const size_t entry_sz = MQTTZ_CLI_ID_SIZE + AES_KEY_SIZE;
+    char cli_id[MQTTZ_CLI_ID_SIZE + 1];
+    char *entries;
+    double *call_times;
+    double total = 0.0, max = 0.0;
+    int num_calls = 0;
+    int done = 0;
+    int i;
+    TEEC_Operation op;
+    uint32_t ori;
+
+    entries = malloc(entry_sz * num_keys);
+    call_times = malloc(sizeof *call_times * num_keys);
+    if (!entries || !call_times)
+        return 1;
+    for (i = 0; i < num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", i);
+        memcpy(entries + i * entry_sz, cli_id, MQTTZ_CLI_ID_SIZE);
+        memset(entries + i * entry_sz + MQTTZ_CLI_ID_SIZE, 'a' + i % 26,
+                AES_KEY_SIZE);
+    }
+    prepare_tee_session(ctx);
+    while (done < num_keys)
+    {
+        memset(&op, 0, sizeof op);
+        op.paramTypes = TEEC_PARAM_TYPES(
+                TEEC_MEMREF_TEMP_INPUT,
+                TEEC_VALUE_OUTPUT,
+                TEEC_NONE,
+                TEEC_NONE);
+        op.params[0].tmpref.buffer = entries + done * entry_sz;
+        op.params[0].tmpref.size = (num_keys - done) * entry_sz;
+        gettimeofday(&t_ini, NULL);
+        if (TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_ROTATE_KEYS, &op,
+                    &ori) != TEEC_SUCCESS)
+            errx(1, "Key rotation failed after %i keys", done);
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        call_times[num_calls] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+        total += call_times[num_calls];
+        if (call_times[num_calls] > max)
+            max = call_times[num_calls];
+        num_calls++;
+        done += op.params[1].value.a;
+    }
+    terminate_tee_session(ctx);
+    printf("MQT-TZ: Rotation of %i keys in %i calls (ms)\n", num_keys,
+            num_calls);
+    printf("Per call (avg, stdev, max), Total\n");
+    printf("%f %f %f %f\n", avg(call_times, num_calls),
+            stdev(call_times, num_calls), max, total);
+    free(entries);
+    free(call_times);
+    return 0;
+}
+
+/*
+ * Ask the TA to load the keys of num_ids packed client IDs into its cache.
+ */
+TEEC_Result tee_prefetch_keys(struct test_ctx *ctx, char *ids, int num_ids,
+        uint32_t *loaded, uint32_t *cached)
+{
+    TEEC_Operation op;
+    uint32_t ori;
+    TEEC_Result res;
+
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_VALUE_OUTPUT,
+            TEEC_NONE,
+            TEEC_NONE);
+    op.params[0].tmpref.buffer = ids;
+    op.params[0].tmpref.size = num_ids * MQTTZ_CLI_ID_SIZE;
+    res = TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_PREFETCH, &op, &ori);
+    *loaded = op.params[1].value.a;
+    *cached = op.params[1].value.b;
+    return res;
+}
+
+/*
+ * Re-encrypt one message per client for num_keys clients whose keys are
+ * not cached, then for num_keys more whose keys were prefetched, and
+ * compare the host side latency of the two sets. The TA is single
+ * instance, so a prefetch running next to the re-encryptions would only
+ * queue in front of them: it is timed on its own and completes before the
+ * second set starts.
+ */
+int prefetch_benchmark(struct test_ctx *ctx, int num_keys)
+{
+    struct timeval t_ini, t_end, t_aux;
+    char cli_id[MQTTZ_CLI_ID_SIZE + 1];
+    char cli_key[AES_KEY_SIZE + 1];
+    char *ids;
+    double *cold_times, *warm_times;
+    double prefetch_time;
+    mqttz_client origin, dest;
+    mqttz_times times;
+    uint32_t loaded, cached;
+    TEEC_Result res;
+    int base = (getpid() % 10000) * 1000;
+    int i;
+
+    if (num_keys > TA_HOT_CACHE_KEY_CACHE_SZ / 2)
+        num_keys = TA_HOT_CACHE_KEY_CACHE_SZ / 2;
+    ids = malloc(2 * num_keys * MQTTZ_CLI_ID_SIZE + 1);
+    cold_times = malloc(sizeof *cold_times * num_keys);
+    warm_times = malloc(sizeof *warm_times * num_keys);
+    origin.iv = malloc(AES_IV_SIZE + 1);
+    origin.data = malloc(256 + 1);
+    if (!ids || !cold_times || !warm_times || !origin.iv || !origin.data)
+        return 1;
+    memset(origin.iv, '1', AES_IV_SIZE);
+    origin.iv[AES_IV_SIZE] = '\0';
+    memset(origin.data, 'h', 256);
+    origin.data[256] = '\0';
+    dest.iv = origin.iv;
+    dest.data = origin.data;
+    memset(&times, 0, sizeof times);
+    times.key_mode = KEY_IN_SS;
+    memset(cli_key, '1', AES_KEY_SIZE);
+    cli_key[AES_KEY_SIZE] = '\0';
+
+    // Fresh client IDs so that nothing is cached from an earlier run
+    prepare_tee_session(ctx);
+    for (i = 0; i < 2 * num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", base + i);
+        memcpy(ids + i * MQTTZ_CLI_ID_SIZE, cli_id, MQTTZ_CLI_ID_SIZE + 1);
+        if (tee_write_key(ctx, cli_id, cli_key,
+                    TA_SECURE_STORAGE_CMD_WRITE_RAW) != TEEC_SUCCESS)
+            errx(1, "Key write failed");
+    }
+
+    for (i = 0; i < num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", base + i);
+        origin.cli_id = dest.cli_id = cli_id;
+        gettimeofday(&t_ini, NULL);
+        payload_reencryption(ctx, &origin, &dest, &times);
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        cold_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    }
+
+    gettimeofday(&t_ini, NULL);
+    res = tee_prefetch_keys(ctx, ids + num_keys * MQTTZ_CLI_ID_SIZE, num_keys,
+            &loaded, &cached);
+    gettimeofday(&t_end, NULL);
+    timersub(&t_end, &t_ini, &t_aux);
+    prefetch_time = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    if (res != TEEC_SUCCESS)
+        printf("MQT-TZ: Prefetch failed with code 0x%x\n", res);
+    for (i = 0; i < num_keys; i++)
+    {
+        snprintf(cli_id, sizeof cli_id, "%012i", base + num_keys + i);
+        origin.cli_id = dest.cli_id = cli_id;
+        gettimeofday(&t_ini, NULL);
+        payload_reencryption(ctx, &origin, &dest, &times);
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        warm_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    }
+
+    // Drop the keys of this run, they would pile up in secure storage
+    for (i = 0; i < 2 * num_keys; i++)
+        if (tee_delete_key(ctx, ids + i * MQTTZ_CLI_ID_SIZE) != TEEC_SUCCESS)
+            printf("MQT-TZ: Failed to delete key %.*s\n", MQTTZ_CLI_ID_SIZE,
+                    ids + i * MQTTZ_CLI_ID_SIZE);
+    terminate_tee_session(ctx);
+
+    printf("MQT-TZ: Re-encryption latency over %i clients (ms)\n", num_keys);
+    printf("Cold cache: %f %f\n", avg(cold_times, num_keys),
+            stdev(cold_times, num_keys));
+    printf("Prefetched: %f %f (%u loaded, %u already cached)\n",
+            avg(warm_times, num_keys), stdev(warm_times, num_keys),
+            loaded, cached);
+    printf("Prefetch call: %f\n", prefetch_time);
+    free(ids);
+    free(cold_times);
+    free(warm_times);
+    free(origin.iv);
+    free(origin.data);
+    return 0;
+}
+
+/*
+ * Host side of the publish benchmark: a plain TCP connection to the broker
+ * and the same MQTT 3.1.1 packets the TA builds in ta/mqtt.c (clean
+ * session CONNECT, QoS 0 PUBLISH, PINGREQ).
+ */
+static size_t mqtt_remaining_length(unsigned char *buf, size_t remaining)
+{
+    size_t n = 0;
+
+    do
+    {
+        buf[n] = remaining % 128;
+        remaining /= 128;
+        if (remaining)
+            buf[n] |= 0x80;
+        n++;
+    } while (remaining);
+    return n;
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len)
+    {
+        n = send(fd, p, len, 0);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len)
+    {
+        n = recv(fd, p, len, 0);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int host_mqtt_connect(const char *broker, int port, const char *id,
+        uint16_t keep_alive)
+{
+    struct sockaddr_in addr;
+    unsigned char pkt[64];
+    size_t id_len = strlen(id);
+    size_t n;
+    int fd;
+
+    if (id_len > 23)
+        return -1;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, broker, &addr.sin_addr) != 1)
+        return -1;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+        goto err;
+
+    pkt[0] = 0x10;
+    n = 1 + mqtt_remaining_length(pkt + 1, 12 + id_len);
+    memcpy(pkt + n, "\x00\x04MQTT\x04\x02", 8);
+    n += 8;
+    pkt[n++] = keep_alive >> 8;
+    pkt[n++] = keep_alive & 0xff;
+    pkt[n++] = id_len >> 8;
+    pkt[n++] = id_len & 0xff;
+    memcpy(pkt + n, id, id_len);
+    n += id_len;
+    // CONNACK: type, length 2, flags, return code 0 when accepted
+    if (send_all(fd, pkt, n) || recv_all(fd, pkt, 4) ||
+            pkt[0] != 0x20 || pkt[1] != 2 || pkt[3] != 0)
+        goto err;
+    return fd;
+err:
+    close(fd);
+    return -1;
+}
+
+/*
+ * Build the PUBLISH in pkt and send it in one go, as the TA does with the
+ * packet it re-encrypts into
+ */
+static int host_mqtt_publish(int fd, unsigned char *pkt, size_t pkt_sz,
+        const char *topic, const char *payload, size_t payload_len)
+{
+    size_t topic_len = strlen(topic);
+    size_t n;
+
+    if (5 + 2 + topic_len + payload_len > pkt_sz)
+        return -1;
+    pkt[0] = 0x30;
+    n = 1 + mqtt_remaining_length(pkt + 1, 2 + topic_len + payload_len);
+    pkt[n++] = topic_len >> 8;
+    pkt[n++] = topic_len & 0xff;
+    memcpy(pkt + n, topic, topic_len);
+    n += topic_len;
+    memcpy(pkt + n, payload, payload_len);
+    return send_all(fd, pkt, n + payload_len);
+}
+
+static int host_mqtt_ping(int fd)
+{
+    unsigned char pkt[2] = { 0xc0, 0 };
+
+    if (send_all(fd, pkt, 2) || recv_all(fd, pkt, 2))
+        return -1;
+    return pkt[0] == 0xd0 && pkt[1] == 0 ? 0 : -1;
+}
+
+/*
+ * Publish num_msgs re-encrypted messages to an MQTT broker from the TA and
+ * compare them with the host path: TA_REENCRYPT returns the new ciphertext
+ * and the host publishes it on its own connection to the same broker.
+ */
+int publish_benchmark(struct test_ctx *ctx, const char *broker, int port,
+        const char *topic, int num_msgs)
+{
+    struct timeval t_ini, t_end, t_aux;
+    const char cli_id[] = "123123123123";
+    const char mqtt_id[] = "mqttz-hot-cache";
+    const char host_mqtt_id[] = "mqttz-hot-cache-host";
+    const size_t msg_sz = MQTTZ_CLI_ID_SIZE + AES_IV_SIZE + 256;
+    const size_t out_sz = MQTTZ_CLI_ID_SIZE + AES_IV_SIZE + MQTTZ_MAX_MSG_SIZE;
+    const size_t pkt_sz = 5 + 2 + TA_HOT_CACHE_MQTT_TOPIC_MAX + msg_sz;
+    char *msg, *out;
+    unsigned char *pkt;
+    char ta_times[100];
+    double *ret_times, *pub_times;
+    TEEC_Operation op;
+    uint32_t ori;
+    int fd;
+    int i;
+
+    if (strlen(topic) > TA_HOT_CACHE_MQTT_TOPIC_MAX)
+        errx(1, "Topic longer than %i bytes", TA_HOT_CACHE_MQTT_TOPIC_MAX);
+    msg = malloc(msg_sz);
+    out = malloc(out_sz);
+    pkt = malloc(pkt_sz);
+    ret_times = malloc(sizeof *ret_times * num_msgs);
+    pub_times = malloc(sizeof *pub_times * num_msgs);
+    if (!msg || !out || !pkt || !ret_times || !pub_times)
+        return 1;
+    memcpy(msg, cli_id, MQTTZ_CLI_ID_SIZE);
+    memset(msg + MQTTZ_CLI_ID_SIZE, '1', AES_IV_SIZE);
+    memset(msg + MQTTZ_CLI_ID_SIZE + AES_IV_SIZE, 'h', 256);
+
+    prepare_tee_session(ctx);
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_NONE);
+    op.params[0].value.a = port;
+    op.params[0].value.b = 60;
+    op.params[1].tmpref.buffer = (void *) broker;
+    op.params[1].tmpref.size = strlen(broker);
+    op.params[2].tmpref.buffer = (void *) mqtt_id;
+    op.params[2].tmpref.size = strlen(mqtt_id);
+    if (TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_MQTT_CONNECT, &op,
+                &ori) != TEEC_SUCCESS)
+        errx(1, "Failed to connect to the broker %s:%i", broker, port);
+    fd = host_mqtt_connect(broker, port, host_mqtt_id, 60);
+    if (fd < 0)
+        errx(1, "Failed to connect the host to the broker %s:%i", broker,
+                port);
+
+    for (i = 0; i < num_msgs; i++)
+    {
+        memset(&op, 0, sizeof op);
+        op.paramTypes = TEEC_PARAM_TYPES(
+                TEEC_MEMREF_TEMP_INPUT,
+                TEEC_MEMREF_TEMP_INOUT,
+                TEEC_MEMREF_TEMP_INOUT,
+                TEEC_VALUE_INPUT);
+        op.params[0].tmpref.buffer = msg;
+        op.params[0].tmpref.size = msg_sz;
+        memcpy(out, cli_id, MQTTZ_CLI_ID_SIZE);
+        op.params[1].tmpref.buffer = out;
+        op.params[1].tmpref.size = out_sz;
+        op.params[2].tmpref.buffer = ta_times;
+        op.params[2].tmpref.size = sizeof ta_times;
+        op.params[3].value.a = KEY_IN_MEM;
+        gettimeofday(&t_ini, NULL);
+        if (TEEC_InvokeCommand(&ctx->sess, TA_REENCRYPT, &op, &ori)
+                != TEEC_SUCCESS)
+            errx(1, "Re-encryption failed");
+        // TA_REENCRYPT returns ID, IV and ciphertext, msg_sz bytes here
+        if (host_mqtt_publish(fd, pkt, pkt_sz, topic, out, msg_sz))
+            errx(1, "Host publish failed after %i messages", i);
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        ret_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+
+        memset(&op, 0, sizeof op);
+        op.paramTypes = TEEC_PARAM_TYPES(
+                TEEC_MEMREF_TEMP_INPUT,
+                TEEC_MEMREF_TEMP_INPUT,
+                TEEC_MEMREF_TEMP_INPUT,
+                TEEC_VALUE_INPUT);
+        op.params[0].tmpref.buffer = msg;
+        op.params[0].tmpref.size = msg_sz;
+        op.params[1].tmpref.buffer = (void *) cli_id;
+        op.params[1].tmpref.size = MQTTZ_CLI_ID_SIZE;
+        op.params[2].tmpref.buffer = (void *) topic;
+        op.params[2].tmpref.size = strlen(topic);
+        op.params[3].value.a = KEY_IN_MEM;
+        gettimeofday(&t_ini, NULL);
+        if (TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_REENCRYPT_PUBLISH,
+                    &op, &ori) != TEEC_SUCCESS)
+            errx(1, "Publish failed after %i messages", i);
+        gettimeofday(&t_end, NULL);
+        timersub(&t_end, &t_ini, &t_aux);
+        pub_times[i] = t_aux.tv_sec * 1000.0 + t_aux.tv_usec / 1000.0;
+    }
+
+    // The broker answers the ping once it has read every publish before it
+    memset(&op, 0, sizeof op);
+    op.paramTypes = TEEC_PARAM_TYPES(TEEC_NONE, TEEC_NONE, TEEC_NONE,
+            TEEC_NONE);
+    if (TEEC_InvokeCommand(&ctx->sess, TA_HOT_CACHE_CMD_MQTT_PING, &op, &ori)
+            != TEEC_SUCCESS)
+        errx(1, "Broker did not answer the ping");
+    if (host_mqtt_ping(fd))
+        errx(1, "Broker did not answer the host ping");
+    close(fd);
+    terminate_tee_session(ctx);
+
+    printf("MQT-TZ: %i messages published on %s (ms)\n", num_msgs, topic);
+    printf("Re-encrypt + host publish: %f %f\n", avg(ret_times, num_msgs),
+            stdev(ret_times, num_msgs));
+    printf("Re-encrypt + TA publish:   %f %f\n", avg(pub_times, num_msgs),
+            stdev(pub_times, num_msgs));
+    free(msg);
+    free(out);
+    free(pkt);
+    free(ret_times);
+    free(pub_times);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     printf("Starting!!\n");
@@ -604,6 +1186,20 @@ int main(int argc, char *argv[])
     // Dummy TEE Context to check if all files are OK
 	//prepare_tee_session(&ctx);
 
+    // ./optee_hot_cache provision <num_keys>
+    if (argc == 3 && !strcmp(argv[1], "provision"))
+        return key_provisioning_benchmark(&ctx, atoi(argv[2]));
+    // ./optee_hot_cache rotate <num_keys>
+    if (argc == 3 && !strcmp(argv[1], "rotate"))
+        return key_rotation_benchmark(&ctx, atoi(argv[2]));
+    // ./optee_hot_cache prefetch <num_keys>
+    if (argc == 3 && !strcmp(argv[1], "prefetch"))
+        return prefetch_benchmark(&ctx, atoi(argv[2]));
+    // ./optee_hot_cache publish <broker_ip> <port> <topic> <num_msgs>
+    if (argc == 6 && !strcmp(argv[1], "publish"))
+        return publish_benchmark(&ctx, argv[2], atoi(argv[3]), argv[4],
+                atoi(argv[5]));
+
     parse_arguments(argc, argv, origin, dest);
     if (times->benchmark)
     {
@@ -636,5 +1232,9 @@ int main(int argc, char *argv[])
 
 //./optee_hot_cache 123123123123 1111111111111111 holaholaholahoholahola 123123123123
 //./optee_hot_cache 123123123123 111111111111
+//./optee_hot_cache provision 1000
+//./optee_hot_cache rotate 1000
+//./optee_hot_cache prefetch 32
+//./optee_hot_cache publish 127.0.0.1 1883 mqttz/bench 1000
 //./optee_save_key 123123123123 0 11111111111111111111111111111111
 //./optee_read_key 123123123123
@@ -32,9 +32,16 @@
 
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
+#include <tee_isocket.h>
+#include <tee_tcpsocket.h>
 #include <utee_defines.h>
 
 #include <hot_cache_ta.h>
+#include <mqtt.h>
+#include <rand_pool.h>
+#ifdef CFG_HOT_CACHE_KV_STORE
+#include <kv_store.h>
+#endif
 
 #define AES128_KEY_BIT_SIZE		128
 #define AES128_KEY_BYTE_SIZE		(AES128_KEY_BIT_SIZE / 8)
@@ -48,6 +55,7 @@ typedef struct aes_cipher {
     uint32_t key_size;
     TEE_OperationHandle op_handle;
     TEE_ObjectHandle key_handle;
+    TEE_iSocketHandle mqtt_ctx; // Broker connection, NULL when closed
 } aes_cipher;
 
 static TEE_Result alloc_resources(void *session, uint32_t mode)
@@ -241,31 +249,973 @@ static TEE_Result cipher_buffer(void *sess, char *enc_data,
             dec_data, dec_data_size);
 }
 
-static int save_key(char *cli_id, char *cli_key)
+#ifndef CFG_HOT_CACHE_KV_STORE
+/*
+ * Versioned client keys
+ *
+ * A key rotation never overwrites the object a reader may have open.
+ * Every version lives in its own immutable object "<cli_id>.<version>",
+ * written under a temporary name and published with
+ * TEE_RenamePersistentObject(), so readers either see the complete new
+ * version or keep the previous one. Version 0 is the plain "<cli_id>"
+ * object written before versioning existed.
+ *
+ * The current version of each client is cached in key_versions. On a miss
+ * it is recovered from the "<cli_id>.head" hint object and by probing for
+ * newer versions, which also covers a crash between publishing a version
+ * and updating the hint. A re-encryption resolves the version once and
+ * keeps using it. Superseded versions are deleted by key_gc_step() a few
+ * at a time from TA_HOT_CACHE_CMD_ROTATE_KEYS and TA_HOT_CACHE_CMD_IDLE,
+ * never from the re-encryption path.
+ */
+#define KEY_VER_ID_SZ           (TA_MQTTZ_CLI_ID_SZ + 10)
+#define KEY_VER_TABLE_SIZE      TABLE_SIZE
+#define KEY_GC_PER_CALL         4
+
+struct key_version {
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    uint32_t current;
+    uint32_t oldest;    /* oldest version that may still be in storage */
+};
+
+struct key_head {
+    uint32_t current;
+    uint32_t oldest;
+};
+
+static struct key_version key_versions[KEY_VER_TABLE_SIZE];
+static uint32_t key_versions_count;
+
+static void key_version_id(char *cli_id, uint32_t version, char *obj_id)
 {
-    uint32_t obj_data_flag;
-    TEE_Result res;
+    if (version)
+        snprintf(obj_id, KEY_VER_ID_SZ, "%s.%08x", cli_id, version);
+    else
+        snprintf(obj_id, KEY_VER_ID_SZ, "%s", cli_id);
+}
+
+static bool key_version_exists(char *cli_id, uint32_t version)
+{
+    char obj_id[KEY_VER_ID_SZ];
     TEE_ObjectHandle object;
-    obj_data_flag = TEE_DATA_FLAG_ACCESS_READ | TEE_DATA_FLAG_ACCESS_WRITE
-        | TEE_DATA_FLAG_ACCESS_WRITE_META | TEE_DATA_FLAG_OVERWRITE;
-    res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, cli_id,
-            strlen(cli_id), obj_data_flag, TEE_HANDLE_NULL, NULL, 0, &object);
+
+    key_version_id(cli_id, version, obj_id);
+    if (TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+                strlen(obj_id), TEE_DATA_FLAG_ACCESS_READ |
+                TEE_DATA_FLAG_SHARE_READ, &object) != TEE_SUCCESS)
+        return false;
+    TEE_CloseObject(object);
+    return true;
+}
+
+static void write_key_head(struct key_version *kv)
+{
+    char obj_id[KEY_VER_ID_SZ];
+    struct key_head head = { kv->current, kv->oldest };
+    TEE_ObjectHandle object;
+
+    /* Only a hint: a stale head is corrected by probing on the next load */
+    snprintf(obj_id, KEY_VER_ID_SZ, "%s.head", kv->cli_id);
+    if (TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+                strlen(obj_id), TEE_DATA_FLAG_ACCESS_WRITE |
+                TEE_DATA_FLAG_ACCESS_WRITE_META | TEE_DATA_FLAG_OVERWRITE,
+                TEE_HANDLE_NULL, &head, sizeof(head), &object)
+            == TEE_SUCCESS)
+        TEE_CloseObject(object);
+}
+
+static struct key_version *lookup_key_version(char *cli_id)
+{
+    char obj_id[KEY_VER_ID_SZ];
+    struct key_version *kv;
+    struct key_head head = { 0, 0 };
+    TEE_ObjectHandle object;
+    uint32_t read_bytes;
+    uint32_t i;
+
+    for (i = 0; i < key_versions_count; i++)
+        if (!strcmp(key_versions[i].cli_id, cli_id))
+            return &key_versions[i];
+    if (key_versions_count == KEY_VER_TABLE_SIZE)
+    {
+        /* Recycle an entry that has nothing left to collect */
+        for (i = 0; i < KEY_VER_TABLE_SIZE; i++)
+            if (key_versions[i].oldest == key_versions[i].current)
+                break;
+        /*
+         * Otherwise any entry will do, the head hint keeps enough state to
+         * resume its clean-up once the client is looked up again.
+         */
+        if (i == KEY_VER_TABLE_SIZE)
+            i = 0;
+        kv = &key_versions[i];
+    }
+    else
+    {
+        kv = &key_versions[key_versions_count++];
+    }
+
+    snprintf(obj_id, KEY_VER_ID_SZ, "%s.head", cli_id);
+    if (TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id, strlen(obj_id),
+                TEE_DATA_FLAG_ACCESS_READ, &object) == TEE_SUCCESS)
+    {
+        if (TEE_ReadObjectData(object, &head, sizeof(head), &read_bytes)
+                != TEE_SUCCESS || read_bytes != sizeof(head))
+            head.current = head.oldest = 0;
+        TEE_CloseObject(object);
+    }
+    while (key_version_exists(cli_id, head.current + 1))
+        head.current++;
+    strncpy(kv->cli_id, cli_id, TA_MQTTZ_CLI_ID_SZ);
+    kv->cli_id[TA_MQTTZ_CLI_ID_SZ] = '\0';
+    kv->current = head.current;
+    kv->oldest = head.oldest;
+    return kv;
+}
+
+static TEE_Result publish_key_version(char *cli_id, char *cli_key)
+{
+    char obj_id[KEY_VER_ID_SZ];
+    struct key_version *kv;
+    TEE_ObjectHandle object;
+    TEE_Result res;
+
+    kv = lookup_key_version(cli_id);
+    snprintf(obj_id, KEY_VER_ID_SZ, "%s.tmp", cli_id);
+    res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+            strlen(obj_id), TEE_DATA_FLAG_ACCESS_WRITE |
+            TEE_DATA_FLAG_ACCESS_WRITE_META | TEE_DATA_FLAG_OVERWRITE,
+            TEE_HANDLE_NULL, NULL, 0, &object);
     if (res != TEE_SUCCESS)
-        return 1;
+        return res;
     res = TEE_WriteObjectData(object, cli_key, strlen(cli_key));
     if (res != TEE_SUCCESS)
     {
         TEE_CloseAndDeletePersistentObject1(object);
-        return 1;
+        return res;
+    }
+    /* The version becomes visible to readers only once complete */
+    key_version_id(cli_id, kv->current + 1, obj_id);
+    res = TEE_RenamePersistentObject(object, obj_id, strlen(obj_id));
+    if (res != TEE_SUCCESS)
+    {
+        EMSG("Failed to publish key version, res=0x%08x", res);
+        TEE_CloseAndDeletePersistentObject1(object);
+        return res;
     }
     TEE_CloseObject(object);
+    kv->current++;
+    write_key_head(kv);
+    return TEE_SUCCESS;
+}
+
+/*
+ * Probe up to KEY_GC_PER_CALL superseded key versions and delete the ones
+ * still in storage. Every probe counts against the budget, present or not,
+ * so a client with a long run of already deleted versions cannot stretch
+ * a step. The head of each client that moved is persisted, so that the
+ * next load does not probe the same versions again.
+ */
+static uint32_t key_gc_step(void)
+{
+    char obj_id[KEY_VER_ID_SZ];
+    TEE_ObjectHandle object;
+    TEE_Result res;
+    uint32_t budget = KEY_GC_PER_CALL;
+    uint32_t deleted = 0;
+    uint32_t oldest;
+    uint32_t i;
+
+    for (i = 0; i < key_versions_count && budget; i++)
+    {
+        struct key_version *kv = &key_versions[i];
+
+        oldest = kv->oldest;
+        while (kv->oldest < kv->current && budget)
+        {
+            key_version_id(kv->cli_id, kv->oldest, obj_id);
+            res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+                    strlen(obj_id), TEE_DATA_FLAG_ACCESS_WRITE_META,
+                    &object);
+            budget--;
+            if (res == TEE_ERROR_ACCESS_CONFLICT)
+                break;  /* still being read, retry on a later call */
+            if (res == TEE_SUCCESS)
+            {
+                TEE_CloseAndDeletePersistentObject1(object);
+                deleted++;
+            }
+            kv->oldest++;
+        }
+        if (kv->oldest != oldest)
+            write_key_head(kv);
+    }
+    return deleted;
+}
+
+/*
+ * Delete every stored version of a client key and its head
+ */
+static TEE_Result delete_key_versions(char *cli_id)
+{
+    char obj_id[KEY_VER_ID_SZ];
+    struct key_version *kv;
+    TEE_ObjectHandle object;
+    TEE_Result res;
+
+    kv = lookup_key_version(cli_id);
+    for (; kv->oldest <= kv->current; kv->oldest++)
+    {
+        key_version_id(cli_id, kv->oldest, obj_id);
+        res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id,
+                strlen(obj_id), TEE_DATA_FLAG_ACCESS_WRITE_META, &object);
+        if (res == TEE_ERROR_ITEM_NOT_FOUND)
+            continue;
+        if (res != TEE_SUCCESS)
+        {
+            write_key_head(kv);
+            return res;
+        }
+        TEE_CloseAndDeletePersistentObject1(object);
+    }
+    snprintf(obj_id, KEY_VER_ID_SZ, "%s.head", cli_id);
+    if (TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, obj_id, strlen(obj_id),
+                TEE_DATA_FLAG_ACCESS_WRITE_META, &object) == TEE_SUCCESS)
+        TEE_CloseAndDeletePersistentObject1(object);
+    *kv = key_versions[--key_versions_count];
+    return TEE_SUCCESS;
+}
+#endif
+
+/*
+ * In-memory key cache
+ *
+ * Keys read from secure storage are kept in a small LRU table so that a
+ * client sending several messages pays the storage read once. Entries are
+ * filled on demand by get_key() or ahead of time by
+ * TA_HOT_CACHE_CMD_PREFETCH, and refreshed whenever a key is saved.
+ */
+struct key_cache_entry {
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    uint32_t last_used;
+};
+
+static struct key_cache_entry key_cache[TA_HOT_CACHE_KEY_CACHE_SZ];
+static uint32_t key_cache_count;
+static uint32_t key_cache_clock;
+
+static struct key_cache_entry *key_cache_find(char *cli_id)
+{
+    uint32_t i;
+
+    for (i = 0; i < key_cache_count; i++)
+        if (!strcmp(key_cache[i].cli_id, cli_id))
+            return &key_cache[i];
+    return NULL;
+}
+
+static int key_cache_lookup(char *cli_id, char *cli_key)
+{
+    struct key_cache_entry *e = key_cache_find(cli_id);
+
+    if (!e)
+        return 0;
+    e->last_used = ++key_cache_clock;
+    memcpy(cli_key, e->cli_key, TA_AES_KEY_SIZE + 1);
+    return 1;
+}
+
+static void key_cache_insert(char *cli_id, char *cli_key)
+{
+    struct key_cache_entry *e = key_cache_find(cli_id);
+    uint32_t i;
+
+    if (!e)
+    {
+        if (key_cache_count < TA_HOT_CACHE_KEY_CACHE_SZ)
+        {
+            e = &key_cache[key_cache_count++];
+        }
+        else
+        {
+            e = &key_cache[0];
+            for (i = 1; i < key_cache_count; i++)
+                if (key_cache[i].last_used < e->last_used)
+                    e = &key_cache[i];
+        }
+        memcpy(e->cli_id, cli_id, TA_MQTTZ_CLI_ID_SZ + 1);
+    }
+    memcpy(e->cli_key, cli_key, TA_AES_KEY_SIZE);
+    e->cli_key[TA_AES_KEY_SIZE] = '\0';
+    e->last_used = ++key_cache_clock;
+}
+
+static void key_cache_drop(char *cli_id)
+{
+    struct key_cache_entry *e = key_cache_find(cli_id);
+
+    if (e)
+        *e = key_cache[--key_cache_count];
+}
+
+static int save_key(char *cli_id, char *cli_key)
+{
+#ifdef CFG_HOT_CACHE_KV_STORE
+    /* Appending a record already leaves the previous value untouched */
+    if (kv_put(cli_id, strlen(cli_id), cli_key, strlen(cli_key))
+            != TEE_SUCCESS)
+        return 1;
+#else
+    if (publish_key_version(cli_id, cli_key) != TEE_SUCCESS)
+        return 1;
+#endif
+    if (key_cache_find(cli_id))
+        key_cache_insert(cli_id, cli_key);
     printf("Saved key with id: %s!\n", cli_id);
     return 0;
 }
 
+static TEE_Result load_key(char *cli_id, char *cli_key, size_t key_sz)
+{
+#ifdef CFG_HOT_CACHE_KV_STORE
+    uint32_t len = key_sz;
+
+    return kv_get(cli_id, strlen(cli_id), cli_key, &len);
+#else
+    char obj_id[KEY_VER_ID_SZ];
+    struct key_version *kv;
+
+    kv = lookup_key_version(cli_id);
+    key_version_id(cli_id, kv->current, obj_id);
+    return read_raw_object(obj_id, strlen(obj_id), cli_key, key_sz);
+#endif
+}
+
+/*
+ * Write-behind key buffer and key log
+ *
+ * Key updates received through TA_HOT_CACHE_CMD_PUT_KEY are kept in memory
+ * and written to secure storage in batches, so that a burst of key
+ * rotations does not pay one persistent object write per key on the
+ * request path. Repeated updates of the same client collapse into a single
+ * entry.
+ *
+ * A flush appends the whole batch to a single log object with one
+ * TEE_WriteObjectData() call and writes nothing else: the log is the
+ * durable copy of those keys. An in-memory index of the log, rebuilt by
+ * replay_key_log() when the TA is loaded, serves them to get_key() after
+ * the buffer and before the per-client objects. key_log_compact() applies
+ * the log to the per-client objects and truncates it, on
+ * TA_HOT_CACHE_CMD_IDLE or when the index cannot take the next batch. A key
+ * written synchronously while the log holds an older value of it is logged
+ * as well, so the log never brings an older value back.
+ *
+ * There are no timers in a TA, so the age threshold of the buffer is only
+ * checked by TA_HOT_CACHE_CMD_PUT_KEY and TA_HOT_CACHE_CMD_IDLE. The
+ * re-encryption path never flushes.
+ */
+#define KEY_BUF_ENTRIES         32
+#define KEY_BUF_MAX_AGE_MS      500
+#define KEY_LOG_INDEX_SZ        256
+#define KEY_LOG_ID              "mqttz.keylog"
+#define KEY_LOG_MAGIC           0x4d51544b  /* "MQTK" */
+
+struct key_buf_entry {
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+};
+
+struct key_log_header {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t checksum;
+};
+
+static struct key_buf_entry key_buf[KEY_BUF_ENTRIES];
+static uint32_t key_buf_count;
+static TEE_Time key_buf_oldest;
+
+/* Latest value of every key in the log */
+static struct key_buf_entry key_log_index[KEY_LOG_INDEX_SZ];
+static uint32_t key_log_count;
+
+static uint32_t key_log_checksum(struct key_buf_entry *entries, uint32_t count)
+{
+    uint8_t *p = (uint8_t *) entries;
+    uint32_t sum = KEY_LOG_MAGIC;
+    size_t i;
+
+    for (i = 0; i < count * sizeof(*entries); i++)
+        sum = (sum << 5) + sum + p[i];
+    return sum;
+}
+
+static int key_buf_lookup(char *cli_id, char *cli_key)
+{
+    uint32_t i;
+
+    for (i = 0; i < key_buf_count; i++)
+    {
+        if (!strcmp(key_buf[i].cli_id, cli_id))
+        {
+            memcpy(cli_key, key_buf[i].cli_key, TA_AES_KEY_SIZE + 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void key_buf_drop(char *cli_id)
+{
+    uint32_t i;
+
+    for (i = 0; i < key_buf_count; i++)
+    {
+        if (!strcmp(key_buf[i].cli_id, cli_id))
+        {
+            key_buf[i] = key_buf[--key_buf_count];
+            return;
+        }
+    }
+}
+
+static struct key_buf_entry *key_log_find(char *cli_id)
+{
+    uint32_t i;
+
+    for (i = 0; i < key_log_count; i++)
+        if (!strcmp(key_log_index[i].cli_id, cli_id))
+            return &key_log_index[i];
+    return NULL;
+}
+
+static int key_log_lookup(char *cli_id, char *cli_key)
+{
+    struct key_buf_entry *e = key_log_find(cli_id);
+
+    if (!e)
+        return 0;
+    memcpy(cli_key, e->cli_key, TA_AES_KEY_SIZE + 1);
+    return 1;
+}
+
+/*
+ * Record a logged key in the index, returns 1 if the index is full
+ */
+static int key_log_index_add(struct key_buf_entry *entry)
+{
+    struct key_buf_entry *e = key_log_find(entry->cli_id);
+
+    if (!e)
+    {
+        if (key_log_count == KEY_LOG_INDEX_SZ)
+            return 1;
+        e = &key_log_index[key_log_count++];
+    }
+    *e = *entry;
+    return 0;
+}
+
+static TEE_Result append_key_log(struct key_buf_entry *entries, uint32_t count)
+{
+    struct key_log_header hdr;
+    TEE_ObjectHandle object;
+    TEE_Result res;
+    uint32_t flags = TEE_DATA_FLAG_ACCESS_READ | TEE_DATA_FLAG_ACCESS_WRITE;
+    size_t rec_sz = sizeof(hdr) + count * sizeof(*entries);
+    char *rec;
+
+    res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, KEY_LOG_ID,
+            strlen(KEY_LOG_ID), flags, &object);
+    if (res == TEE_ERROR_ITEM_NOT_FOUND)
+        res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, KEY_LOG_ID,
+                strlen(KEY_LOG_ID), flags, TEE_HANDLE_NULL, NULL, 0, &object);
+    if (res != TEE_SUCCESS)
+    {
+        EMSG("Failed to open key log, res=0x%08x", res);
+        return res;
+    }
+    rec = TEE_Malloc(rec_sz, 0);
+    if (!rec)
+    {
+        res = TEE_ERROR_OUT_OF_MEMORY;
+        goto exit;
+    }
+    hdr.magic = KEY_LOG_MAGIC;
+    hdr.count = count;
+    hdr.checksum = key_log_checksum(entries, count);
+    TEE_MemMove(rec, &hdr, sizeof(hdr));
+    TEE_MemMove(rec + sizeof(hdr), entries, count * sizeof(*entries));
+    res = TEE_SeekObjectData(object, 0, TEE_DATA_SEEK_END);
+    if (res == TEE_SUCCESS)
+        /* One write per batch: the storage layer commits it atomically */
+        res = TEE_WriteObjectData(object, rec, rec_sz);
+    if (res != TEE_SUCCESS)
+        EMSG("Failed to append to key log, res=0x%08x", res);
+    TEE_Free(rec);
+exit:
+    TEE_CloseObject(object);
+    return res;
+}
+
+static TEE_Result truncate_key_log(void)
+{
+    TEE_ObjectHandle object;
+    TEE_Result res;
+
+    res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, KEY_LOG_ID,
+            strlen(KEY_LOG_ID), TEE_DATA_FLAG_ACCESS_WRITE, &object);
+    if (res == TEE_ERROR_ITEM_NOT_FOUND)
+        return TEE_SUCCESS;
+    if (res != TEE_SUCCESS)
+        return res;
+    res = TEE_TruncateObjectData(object, 0);
+    TEE_CloseObject(object);
+    return res;
+}
+
+/*
+ * Apply the logged keys to the per-client objects and empty the log. On a
+ * failure the whole log is kept and applied again on the next compaction.
+ */
+static TEE_Result key_log_compact(uint32_t *applied)
+{
+    TEE_Result res;
+    uint32_t i;
+
+    if (applied)
+        *applied = 0;
+    for (i = 0; i < key_log_count; i++)
+    {
+        if (save_key(key_log_index[i].cli_id, key_log_index[i].cli_key))
+            return TEE_ERROR_STORAGE_NOT_AVAILABLE;
+    }
+    res = truncate_key_log();
+    if (res != TEE_SUCCESS)
+        return res;
+    if (applied)
+        *applied = key_log_count;
+    key_log_count = 0;
+    return TEE_SUCCESS;
+}
+
+static TEE_Result flush_key_buf(uint32_t *flushed)
+{
+    TEE_Result res;
+    uint32_t new_keys = 0;
+    uint32_t i;
+
+    if (flushed)
+        *flushed = 0;
+    if (!key_buf_count)
+        return TEE_SUCCESS;
+    /* The log only holds keys its index has room for */
+    for (i = 0; i < key_buf_count; i++)
+        if (!key_log_find(key_buf[i].cli_id))
+            new_keys++;
+    if (key_log_count + new_keys > KEY_LOG_INDEX_SZ)
+    {
+        res = key_log_compact(NULL);
+        if (res != TEE_SUCCESS)
+            return res;
+    }
+    res = append_key_log(key_buf, key_buf_count);
+    if (res != TEE_SUCCESS)
+        return res;
+    for (i = 0; i < key_buf_count; i++)
+        key_log_index_add(&key_buf[i]);
+    printf("MQTTZ: Flushed %u buffered keys\n", key_buf_count);
+    if (flushed)
+        *flushed = key_buf_count;
+    key_buf_count = 0;
+    return TEE_SUCCESS;
+}
+
+/*
+ * Rebuild the index of the key log
+ */
+static TEE_Result replay_key_log(void)
+{
+    struct key_log_header hdr;
+    struct key_buf_entry *entries;
+    TEE_ObjectHandle object;
+    TEE_Result res;
+    uint32_t read_bytes;
+    uint32_t i;
+    uint32_t replayed = 0;
+    bool overflow = false;
+
+    res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, KEY_LOG_ID,
+            strlen(KEY_LOG_ID), TEE_DATA_FLAG_ACCESS_READ, &object);
+    if (res == TEE_ERROR_ITEM_NOT_FOUND)
+        return TEE_SUCCESS;
+    if (res != TEE_SUCCESS)
+        return res;
+    entries = TEE_Malloc(KEY_BUF_ENTRIES * sizeof(*entries), 0);
+    if (!entries)
+    {
+        TEE_CloseObject(object);
+        return TEE_ERROR_OUT_OF_MEMORY;
+    }
+    key_log_count = 0;
+    for (;;)
+    {
+        res = TEE_ReadObjectData(object, &hdr, sizeof(hdr), &read_bytes);
+        if (res != TEE_SUCCESS || read_bytes != sizeof(hdr) ||
+                hdr.magic != KEY_LOG_MAGIC || hdr.count > KEY_BUF_ENTRIES)
+            break;
+        res = TEE_ReadObjectData(object, entries,
+                hdr.count * sizeof(*entries), &read_bytes);
+        /* A torn or corrupted batch ends the replay */
+        if (res != TEE_SUCCESS || read_bytes != hdr.count * sizeof(*entries)
+                || key_log_checksum(entries, hdr.count) != hdr.checksum)
+            break;
+        /*
+         * Only a log written with a larger index overflows, its extra keys
+         * go straight to their objects
+         */
+        for (i = 0; i < hdr.count; i++)
+        {
+            if (key_log_index_add(&entries[i]))
+            {
+                save_key(entries[i].cli_id, entries[i].cli_key);
+                overflow = true;
+            }
+        }
+        replayed += hdr.count;
+    }
+    TEE_Free(entries);
+    TEE_CloseObject(object);
+    if (replayed)
+        printf("MQTTZ: Replayed %u keys from the key log\n", replayed);
+    if (overflow)
+        return key_log_compact(NULL);
+    return TEE_SUCCESS;
+}
+
+static TEE_Result key_buf_maybe_flush(void)
+{
+    TEE_Time now;
+    TEE_Time age;
+
+    if (!key_buf_count)
+        return TEE_SUCCESS;
+    TEE_GetSystemTime(&now);
+    TEE_TIME_SUB(now, key_buf_oldest, age);
+    if (key_buf_count < KEY_BUF_ENTRIES &&
+            age.seconds * 1000 + age.millis < KEY_BUF_MAX_AGE_MS)
+        return TEE_SUCCESS;
+    return flush_key_buf(NULL);
+}
+
+static TEE_Result key_buf_put(char *cli_id, char *cli_key)
+{
+    TEE_Result res;
+    uint32_t i;
+
+    for (i = 0; i < key_buf_count; i++)
+    {
+        if (!strcmp(key_buf[i].cli_id, cli_id))
+        {
+            memcpy(key_buf[i].cli_key, cli_key, TA_AES_KEY_SIZE + 1);
+            return TEE_SUCCESS;
+        }
+    }
+    if (key_buf_count == KEY_BUF_ENTRIES)
+    {
+        res = flush_key_buf(NULL);
+        if (res != TEE_SUCCESS)
+            return res;
+    }
+    if (!key_buf_count)
+        TEE_GetSystemTime(&key_buf_oldest);
+    memcpy(key_buf[key_buf_count].cli_id, cli_id, TA_MQTTZ_CLI_ID_SZ + 1);
+    memcpy(key_buf[key_buf_count].cli_key, cli_key, TA_AES_KEY_SIZE + 1);
+    key_buf_count++;
+    return TEE_SUCCESS;
+}
+
+/*
+ * Write a key through to secure storage. A key the log holds is logged
+ * again instead, which is as durable and keeps the log from shadowing the
+ * new value with its older one.
+ */
+static TEE_Result store_key_sync(char *cli_id, char *cli_key)
+{
+    struct key_buf_entry entry;
+    TEE_Result res;
+
+    /* Do not let a pending older value shadow the one written here */
+    key_buf_drop(cli_id);
+    if (!key_log_find(cli_id))
+        return save_key(cli_id, cli_key) ? TEE_ERROR_STORAGE_NOT_AVAILABLE :
+            TEE_SUCCESS;
+    memcpy(entry.cli_id, cli_id, TA_MQTTZ_CLI_ID_SZ + 1);
+    memcpy(entry.cli_key, cli_key, TA_AES_KEY_SIZE + 1);
+    res = append_key_log(&entry, 1);
+    if (res == TEE_SUCCESS)
+        key_log_index_add(&entry);
+    return res;
+}
+
+/*
+ * Remove a client key from every place it may live. A logged key can only
+ * be dropped from the log by applying the log first.
+ */
+static TEE_Result delete_key(char *cli_id)
+{
+    TEE_Result res;
+
+    key_buf_drop(cli_id);
+    if (key_log_find(cli_id))
+    {
+        res = key_log_compact(NULL);
+        if (res != TEE_SUCCESS)
+            return res;
+    }
+    key_cache_drop(cli_id);
+#ifdef CFG_HOT_CACHE_KV_STORE
+    return kv_delete(cli_id, strlen(cli_id));
+#else
+    return delete_key_versions(cli_id);
+#endif
+}
+
+/*
+ * Copy the client id and key out of the parameters of the key commands
+ * into NUL terminated strings.
+ */
+static TEE_Result get_key_params(uint32_t param_types, TEE_Param params[4],
+        char *cli_id, char *cli_key)
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[0].memref.size != TA_MQTTZ_CLI_ID_SZ ||
+            params[1].memref.size != TA_AES_KEY_SIZE)
+        return TEE_ERROR_BAD_PARAMETERS;
+    TEE_MemMove(cli_id, params[0].memref.buffer, TA_MQTTZ_CLI_ID_SZ);
+    cli_id[TA_MQTTZ_CLI_ID_SZ] = '\0';
+    TEE_MemMove(cli_key, params[1].memref.buffer, TA_AES_KEY_SIZE);
+    cli_key[TA_AES_KEY_SIZE] = '\0';
+    return TEE_SUCCESS;
+}
+
+/*
+ * Process command TA_SECURE_STORAGE_CMD_WRITE_RAW. API in hot_cache_ta.h
+ *
+ * Synchronous write-through of a client key, the baseline for PUT_KEY.
+ */
+static TEE_Result write_key(uint32_t param_types, TEE_Param params[4])
+{
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    TEE_Result res;
+
+    res = get_key_params(param_types, params, cli_id, cli_key);
+    if (res != TEE_SUCCESS)
+        return res;
+    return store_key_sync(cli_id, cli_key);
+}
+
+/*
+ * Process command TA_SECURE_STORAGE_CMD_DELETE. API in hot_cache_ta.h
+ */
+static TEE_Result delete_key_cmd(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[0].memref.size != TA_MQTTZ_CLI_ID_SZ)
+        return TEE_ERROR_BAD_PARAMETERS;
+    TEE_MemMove(cli_id, params[0].memref.buffer, TA_MQTTZ_CLI_ID_SZ);
+    cli_id[TA_MQTTZ_CLI_ID_SZ] = '\0';
+    return delete_key(cli_id);
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_PUT_KEY. API in hot_cache_ta.h
+ */
+static TEE_Result put_key(uint32_t param_types, TEE_Param params[4])
+{
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    TEE_Result res;
+
+    res = get_key_params(param_types, params, cli_id, cli_key);
+    if (res != TEE_SUCCESS)
+        return res;
+    res = key_buf_put(cli_id, cli_key);
+    if (res != TEE_SUCCESS)
+        return res;
+    return key_buf_maybe_flush();
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_FLUSH. API in hot_cache_ta.h
+ */
+static TEE_Result flush_keys(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    return flush_key_buf(&params[0].value.a);
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_IDLE. API in hot_cache_ta.h
+ *
+ * Storage work kept off the re-encryption path, for the host to run when
+ * the broker is quiet.
+ */
+static TEE_Result idle_work(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    TEE_Result res;
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    params[0].value.a = 0;
+    params[0].value.b = 0;
+    res = key_buf_maybe_flush();
+    if (res != TEE_SUCCESS)
+        return res;
+#ifndef CFG_HOT_CACHE_KV_STORE
+    params[0].value.b = key_gc_step();
+#endif
+    return key_log_compact(&params[0].value.a);
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_ROTATE_KEYS. API in hot_cache_ta.h
+ *
+ * Work per invocation is bounded so that re-encryptions queued behind a
+ * large rotation are served between the calls.
+ */
+static TEE_Result rotate_keys(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    const size_t entry_sz = TA_MQTTZ_CLI_ID_SZ + TA_AES_KEY_SIZE;
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    char *entry;
+    uint32_t num_entries;
+    uint32_t i;
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[0].memref.size % entry_sz)
+        return TEE_ERROR_BAD_PARAMETERS;
+    num_entries = params[0].memref.size / entry_sz;
+    if (num_entries > TA_HOT_CACHE_ROTATE_MAX)
+        num_entries = TA_HOT_CACHE_ROTATE_MAX;
+    for (i = 0; i < num_entries; i++)
+    {
+        entry = (char *) params[0].memref.buffer + i * entry_sz;
+        TEE_MemMove(cli_id, entry, TA_MQTTZ_CLI_ID_SZ);
+        cli_id[TA_MQTTZ_CLI_ID_SZ] = '\0';
+        TEE_MemMove(cli_key, entry + TA_MQTTZ_CLI_ID_SZ, TA_AES_KEY_SIZE);
+        cli_key[TA_AES_KEY_SIZE] = '\0';
+        if (store_key_sync(cli_id, cli_key) != TEE_SUCCESS)
+            break;
+    }
+#ifndef CFG_HOT_CACHE_KV_STORE
+    key_gc_step();
+#endif
+    params[1].value.a = i;
+    return i == num_entries ? TEE_SUCCESS : TEE_ERROR_STORAGE_NOT_AVAILABLE;
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_COMPACT. API in hot_cache_ta.h
+ */
+static TEE_Result compact_keys(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+#ifdef CFG_HOT_CACHE_KV_STORE
+    struct kv_stats stats;
+    TEE_Result res;
+
+    kv_get_stats(&stats);
+    params[0].value.a = stats.total_bytes;
+    res = kv_compact();
+    kv_get_stats(&stats);
+    params[0].value.b = stats.total_bytes;
+    params[1].value.a = stats.num_keys;
+    params[1].value.b = stats.active_seg - stats.first_seg + 1;
+    return res;
+#else
+    return TEE_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+/*
+ * Process command TA_HOT_CACHE_CMD_PREFETCH. API in hot_cache_ta.h
+ */
+static TEE_Result prefetch_keys(uint32_t param_types, TEE_Param params[4])
+{
+    uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_VALUE_OUTPUT,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    char cli_id[TA_MQTTZ_CLI_ID_SZ + 1];
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    uint32_t num_ids;
+    uint32_t i;
+
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (params[0].memref.size % TA_MQTTZ_CLI_ID_SZ)
+        return TEE_ERROR_BAD_PARAMETERS;
+    num_ids = params[0].memref.size / TA_MQTTZ_CLI_ID_SZ;
+    params[1].value.a = 0;
+    params[1].value.b = 0;
+    for (i = 0; i < num_ids; i++)
+    {
+        TEE_MemMove(cli_id, (char *) params[0].memref.buffer +
+                i * TA_MQTTZ_CLI_ID_SZ, TA_MQTTZ_CLI_ID_SZ);
+        cli_id[TA_MQTTZ_CLI_ID_SZ] = '\0';
+        if (key_buf_lookup(cli_id, cli_key) ||
+                key_log_lookup(cli_id, cli_key) || key_cache_find(cli_id))
+        {
+            params[1].value.b++;
+            continue;
+        }
+        memset(cli_key, 0, sizeof(cli_key));
+        /* Unknown clients are skipped, get_key() handles them later */
+        if (load_key(cli_id, cli_key, sizeof(cli_key)) != TEE_SUCCESS)
+            continue;
+        key_cache_insert(cli_id, cli_key);
+        params[1].value.a++;
+    }
+    return TEE_SUCCESS;
+}
+
 static int get_key(char *cli_id, char *cli_key, int key_mode)
 {
-    // TODO Implement Cache Logic
     char fke_key[TA_AES_KEY_SIZE + 1] = "11111111111111111111111111111111";
     size_t read_bytes = TA_AES_KEY_SIZE + 1;
     char my_id[TA_MQTTZ_CLI_ID_SZ + 1];
@@ -290,9 +1240,15 @@ static int get_key(char *cli_id, char *cli_key, int key_mode)
     */// Until here
     if (key_mode == 0)
         goto keyinmem;
+    // Keys waiting in the write-behind buffer are newer than storage
+    if (key_buf_lookup(my_id, cli_key))
+        return 0;
+    if (key_log_lookup(my_id, cli_key))
+        return 0;
+    if (key_cache_lookup(my_id, cli_key))
+        return 0;
     //if ((read_raw_object(cli_id, strlen(cli_id), cli_key, read_bytes) 
-    if ((read_raw_object(my_id, strlen(my_id), cli_key, read_bytes) 
-            != TEE_SUCCESS))// || (read_bytes != TA_AES_KEY_SIZE))
+    if ((load_key(my_id, cli_key, read_bytes) != TEE_SUCCESS))// || (read_bytes != TA_AES_KEY_SIZE))
     {
         // FIXME We should not do this, using cache instead
         // FIXME We should run the TA as a service not to reload it every time
@@ -304,6 +1260,7 @@ static int get_key(char *cli_id, char *cli_key, int key_mode)
         //printf("Key not found in storage!\n");
         return 1;
     }
+    key_cache_insert(my_id, cli_key);
     return 0;
 keyinmem:
     strcpy(cli_key, fke_key);
@@ -491,10 +1448,8 @@ static TEE_Result payload_reencryption(void *session, uint32_t param_types,
         goto exit;
     }
     printf("MQTTZ: Set Destination Key in Session\n");
-    // Set random IV for encryption TODO
-    char fake_iv[TA_AES_IV_SIZE + 1] = "1111111111111111";
-    strcpy(dest_cli_iv, fake_iv);
-    printf("This is the initial IV: %s\n", dest_cli_iv);
+    // Fresh random IV for every message, taken from the TA random pool
+    rand_pool_get(dest_cli_iv, TA_AES_IV_SIZE);
     if (set_aes_iv(session, dest_cli_iv) != TEE_SUCCESS)
     {
         printf("MQTTZ-ERROR: set_aes_iv failed\n");
@@ -512,7 +1467,6 @@ static TEE_Result payload_reencryption(void *session, uint32_t param_types,
     }
     printf("MQTTZ: Finished encrypting!\n");
     //printf("MQTTZ: Encrypted Data: %s\n", dest_cli_data);
-    printf("MQTTZ: This is the final IV: %s\n", dest_cli_iv);
     TEE_GetSystemTime(&t2);
     TEE_TIME_SUB(t2, t1, t_aux);
     //sprintf(params[2].memref.buffer, "%s%i", params[2].memref.buffer, t_aux.seconds * 1000 + t_aux.millis);
@@ -522,7 +1476,9 @@ static TEE_Result payload_reencryption(void *session, uint32_t param_types,
     //printf("MQTTZ: Time: %i\n%s\n", t2.seconds * 1000 + t2.millis, tmp_buffer);
     //printf("MQTTZ: Time elapsed: %i\n", jeje.seconds * 1000 + jeje.millis); 
     // Rebuild the return value
-    strcpy((char *) params[1].memref.buffer + TA_MQTTZ_CLI_ID_SZ, dest_cli_iv);
+    // The IV is binary, copy it without touching the ciphertext that follows
+    TEE_MemMove((char *) params[1].memref.buffer + TA_MQTTZ_CLI_ID_SZ,
+            dest_cli_iv, TA_AES_IV_SIZE);
     //strcpy((char *) params[1].memref.buffer + TA_MQTTZ_CLI_ID_SZ 
     //        + TA_AES_IV_SIZE, dest_cli_data);
     //strcpy((char *) params[2].memref.buffer, tmp_buffer);
@@ -538,15 +1494,278 @@ exit:
     return res;
 }
 
+/*
+ * Secure publish path
+ *
+ * The session keeps a TCP connection to an MQTT broker. A message is
+ * re-encrypted straight into a PUBLISH packet and sent from the TA, so
+ * neither the plaintext nor the new ciphertext goes back to the host.
+ *
+ * The TA is single instance, so while a session waits on the broker every
+ * other session of the TA waits too. CONNECT and PINGREQ are setup calls
+ * and may wait MQTT_TIMEOUT_MS. A PUBLISH only gets MQTT_PUBLISH_TIMEOUT_MS
+ * to hand its packet to the socket; if that does not do, the connection is
+ * closed since a partial packet leaves the stream unusable, and the host
+ * has to connect again.
+ */
+#define MQTT_TIMEOUT_MS         5000
+#define MQTT_PUBLISH_TIMEOUT_MS 100
+
+static TEE_Result mqtt_send(aes_cipher *sess, const void *buf, uint32_t len,
+        uint32_t timeout)
+{
+    uint32_t sent = len;
+    TEE_Result res;
+
+    res = TEE_tcpSocket->send(sess->mqtt_ctx, buf, &sent, timeout);
+    if (res == TEE_SUCCESS && sent != len)
+        res = TEE_ERROR_COMMUNICATION;
+    return res;
+}
+
+static TEE_Result mqtt_recv(aes_cipher *sess, uint8_t *buf, uint32_t len)
+{
+    uint32_t got = 0;
+    uint32_t sz;
+    TEE_Result res;
+
+    while (got < len)
+    {
+        sz = len - got;
+        res = TEE_tcpSocket->recv(sess->mqtt_ctx, buf + got, &sz,
+                MQTT_TIMEOUT_MS);
+        if (res != TEE_SUCCESS)
+            return res;
+        if (!sz)
+            return TEE_ERROR_COMMUNICATION;
+        got += sz;
+    }
+    return TEE_SUCCESS;
+}
+
+static void mqtt_close(aes_cipher *sess)
+{
+    uint8_t pkt[2];
+
+    if (!sess->mqtt_ctx)
+        return;
+    /* Best effort, the broker drops the connection anyway */
+    if (mqtt_disconnect(pkt, sizeof(pkt)))
+        mqtt_send(sess, pkt, sizeof(pkt), MQTT_PUBLISH_TIMEOUT_MS);
+    TEE_tcpSocket->close(sess->mqtt_ctx);
+    sess->mqtt_ctx = NULL;
+}
+
+static TEE_Result mqtt_open(void *session, uint32_t param_types,
+        TEE_Param params[4])
+{
+    aes_cipher *sess = (aes_cipher *) session;
+    TEE_tcpSocket_Setup setup = { };
+    uint8_t pkt[MQTT_MAX_FIXED_HDR + 12 + TA_HOT_CACHE_MQTT_ID_MAX];
+    uint8_t connack[MQTT_CONNACK_SIZE];
+    uint32_t proto_err;
+    size_t len;
+    char *addr;
+    TEE_Result res;
+    uint32_t exp_param_types = TEE_PARAM_TYPES(
+            TEE_PARAM_TYPE_VALUE_INPUT,
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_NONE);
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (sess->mqtt_ctx)
+        return TEE_ERROR_BAD_STATE;
+    if (!params[2].memref.size ||
+            params[2].memref.size > TA_HOT_CACHE_MQTT_ID_MAX)
+        return TEE_ERROR_BAD_PARAMETERS;
+
+    addr = TEE_Malloc(params[1].memref.size + 1, TEE_MALLOC_FILL_ZERO);
+    if (!addr)
+        return TEE_ERROR_OUT_OF_MEMORY;
+    TEE_MemMove(addr, params[1].memref.buffer, params[1].memref.size);
+    setup.ipVersion = TEE_IP_VERSION_4;
+    setup.server_addr = addr;
+    setup.server_port = params[0].value.a;
+    res = TEE_tcpSocket->open(&sess->mqtt_ctx, &setup, &proto_err);
+    TEE_Free(addr);
+    if (res != TEE_SUCCESS)
+    {
+        EMSG("Failed to connect to the broker, res=0x%08x", res);
+        sess->mqtt_ctx = NULL;
+        return res;
+    }
+
+    len = mqtt_connect(pkt, sizeof(pkt), params[2].memref.buffer,
+            params[2].memref.size, params[0].value.b);
+    res = mqtt_send(sess, pkt, len, MQTT_TIMEOUT_MS);
+    if (res == TEE_SUCCESS)
+        res = mqtt_recv(sess, connack, sizeof(connack));
+    if (res == TEE_SUCCESS && !mqtt_connack_ok(connack, sizeof(connack)))
+    {
+        EMSG("Broker refused the connection, code %u", connack[3]);
+        res = TEE_ERROR_ACCESS_DENIED;
+    }
+    if (res != TEE_SUCCESS)
+    {
+        TEE_tcpSocket->close(sess->mqtt_ctx);
+        sess->mqtt_ctx = NULL;
+    }
+    return res;
+}
+
+static TEE_Result mqtt_ping(void *session, uint32_t param_types,
+        TEE_Param params[4])
+{
+    aes_cipher *sess = (aes_cipher *) session;
+    uint8_t pkt[MQTT_PINGRESP_SIZE];
+    TEE_Result res;
+    uint32_t exp_param_types = TEE_PARAM_TYPES(
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE,
+            TEE_PARAM_TYPE_NONE);
+    (void) params;
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (!sess->mqtt_ctx)
+        return TEE_ERROR_BAD_STATE;
+
+    res = mqtt_send(sess, pkt, mqtt_pingreq(pkt, sizeof(pkt)),
+            MQTT_TIMEOUT_MS);
+    if (res == TEE_SUCCESS)
+        res = mqtt_recv(sess, pkt, sizeof(pkt));
+    if (res == TEE_SUCCESS && !mqtt_pingresp_ok(pkt, sizeof(pkt)))
+        res = TEE_ERROR_COMMUNICATION;
+    return res;
+}
+
+/*
+ * Decrypt data_size bytes of msg (client ID, IV, ciphertext) with the key
+ * of its sender and encrypt them for dest_cli_id under a fresh IV, into iv
+ * and data. Uses the same key and mode sequence as payload_reencryption()
+ * so that subscribers handle both paths alike.
+ */
+static TEE_Result reencrypt_payload(void *session, char *msg,
+        size_t data_size, char *dest_cli_id, int key_mode, char *iv,
+        char *data)
+{
+    char cli_key[TA_AES_KEY_SIZE + 1];
+    char *dec_data;
+    size_t dec_data_size = data_size;
+    size_t enc_data_size = data_size;
+    TEE_Result res = TEE_ERROR_GENERIC;
+
+    dec_data = TEE_Malloc(data_size, 0);
+    if (!dec_data)
+        return TEE_ERROR_OUT_OF_MEMORY;
+
+    if (get_key(msg, cli_key, key_mode) != 0 ||
+            alloc_resources(session, TA_AES_MODE_ENCODE) != TEE_SUCCESS ||
+            set_aes_key(session, cli_key) != TEE_SUCCESS ||
+            set_aes_iv(session, msg + TA_MQTTZ_CLI_ID_SZ) != TEE_SUCCESS ||
+            cipher_buffer(session, msg + TA_MQTTZ_CLI_ID_SZ + TA_AES_IV_SIZE,
+                data_size, dec_data, &dec_data_size) != TEE_SUCCESS)
+        goto exit;
+
+    rand_pool_get(iv, TA_AES_IV_SIZE);
+    if (get_key(dest_cli_id, cli_key, key_mode) != 0 ||
+            alloc_resources(session, TA_AES_MODE_DECODE) != TEE_SUCCESS ||
+            set_aes_key(session, cli_key) != TEE_SUCCESS ||
+            set_aes_iv(session, iv) != TEE_SUCCESS ||
+            cipher_buffer(session, dec_data, dec_data_size, data,
+                &enc_data_size) != TEE_SUCCESS)
+        goto exit;
+    res = TEE_SUCCESS;
+exit:
+    TEE_MemFill(cli_key, 0, sizeof(cli_key));
+    TEE_MemFill(dec_data, 0, data_size);
+    TEE_Free(dec_data);
+    return res;
+}
+
+static TEE_Result reencrypt_publish(void *session, uint32_t param_types,
+        TEE_Param params[4])
+{
+    aes_cipher *sess = (aes_cipher *) session;
+    size_t data_size, payload_len, pkt_sz, hdr_len;
+    uint8_t *pkt, *payload;
+    TEE_Result res;
+    uint32_t exp_param_types = TEE_PARAM_TYPES(
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_MEMREF_INPUT,
+            TEE_PARAM_TYPE_VALUE_INPUT);
+    if (param_types != exp_param_types)
+        return TEE_ERROR_BAD_PARAMETERS;
+    if (!sess->mqtt_ctx)
+        return TEE_ERROR_BAD_STATE;
+    if (params[0].memref.size <= TA_MQTTZ_CLI_ID_SZ + TA_AES_IV_SIZE ||
+            params[1].memref.size != TA_MQTTZ_CLI_ID_SZ ||
+            params[2].memref.size > TA_HOT_CACHE_MQTT_TOPIC_MAX)
+        return TEE_ERROR_BAD_PARAMETERS;
+    data_size = params[0].memref.size - TA_MQTTZ_CLI_ID_SZ - TA_AES_IV_SIZE;
+    if (data_size > TA_MQTTZ_MAX_MSG_SZ || data_size % TA_AES_IV_SIZE)
+        return TEE_ERROR_BAD_PARAMETERS;
+
+    // The payload has the layout TA_REENCRYPT returns: ID, IV, ciphertext
+    payload_len = TA_MQTTZ_CLI_ID_SZ + TA_AES_IV_SIZE + data_size;
+    pkt_sz = MQTT_MAX_FIXED_HDR + 2 + params[2].memref.size + payload_len;
+    pkt = TEE_Malloc(pkt_sz, 0);
+    if (!pkt)
+        return TEE_ERROR_OUT_OF_MEMORY;
+    hdr_len = mqtt_publish_header(pkt, pkt_sz, params[2].memref.buffer,
+            params[2].memref.size, payload_len);
+    if (!hdr_len)
+    {
+        res = TEE_ERROR_BAD_PARAMETERS;
+        goto exit;
+    }
+    payload = pkt + hdr_len;
+    TEE_MemMove(payload, params[1].memref.buffer, TA_MQTTZ_CLI_ID_SZ);
+    res = reencrypt_payload(session, params[0].memref.buffer, data_size,
+            (char *) payload, params[3].value.a,
+            (char *) payload + TA_MQTTZ_CLI_ID_SZ,
+            (char *) payload + TA_MQTTZ_CLI_ID_SZ + TA_AES_IV_SIZE);
+    if (res == TEE_SUCCESS)
+    {
+        res = mqtt_send(sess, pkt, hdr_len + payload_len,
+                MQTT_PUBLISH_TIMEOUT_MS);
+        if (res != TEE_SUCCESS)
+        {
+            EMSG("Publish failed, closing the broker connection, res=0x%08x",
+                    res);
+            TEE_tcpSocket->close(sess->mqtt_ctx);
+            sess->mqtt_ctx = NULL;
+        }
+    }
+exit:
+    TEE_Free(pkt);
+    return res;
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
-	/* Nothing to do */
+#ifdef CFG_HOT_CACHE_KV_STORE
+	TEE_Result res;
+
+	res = kv_open();
+	if (res != TEE_SUCCESS)
+		return res;
+#endif
+	/* Index the keys of the log, it holds the newest value of each */
+	if (replay_key_log() != TEE_SUCCESS)
+		EMSG("Failed to replay the key log");
 	return TEE_SUCCESS;
 }
 
 void TA_DestroyEntryPoint(void)
 {
-	/* Nothing to do */
+	flush_key_buf(NULL);
+	rand_pool_wipe();
+#ifdef CFG_HOT_CACHE_KV_STORE
+	kv_close();
+#endif
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
@@ -559,6 +1778,7 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
         return TEE_ERROR_OUT_OF_MEMORY;
     sess->key_handle = TEE_HANDLE_NULL;
     sess->op_handle = TEE_HANDLE_NULL;
+    sess->mqtt_ctx = NULL;
     *session = (void *)sess;
 	return TEE_SUCCESS;
 }
@@ -567,6 +1787,7 @@ void TA_CloseSessionEntryPoint(void __unused *session)
 {
     aes_cipher *sess;
     sess = (aes_cipher *) session;
+    mqtt_close(sess);
     if (sess->key_handle != TEE_HANDLE_NULL)
         TEE_FreeTransientObject(sess->key_handle);
     if (sess->op_handle != TEE_HANDLE_NULL)
@@ -580,9 +1801,31 @@ TEE_Result TA_InvokeCommandEntryPoint(void __unused *session,
 				      TEE_Param params[4])
 {
 	switch (command) {
+        case TA_SECURE_STORAGE_CMD_WRITE_RAW:
+            return write_key(param_types, params);
+        case TA_SECURE_STORAGE_CMD_DELETE:
+            return delete_key_cmd(param_types, params);
         case TA_REENCRYPT:
             printf("Aloha?\n");
             return payload_reencryption(session, param_types, params);
+        case TA_HOT_CACHE_CMD_PUT_KEY:
+            return put_key(param_types, params);
+        case TA_HOT_CACHE_CMD_FLUSH:
+            return flush_keys(param_types, params);
+        case TA_HOT_CACHE_CMD_IDLE:
+            return idle_work(param_types, params);
+        case TA_HOT_CACHE_CMD_COMPACT:
+            return compact_keys(param_types, params);
+        case TA_HOT_CACHE_CMD_ROTATE_KEYS:
+            return rotate_keys(param_types, params);
+        case TA_HOT_CACHE_CMD_PREFETCH:
+            return prefetch_keys(param_types, params);
+        case TA_HOT_CACHE_CMD_MQTT_CONNECT:
+            return mqtt_open(session, param_types, params);
+        case TA_HOT_CACHE_CMD_REENCRYPT_PUBLISH:
+            return reencrypt_publish(session, param_types, params);
+        case TA_HOT_CACHE_CMD_MQTT_PING:
+            return mqtt_ping(session, param_types, params);
 	default:
 		EMSG("Command ID 0x%x is not supported", command);
 		return TEE_ERROR_NOT_SUPPORTED;
@@ -55,17 +55,18 @@
 #define TA_SECURE_STORAGE_CMD_READ_RAW		0
 
 /*
- * TA_SECURE_STORAGE_CMD_WRITE_RAW - Create and fill a secure storage file
- * param[0] (memref) ID used the identify the persistent object
- * param[1] (memref) Raw data to be writen in the persistent object
+ * TA_SECURE_STORAGE_CMD_WRITE_RAW - Store a client key synchronously
+ * param[0] (memref) client ID, TA_MQTTZ_CLI_ID_SZ bytes
+ * param[1] (memref) client key, TA_AES_KEY_SIZE bytes
  * param[2] unused
  * param[3] unused
  */
 #define TA_SECURE_STORAGE_CMD_WRITE_RAW		1
 
 /*
- * TA_SECURE_STORAGE_CMD_DELETE - Delete a persistent object
- * param[0] (memref) ID used the identify the persistent object
+ * TA_SECURE_STORAGE_CMD_DELETE - Delete a client key from the buffer, the
+ * key cache and secure storage, every stored version included
+ * param[0] (memref) client ID, TA_MQTTZ_CLI_ID_SZ bytes
  * param[1] unused
  * param[2] unused
  * param[3] unused
@@ -117,5 +118,114 @@
  */
 #define TA_AES_CMD_CIPHER		            7
 
+/*
+ * TA_HOT_CACHE_CMD_PUT_KEY - Store a client key through the write-behind
+ * buffer. The key is visible to TA_REENCRYPT immediately and is appended to
+ * the key log on the next flush, which this command starts once the buffer
+ * is full or its oldest key is 500 ms old.
+ * param[0] (memref) client ID, TA_MQTTZ_CLI_ID_SZ bytes
+ * param[1] (memref) client key, TA_AES_KEY_SIZE bytes
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_PUT_KEY            8
+
+/*
+ * TA_HOT_CACHE_CMD_FLUSH - Append all buffered keys to the key log in secure
+ * storage, with a single write
+ * param[0] (value) a: number of keys flushed, b: unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_FLUSH              9
+
+/*
+ * TA_HOT_CACHE_CMD_COMPACT - Compact the key store, only supported when the
+ * TA is built with CFG_HOT_CACHE_KV_STORE=y
+ * param[0] (value) a: store bytes before, b: store bytes after compaction
+ * param[1] (value) a: number of live keys, b: number of segments in use
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_COMPACT            10
+
+/*
+ * TA_HOT_CACHE_CMD_ROTATE_KEYS - Publish new versions of client keys. At
+ * most TA_HOT_CACHE_ROTATE_MAX entries are handled per invocation, the
+ * caller resubmits the remaining ones. Each invocation also deletes a few
+ * superseded versions.
+ * param[0] (memref) packed entries of client ID (TA_MQTTZ_CLI_ID_SZ bytes)
+ *          followed by client key (TA_AES_KEY_SIZE bytes)
+ * param[1] (value) a: number of entries consumed, b: unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_ROTATE_KEYS        11
+#define TA_HOT_CACHE_ROTATE_MAX             8
+
+/*
+ * TA_HOT_CACHE_CMD_PREFETCH - Load the keys of the given clients into the
+ * key cache, which holds TA_HOT_CACHE_KEY_CACHE_SZ keys. Keys already
+ * cached or buffered are left alone, unknown clients are skipped.
+ * param[0] (memref) packed client IDs, TA_MQTTZ_CLI_ID_SZ bytes each
+ * param[1] (value) a: number of keys loaded, b: number already cached
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_PREFETCH           12
+#define TA_HOT_CACHE_KEY_CACHE_SZ           64
+
+/*
+ * TA_HOT_CACHE_CMD_MQTT_CONNECT - Connect the session to an MQTT broker over
+ * a TEE TCP socket (CONNECT with a clean session, no credentials). The
+ * connection is closed with a DISCONNECT when the session ends. The TA is
+ * single instance: while it waits up to 5 s for the broker, the other
+ * sessions wait too, so connect before the traffic starts.
+ * param[0] (value) a: broker port, b: keep alive in seconds
+ * param[1] (memref) broker IPv4 address, as a string
+ * param[2] (memref) MQTT client ID, at most TA_HOT_CACHE_MQTT_ID_MAX bytes
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_MQTT_CONNECT       13
+#define TA_HOT_CACHE_MQTT_ID_MAX            23
+
+/*
+ * TA_HOT_CACHE_CMD_REENCRYPT_PUBLISH - Re-encrypt a message as TA_REENCRYPT
+ * does and publish it (QoS 0) on the broker connection, without returning
+ * it. The payload is the destination client ID, the new IV and the
+ * ciphertext, whose size shall be a multiple of TA_AES_IV_SIZE. The send
+ * may stall the TA for up to 100 ms; if the packet does not go out in that
+ * time the connection is closed and TA_HOT_CACHE_CMD_MQTT_CONNECT has to be
+ * invoked again.
+ * param[0] (memref) origin client ID, IV and ciphertext
+ * param[1] (memref) destination client ID, TA_MQTTZ_CLI_ID_SZ bytes
+ * param[2] (memref) topic, at most TA_HOT_CACHE_MQTT_TOPIC_MAX bytes
+ * param[3] (value) a: key mode as for TA_REENCRYPT, b: unused
+ */
+#define TA_HOT_CACHE_CMD_REENCRYPT_PUBLISH  14
+#define TA_HOT_CACHE_MQTT_TOPIC_MAX         128
+
+/*
+ * TA_HOT_CACHE_CMD_MQTT_PING - Send a PINGREQ and wait for the PINGRESP
+ * param[0] unused
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_MQTT_PING          15
+
+/*
+ * TA_HOT_CACHE_CMD_IDLE - Do the storage work kept off TA_REENCRYPT: flush
+ * the buffer if it is due, delete a few superseded key versions, then apply
+ * the key log to the per-client key objects and empty it. Meant to be
+ * invoked while no messages flow.
+ * param[0] (value) a: number of logged keys applied, b: number of key
+ *          versions deleted
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_HOT_CACHE_CMD_IDLE               16
 
 #endif /* __HOT_CACHE_H__ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __MQTT_H__
+#define __MQTT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal MQTT 3.1.1 encoder, enough to publish from the TA: CONNECT with a
+ * clean session and no credentials, QoS 0 PUBLISH, PINGREQ and DISCONNECT.
+ * Each function writes a packet to buf and returns its length, or 0 when
+ * it does not fit in buf_sz bytes or a field is too long for the protocol.
+ */
+#define MQTT_MAX_FIXED_HDR	5	/* packet type and remaining length */
+#define MQTT_CONNACK_SIZE	4
+#define MQTT_PINGRESP_SIZE	2
+
+size_t mqtt_connect(uint8_t *buf, size_t buf_sz, const char *client_id,
+		    size_t client_id_len, uint16_t keep_alive);
+/*
+ * Only the fixed header and the topic of a PUBLISH, the caller appends the
+ * payload_len payload bytes right after the returned length
+ */
+size_t mqtt_publish_header(uint8_t *buf, size_t buf_sz, const char *topic,
+			   size_t topic_len, size_t payload_len);
+size_t mqtt_pingreq(uint8_t *buf, size_t buf_sz);
+size_t mqtt_disconnect(uint8_t *buf, size_t buf_sz);
+
+/* Whether a CONNACK accepts the connection */
+int mqtt_connack_ok(const uint8_t *buf, size_t len);
+/* Whether buf holds a PINGRESP */
+int mqtt_pingresp_ok(const uint8_t *buf, size_t len);
+
+#endif /* __MQTT_H__ */
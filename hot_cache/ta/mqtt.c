@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <tee_internal_api.h>
+
+#include <mqtt.h>
+
+#define MQTT_CONNECT		0x10
+#define MQTT_CONNACK		0x20
+#define MQTT_PUBLISH		0x30
+#define MQTT_PINGREQ		0xc0
+#define MQTT_PINGRESP		0xd0
+#define MQTT_DISCONNECT		0xe0
+
+#define MQTT_PROTO_LEVEL	4	/* 3.1.1 */
+#define MQTT_CLEAN_SESSION	0x02
+#define MQTT_MAX_REMAINING	268435455
+#define MQTT_MAX_STRING		65535
+
+/* Fixed header, returns its length or 0 if the remaining length is invalid */
+static size_t put_fixed_header(uint8_t *buf, uint8_t type, size_t remaining)
+{
+	size_t n = 0;
+
+	if (remaining > MQTT_MAX_REMAINING)
+		return 0;
+
+	buf[n++] = type;
+	do {
+		buf[n] = remaining % 128;
+		remaining /= 128;
+		if (remaining)
+			buf[n] |= 0x80;
+		n++;
+	} while (remaining);
+	return n;
+}
+
+static size_t fixed_header_size(size_t remaining)
+{
+	size_t n = 2;
+
+	while (remaining >= 128) {
+		remaining /= 128;
+		n++;
+	}
+	return n;
+}
+
+/* UTF-8 string field: 16 bit big endian length and the bytes */
+static size_t put_string(uint8_t *buf, const char *str, size_t len)
+{
+	buf[0] = len >> 8;
+	buf[1] = len & 0xff;
+	TEE_MemMove(buf + 2, str, len);
+	return len + 2;
+}
+
+size_t mqtt_connect(uint8_t *buf, size_t buf_sz, const char *client_id,
+		    size_t client_id_len, uint16_t keep_alive)
+{
+	/* Protocol name, level, flags and keep alive, then the client id */
+	size_t remaining = 6 + 1 + 1 + 2 + 2 + client_id_len;
+	size_t n = 0;
+
+	if (client_id_len > MQTT_MAX_STRING ||
+	    fixed_header_size(remaining) + remaining > buf_sz)
+		return 0;
+
+	n = put_fixed_header(buf, MQTT_CONNECT, remaining);
+	n += put_string(buf + n, "MQTT", 4);
+	buf[n++] = MQTT_PROTO_LEVEL;
+	buf[n++] = MQTT_CLEAN_SESSION;
+	buf[n++] = keep_alive >> 8;
+	buf[n++] = keep_alive & 0xff;
+	n += put_string(buf + n, client_id, client_id_len);
+	return n;
+}
+
+size_t mqtt_publish_header(uint8_t *buf, size_t buf_sz, const char *topic,
+			   size_t topic_len, size_t payload_len)
+{
+	size_t remaining = 2 + topic_len + payload_len;
+	size_t n = 0;
+
+	if (!topic_len || topic_len > MQTT_MAX_STRING ||
+	    remaining > MQTT_MAX_REMAINING ||
+	    fixed_header_size(remaining) + remaining > buf_sz)
+		return 0;
+
+	/* QoS 0, no packet identifier */
+	n = put_fixed_header(buf, MQTT_PUBLISH, remaining);
+	n += put_string(buf + n, topic, topic_len);
+	return n;
+}
+
+size_t mqtt_pingreq(uint8_t *buf, size_t buf_sz)
+{
+	if (buf_sz < 2)
+		return 0;
+	return put_fixed_header(buf, MQTT_PINGREQ, 0);
+}
+
+size_t mqtt_disconnect(uint8_t *buf, size_t buf_sz)
+{
+	if (buf_sz < 2)
+		return 0;
+	return put_fixed_header(buf, MQTT_DISCONNECT, 0);
+}
+
+int mqtt_connack_ok(const uint8_t *buf, size_t len)
+{
+	/* Byte 3 is the return code, 0 is connection accepted */
+	return len == MQTT_CONNACK_SIZE && buf[0] == MQTT_CONNACK &&
+	       buf[1] == 2 && buf[3] == 0;
+}
+
+int mqtt_pingresp_ok(const uint8_t *buf, size_t len)
+{
+	return len == MQTT_PINGRESP_SIZE && buf[0] == MQTT_PINGRESP &&
+	       buf[1] == 0;
+}
@@ -1,2 +1,6 @@
 global-incdirs-y += include
+global-incdirs-y += ../../lib/ta/include
 srcs-y += hot_cache_ta.c
+srcs-y += ../../lib/ta/rand_pool.c
+srcs-y += mqtt.c
+srcs-$(CFG_HOT_CACHE_KV_STORE) += ../../lib/ta/kv_store.c
@@ -36,7 +36,14 @@
 
 #define TA_UUID				TA_HOT_CACHE_UUID
 
-#define TA_FLAGS			(TA_FLAG_EXEC_DDR | TA_FLAG_SINGLE_INSTANCE)
+/*
+ * Keep the instance, and its key buffer and cache, across sessions. Several
+ * sessions may be open at once so that keys can be prefetched from another
+ * host thread, their commands are still run one at a time.
+ */
+#define TA_FLAGS			(TA_FLAG_EXEC_DDR | TA_FLAG_SINGLE_INSTANCE | \
+					 TA_FLAG_MULTI_SESSION | \
+					 TA_FLAG_INSTANCE_KEEP_ALIVE)
 #define TA_STACK_SIZE			(4 * 1024)
 #define TA_DATA_SIZE			(64 * 1024)
 
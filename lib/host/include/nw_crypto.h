@@ -0,0 +1,62 @@
+#ifndef __NW_CRYPTO_H__
+#define __NW_CRYPTO_H__
+
+#include <stdint.h>
+#include <openssl/evp.h>
+
+/*
+ * Normal world AES engine on top of OpenSSL.
+ *
+ * Every thread keeps NW_CTX_CACHE_SIZE cipher contexts that stay keyed
+ * between calls. A call with a known (cipher, key, direction) only restarts
+ * the context with the new IV, instead of allocating it and expanding the
+ * key again. nw_cipher_parallel() splits a CTR buffer into counter aligned
+ * segments and ciphers them on the worker threads started by
+ * nw_crypto_init(), the calling thread taking the first segment.
+ */
+#define NW_CTX_CACHE_SIZE       4
+#define NW_MAX_THREADS          64
+#define NW_BLOCK_SIZE           16
+
+int nw_crypto_init(int num_threads);
+void nw_crypto_release(void);
+/* Free the contexts cached by the calling thread */
+void nw_crypto_thread_release(void);
+
+/*
+ * Cipher in_len bytes of in into out, padding as the cipher does by
+ * default. Returns the output length or -1 on error.
+ */
+int nw_cipher(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, int enc, const unsigned char *in, int in_len,
+        unsigned char *out);
+/*
+ * AES-GCM through the same context cache: the nonce only restarts a keyed
+ * context. The encryption writes tag_len bytes of tag, the decryption
+ * checks them. Both return the payload length or -1 on error, a tag
+ * mismatch included.
+ */
+int nw_gcm_encrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *nonce, const unsigned char *aad, int aad_len,
+        const unsigned char *in, int in_len, unsigned char *out,
+        unsigned char *tag, int tag_len);
+int nw_gcm_decrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *nonce, const unsigned char *aad, int aad_len,
+        const unsigned char *in, int in_len, unsigned char *out,
+        const unsigned char *tag, int tag_len);
+/* Same as nw_cipher() with a new context per call, for comparison */
+int nw_cipher_oneshot(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, int enc, const unsigned char *in, int in_len,
+        unsigned char *out);
+/*
+ * CTR only: cipher in_len bytes on up to num_threads threads, limited to
+ * the number given to nw_crypto_init(). Returns in_len or -1 on error.
+ */
+int nw_cipher_parallel(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, const unsigned char *in, size_t in_len,
+        unsigned char *out, int num_threads);
+
+/* Advance a big endian 128 bit CTR counter block by blocks */
+void nw_ctr_add(unsigned char *ctr, uint64_t blocks);
+
+#endif /* __NW_CRYPTO_H__ */
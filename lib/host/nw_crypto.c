@@ -0,0 +1,310 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "nw_crypto.h"
+
+struct nw_ctx {
+    EVP_CIPHER_CTX *ctx;
+    const EVP_CIPHER *cipher;
+    unsigned char key[EVP_MAX_KEY_LENGTH];
+    int enc;
+    unsigned long last_use;
+};
+
+// Contexts of the calling thread, the least recently used one is recycled
+static __thread struct nw_ctx nw_ctxs[NW_CTX_CACHE_SIZE];
+static __thread unsigned long nw_clock;
+
+struct nw_job {
+    const EVP_CIPHER *cipher;
+    const unsigned char *key;
+    unsigned char iv[NW_BLOCK_SIZE];
+    const unsigned char *in;
+    unsigned char *out;
+    size_t len;
+    size_t seg_len;
+    int num_segs;
+};
+
+static struct {
+    pthread_mutex_t call_lock;      // one parallel call at a time
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t threads[NW_MAX_THREADS];
+    int num_workers;
+    unsigned long generation;
+    int pending;
+    bool failed;
+    bool stop;
+    struct nw_job job;
+} nw_pool = {
+    .call_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+void nw_ctr_add(unsigned char *ctr, uint64_t blocks)
+{
+    unsigned int carry = 0;
+
+    for (int i = NW_BLOCK_SIZE - 1; i >= 0 && (blocks || carry); i--) {
+        carry += ctr[i] + (blocks & 0xff);
+        ctr[i] = carry & 0xff;
+        carry >>= 8;
+        blocks >>= 8;
+    }
+}
+
+static EVP_CIPHER_CTX *nw_get_ctx(const EVP_CIPHER *cipher,
+        const unsigned char *key, const unsigned char *iv, int enc)
+{
+    int key_len = EVP_CIPHER_key_length(cipher);
+    struct nw_ctx *victim = &nw_ctxs[0];
+    struct nw_ctx *c;
+
+    for (int i = 0; i < NW_CTX_CACHE_SIZE; i++) {
+        c = &nw_ctxs[i];
+        if (c->ctx && c->cipher == cipher && c->enc == enc &&
+                !memcmp(c->key, key, key_len)) {
+            c->last_use = ++nw_clock;
+            // Same key schedule, only restart with the new IV
+            if (1 != EVP_CipherInit_ex(c->ctx, NULL, NULL, NULL, iv, enc))
+                return NULL;
+            return c->ctx;
+        }
+        if (c->last_use < victim->last_use)
+            victim = c;
+    }
+
+    if (!victim->ctx && !(victim->ctx = EVP_CIPHER_CTX_new()))
+        return NULL;
+    if (1 != EVP_CipherInit_ex(victim->ctx, cipher, NULL, key, iv, enc)) {
+        victim->cipher = NULL;
+        return NULL;
+    }
+    victim->cipher = cipher;
+    victim->enc = enc;
+    memcpy(victim->key, key, key_len);
+    victim->last_use = ++nw_clock;
+    return victim->ctx;
+}
+
+void nw_crypto_thread_release(void)
+{
+    for (int i = 0; i < NW_CTX_CACHE_SIZE; i++) {
+        EVP_CIPHER_CTX_free(nw_ctxs[i].ctx);
+        memset(&nw_ctxs[i], 0, sizeof(nw_ctxs[i]));
+    }
+}
+
+int nw_cipher(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, int enc, const unsigned char *in, int in_len,
+        unsigned char *out)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, out_len;
+
+    if (!(ctx = nw_get_ctx(cipher, key, iv, enc)))
+        return -1;
+    if (1 != EVP_CipherUpdate(ctx, out, &len, in, in_len))
+        return -1;
+    out_len = len;
+    if (1 != EVP_CipherFinal_ex(ctx, out + out_len, &len))
+        return -1;
+    return out_len + len;
+}
+
+int nw_gcm_encrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *nonce, const unsigned char *aad, int aad_len,
+        const unsigned char *in, int in_len, unsigned char *out,
+        unsigned char *tag, int tag_len)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, out_len;
+
+    if (!(ctx = nw_get_ctx(cipher, key, nonce, 1)))
+        return -1;
+    if (aad_len && 1 != EVP_EncryptUpdate(ctx, NULL, &len, aad, aad_len))
+        return -1;
+    if (1 != EVP_EncryptUpdate(ctx, out, &len, in, in_len))
+        return -1;
+    out_len = len;
+    if (1 != EVP_EncryptFinal_ex(ctx, out + out_len, &len))
+        return -1;
+    out_len += len;
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, tag_len, tag))
+        return -1;
+    return out_len;
+}
+
+int nw_gcm_decrypt(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *nonce, const unsigned char *aad, int aad_len,
+        const unsigned char *in, int in_len, unsigned char *out,
+        const unsigned char *tag, int tag_len)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, out_len;
+
+    if (!(ctx = nw_get_ctx(cipher, key, nonce, 0)))
+        return -1;
+    if (aad_len && 1 != EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_len))
+        return -1;
+    if (1 != EVP_DecryptUpdate(ctx, out, &len, in, in_len))
+        return -1;
+    out_len = len;
+    // The tag is checked by the final call
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag_len,
+                (void *) tag))
+        return -1;
+    if (EVP_DecryptFinal_ex(ctx, out + out_len, &len) <= 0)
+        return -1;
+    return out_len + len;
+}
+
+int nw_cipher_oneshot(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, int enc, const unsigned char *in, int in_len,
+        unsigned char *out)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, out_len = -1;
+
+    if (!(ctx = EVP_CIPHER_CTX_new()))
+        return -1;
+    if (1 == EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, enc) &&
+            1 == EVP_CipherUpdate(ctx, out, &len, in, in_len)) {
+        out_len = len;
+        if (1 == EVP_CipherFinal_ex(ctx, out + out_len, &len))
+            out_len += len;
+        else
+            out_len = -1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return out_len;
+}
+
+static int nw_run_segment(struct nw_job *job, int seg)
+{
+    unsigned char iv[NW_BLOCK_SIZE];
+    size_t off = job->seg_len * seg;
+    size_t len = job->len - off < job->seg_len ? job->len - off : job->seg_len;
+
+    // Each segment starts at the counter of its first block
+    memcpy(iv, job->iv, sizeof(iv));
+    nw_ctr_add(iv, off / NW_BLOCK_SIZE);
+    return nw_cipher(job->cipher, job->key, iv, 1, job->in + off, len,
+            job->out + off) == (int) len ? 0 : -1;
+}
+
+static void *nw_worker(void *arg)
+{
+    int seg = (int) (intptr_t) arg + 1;
+    unsigned long seen = 0;
+    int res;
+
+    pthread_mutex_lock(&nw_pool.lock);
+    for (;;) {
+        while (!nw_pool.stop && nw_pool.generation == seen)
+            pthread_cond_wait(&nw_pool.start, &nw_pool.lock);
+        if (nw_pool.stop)
+            break;
+        seen = nw_pool.generation;
+        if (seg >= nw_pool.job.num_segs)
+            continue;
+        pthread_mutex_unlock(&nw_pool.lock);
+
+        res = nw_run_segment(&nw_pool.job, seg);
+
+        pthread_mutex_lock(&nw_pool.lock);
+        if (res)
+            nw_pool.failed = true;
+        if (--nw_pool.pending == 0)
+            pthread_cond_signal(&nw_pool.done);
+    }
+    pthread_mutex_unlock(&nw_pool.lock);
+
+    nw_crypto_thread_release();
+    return NULL;
+}
+
+int nw_crypto_init(int num_threads)
+{
+    int num_workers = num_threads - 1;
+
+    if (num_workers > NW_MAX_THREADS)
+        num_workers = NW_MAX_THREADS;
+    nw_pool.stop = false;
+    for (nw_pool.num_workers = 0; nw_pool.num_workers < num_workers;
+            nw_pool.num_workers++) {
+        if (pthread_create(&nw_pool.threads[nw_pool.num_workers], NULL,
+                    nw_worker, (void *) (intptr_t) nw_pool.num_workers)) {
+            nw_crypto_release();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void nw_crypto_release(void)
+{
+    pthread_mutex_lock(&nw_pool.lock);
+    nw_pool.stop = true;
+    pthread_cond_broadcast(&nw_pool.start);
+    pthread_mutex_unlock(&nw_pool.lock);
+    for (int i = 0; i < nw_pool.num_workers; i++)
+        pthread_join(nw_pool.threads[i], NULL);
+    nw_pool.num_workers = 0;
+    nw_crypto_thread_release();
+}
+
+int nw_cipher_parallel(const EVP_CIPHER *cipher, const unsigned char *key,
+        const unsigned char *iv, const unsigned char *in, size_t in_len,
+        unsigned char *out, int num_threads)
+{
+    struct nw_job *job = &nw_pool.job;
+    size_t blocks = (in_len + NW_BLOCK_SIZE - 1) / NW_BLOCK_SIZE;
+    size_t seg_blocks;
+    int res;
+
+    if (EVP_CIPHER_mode(cipher) != EVP_CIPH_CTR_MODE)
+        return -1;
+    if (num_threads > nw_pool.num_workers + 1)
+        num_threads = nw_pool.num_workers + 1;
+    if (num_threads < 1)
+        num_threads = 1;
+    if (!in_len)
+        return 0;
+
+    pthread_mutex_lock(&nw_pool.call_lock);
+    seg_blocks = (blocks + num_threads - 1) / num_threads;
+    job->cipher = cipher;
+    job->key = key;
+    memcpy(job->iv, iv, NW_BLOCK_SIZE);
+    job->in = in;
+    job->out = out;
+    job->len = in_len;
+    job->seg_len = seg_blocks * NW_BLOCK_SIZE;
+    job->num_segs = (in_len + job->seg_len - 1) / job->seg_len;
+
+    pthread_mutex_lock(&nw_pool.lock);
+    nw_pool.pending = job->num_segs - 1;
+    nw_pool.failed = false;
+    nw_pool.generation++;
+    pthread_cond_broadcast(&nw_pool.start);
+    pthread_mutex_unlock(&nw_pool.lock);
+
+    res = nw_run_segment(job, 0);
+
+    pthread_mutex_lock(&nw_pool.lock);
+    while (nw_pool.pending)
+        pthread_cond_wait(&nw_pool.done, &nw_pool.lock);
+    if (nw_pool.failed)
+        res = -1;
+    pthread_mutex_unlock(&nw_pool.lock);
+    pthread_mutex_unlock(&nw_pool.call_lock);
+
+    return res ? -1 : (int) in_len;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __KV_STORE_H__
+#define __KV_STORE_H__
+
+#include <tee_internal_api.h>
+
+/*
+ * Log-structured key/value store on top of the TA private secure storage.
+ *
+ * Puts and deletes are appended as records to the active segment object.
+ * Once a segment reaches KV_SEGMENT_SIZE it is sealed and never written
+ * again. An in-memory index maps every live key to the segment and offset
+ * of its latest record and is rebuilt by scanning the segments in
+ * kv_open(). kv_compact() rewrites the live records into fresh segments and
+ * deletes the old ones. A small manifest object records the range of
+ * segments in use.
+ *
+ * The store is a singleton owned by the TA instance and is not thread
+ * safe, which matches the TA execution model.
+ */
+#define KV_MAX_KEY_SIZE		64
+#define KV_MAX_VALUE_SIZE	8192
+#define KV_SEGMENT_SIZE		(64 * 1024)
+
+struct kv_stats {
+	uint32_t num_keys;
+	uint32_t live_bytes;	/* bytes of records reachable from the index */
+	uint32_t total_bytes;	/* bytes of records in all segments */
+	uint32_t first_seg;
+	uint32_t active_seg;
+};
+
+TEE_Result kv_open(void);
+void kv_close(void);
+
+TEE_Result kv_put(const void *key, uint32_t key_len,
+		  const void *val, uint32_t val_len);
+/*
+ * On TEE_ERROR_SHORT_BUFFER val_len is updated with the size of the value.
+ * On success it holds the number of bytes copied to val.
+ */
+TEE_Result kv_get(const void *key, uint32_t key_len,
+		  void *val, uint32_t *val_len);
+TEE_Result kv_delete(const void *key, uint32_t key_len);
+
+TEE_Result kv_compact(void);
+void kv_get_stats(struct kv_stats *stats);
+
+#endif /* __KV_STORE_H__ */
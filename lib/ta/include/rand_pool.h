@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef __RAND_POOL_H__
+#define __RAND_POOL_H__
+
+#include <stdint.h>
+
+/*
+ * Random bytes for IVs and nonces, served from a pool that is refilled by
+ * one TEE_GenerateRandom() call every RAND_POOL_SIZE bytes. A request costs
+ * a copy out of the pool instead of a system call into the TEE core. Bytes
+ * left in the pool when a request does not fit are dropped, and bytes handed
+ * out are wiped, so no value is ever returned twice.
+ *
+ * The pool belongs to the TA instance and is not thread safe, which matches
+ * the TA execution model.
+ */
+#define RAND_POOL_SIZE		4096
+
+void rand_pool_get(void *buf, uint32_t len);
+/* Drop the unused bytes, e.g. when the TA instance is destroyed */
+void rand_pool_wipe(void);
+
+#endif /* __RAND_POOL_H__ */
@@ -0,0 +1,669 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include <kv_store.h>
+
+#define KV_MANIFEST_ID		"kv.manifest"
+#define KV_MANIFEST_MAGIC	0x4b564d46	/* "KVMF" */
+#define KV_RECORD_MAGIC		0x4b565243	/* "KVRC" */
+#define KV_SEG_ID_SIZE		16
+#define KV_INDEX_BUCKETS	64
+
+#define KV_REC_PUT		0
+#define KV_REC_DELETE		1
+
+/*
+ * Segments first_seg..active_seg are in use. Segment numbers only grow, so
+ * a segment outside that range is a leftover of an interrupted roll-over
+ * or compaction and is deleted by kv_open().
+ */
+struct kv_manifest {
+	uint32_t magic;
+	uint32_t first_seg;
+	uint32_t active_seg;
+};
+
+/* On-storage record header, followed by the key and then the value */
+struct kv_record {
+	uint32_t magic;
+	uint16_t type;
+	uint16_t key_len;
+	uint32_t val_len;
+	uint32_t checksum;
+};
+
+struct kv_entry {
+	struct kv_entry *next;
+	uint32_t seg;
+	uint32_t offset;	/* of the record header in the segment */
+	uint32_t val_len;
+	uint32_t key_len;
+	uint8_t key[];
+};
+
+static struct {
+	bool is_open;
+	struct kv_manifest mf;
+	TEE_ObjectHandle active;
+	uint32_t active_size;
+	struct kv_entry *index[KV_INDEX_BUCKETS];
+	struct kv_stats stats;
+} kv;
+
+static uint32_t fnv1a(uint32_t h, const void *data, uint32_t len)
+{
+	const uint8_t *p = data;
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
+static uint32_t record_checksum(struct kv_record *rec, const void *key,
+				const void *val)
+{
+	uint32_t h = 2166136261U;
+
+	h = fnv1a(h, &rec->type, sizeof(rec->type));
+	h = fnv1a(h, &rec->key_len, sizeof(rec->key_len));
+	h = fnv1a(h, &rec->val_len, sizeof(rec->val_len));
+	h = fnv1a(h, key, rec->key_len);
+	return fnv1a(h, val, rec->val_len);
+}
+
+static uint32_t record_size(uint32_t key_len, uint32_t val_len)
+{
+	return sizeof(struct kv_record) + key_len + val_len;
+}
+
+static void seg_id(uint32_t seg, char *id)
+{
+	snprintf(id, KV_SEG_ID_SIZE, "kv.seg.%08" PRIx32, seg);
+}
+
+static TEE_Result open_segment(uint32_t seg, uint32_t flags, bool create,
+			       TEE_ObjectHandle *object)
+{
+	char id[KV_SEG_ID_SIZE];
+
+	seg_id(seg, id);
+	if (create)
+		return TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+						  id, strlen(id),
+						  flags |
+						  TEE_DATA_FLAG_ACCESS_WRITE_META |
+						  TEE_DATA_FLAG_OVERWRITE,
+						  TEE_HANDLE_NULL, NULL, 0,
+						  object);
+	return TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, id, strlen(id),
+					flags, object);
+}
+
+static TEE_Result delete_segment(uint32_t seg)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	res = open_segment(seg, TEE_DATA_FLAG_ACCESS_WRITE_META, false,
+			   &object);
+	if (res != TEE_SUCCESS)
+		return res;
+	TEE_CloseAndDeletePersistentObject1(object);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result write_manifest(struct kv_manifest *mf)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	/* The manifest is tiny, replacing it is a single atomic update */
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE, KV_MANIFEST_ID,
+					 strlen(KV_MANIFEST_ID),
+					 TEE_DATA_FLAG_ACCESS_WRITE |
+					 TEE_DATA_FLAG_ACCESS_WRITE_META |
+					 TEE_DATA_FLAG_OVERWRITE,
+					 TEE_HANDLE_NULL, mf, sizeof(*mf),
+					 &object);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to write the kv manifest, res=0x%08x", res);
+		return res;
+	}
+	TEE_CloseObject(object);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result read_manifest(struct kv_manifest *mf)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint32_t read_bytes;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, KV_MANIFEST_ID,
+				       strlen(KV_MANIFEST_ID),
+				       TEE_DATA_FLAG_ACCESS_READ, &object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+		mf->magic = KV_MANIFEST_MAGIC;
+		mf->first_seg = 0;
+		mf->active_seg = 0;
+		return write_manifest(mf);
+	}
+	if (res != TEE_SUCCESS)
+		return res;
+	res = TEE_ReadObjectData(object, mf, sizeof(*mf), &read_bytes);
+	TEE_CloseObject(object);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (read_bytes != sizeof(*mf) || mf->magic != KV_MANIFEST_MAGIC ||
+	    mf->first_seg > mf->active_seg)
+		return TEE_ERROR_CORRUPT_OBJECT;
+	return TEE_SUCCESS;
+}
+
+static uint32_t key_hash(const void *key, uint32_t key_len)
+{
+	return fnv1a(2166136261U, key, key_len) % KV_INDEX_BUCKETS;
+}
+
+static struct kv_entry **index_find(const void *key, uint32_t key_len)
+{
+	struct kv_entry **e = &kv.index[key_hash(key, key_len)];
+
+	for (; *e; e = &(*e)->next)
+		if ((*e)->key_len == key_len &&
+		    !memcmp((*e)->key, key, key_len))
+			break;
+	return e;
+}
+
+static TEE_Result index_set(const void *key, uint32_t key_len, uint32_t seg,
+			    uint32_t offset, uint32_t val_len)
+{
+	struct kv_entry **e = index_find(key, key_len);
+
+	if (*e) {
+		kv.stats.live_bytes -= record_size(key_len, (*e)->val_len);
+	} else {
+		*e = TEE_Malloc(sizeof(**e) + key_len, 0);
+		if (!*e)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		TEE_MemMove((*e)->key, key, key_len);
+		(*e)->key_len = key_len;
+		kv.stats.num_keys++;
+	}
+	(*e)->seg = seg;
+	(*e)->offset = offset;
+	(*e)->val_len = val_len;
+	kv.stats.live_bytes += record_size(key_len, val_len);
+	return TEE_SUCCESS;
+}
+
+static void index_remove(const void *key, uint32_t key_len)
+{
+	struct kv_entry **e = index_find(key, key_len);
+	struct kv_entry *victim = *e;
+
+	if (!victim)
+		return;
+	*e = victim->next;
+	kv.stats.live_bytes -= record_size(key_len, victim->val_len);
+	kv.stats.num_keys--;
+	TEE_Free(victim);
+}
+
+static void index_clear(void)
+{
+	struct kv_entry *e;
+	size_t i;
+
+	for (i = 0; i < KV_INDEX_BUCKETS; i++) {
+		while (kv.index[i]) {
+			e = kv.index[i];
+			kv.index[i] = e->next;
+			TEE_Free(e);
+		}
+	}
+	kv.stats.num_keys = 0;
+	kv.stats.live_bytes = 0;
+}
+
+/*
+ * Replay the records of one segment into the index. Returns the offset
+ * right after the last valid record in end, anything past it is a torn
+ * append and is ignored.
+ */
+static TEE_Result scan_segment(uint32_t seg, TEE_ObjectHandle object,
+			       uint8_t *scratch, uint32_t *end)
+{
+	struct kv_record rec;
+	TEE_Result res;
+	uint32_t offset = 0;
+	uint32_t read_bytes;
+	uint8_t key[KV_MAX_KEY_SIZE];
+
+	for (;;) {
+		res = TEE_ReadObjectData(object, &rec, sizeof(rec),
+					 &read_bytes);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (read_bytes != sizeof(rec) || rec.magic != KV_RECORD_MAGIC ||
+		    rec.key_len > KV_MAX_KEY_SIZE ||
+		    rec.val_len > KV_MAX_VALUE_SIZE)
+			break;
+		res = TEE_ReadObjectData(object, key, rec.key_len,
+					 &read_bytes);
+		if (res != TEE_SUCCESS || read_bytes != rec.key_len)
+			break;
+		res = TEE_ReadObjectData(object, scratch, rec.val_len,
+					 &read_bytes);
+		if (res != TEE_SUCCESS || read_bytes != rec.val_len)
+			break;
+		if (record_checksum(&rec, key, scratch) != rec.checksum)
+			break;
+
+		if (rec.type == KV_REC_PUT)
+			res = index_set(key, rec.key_len, seg, offset,
+					rec.val_len);
+		else
+			index_remove(key, rec.key_len);
+		if (res != TEE_SUCCESS)
+			return res;
+		offset += record_size(rec.key_len, rec.val_len);
+	}
+
+	*end = offset;
+	kv.stats.total_bytes += offset;
+	return TEE_SUCCESS;
+}
+
+TEE_Result kv_open(void)
+{
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint8_t *scratch;
+	uint32_t end;
+	uint32_t seg;
+
+	if (kv.is_open)
+		return TEE_SUCCESS;
+
+	res = read_manifest(&kv.mf);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to read the kv manifest, res=0x%08x", res);
+		return res;
+	}
+
+	/* Drop leftovers of an interrupted roll-over or compaction */
+	for (seg = kv.mf.active_seg + 1; delete_segment(seg) == TEE_SUCCESS;
+	     seg++)
+		;
+	for (seg = kv.mf.first_seg; seg-- > 0 &&
+	     delete_segment(seg) == TEE_SUCCESS;)
+		;
+
+	scratch = TEE_Malloc(KV_MAX_VALUE_SIZE, 0);
+	if (!scratch)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	kv.stats.total_bytes = 0;
+	for (seg = kv.mf.first_seg; seg <= kv.mf.active_seg; seg++) {
+		if (seg == kv.mf.active_seg) {
+			res = open_segment(seg, TEE_DATA_FLAG_ACCESS_READ |
+					   TEE_DATA_FLAG_ACCESS_WRITE, false,
+					   &object);
+			if (res == TEE_ERROR_ITEM_NOT_FOUND)
+				res = open_segment(seg,
+						   TEE_DATA_FLAG_ACCESS_READ |
+						   TEE_DATA_FLAG_ACCESS_WRITE,
+						   true, &object);
+		} else {
+			res = open_segment(seg, TEE_DATA_FLAG_ACCESS_READ,
+					   false, &object);
+		}
+		if (res != TEE_SUCCESS) {
+			EMSG("Failed to open kv segment %" PRIu32
+			     ", res=0x%08x", seg, res);
+			goto err;
+		}
+
+		res = scan_segment(seg, object, scratch, &end);
+		if (res != TEE_SUCCESS) {
+			TEE_CloseObject(object);
+			goto err;
+		}
+
+		if (seg != kv.mf.active_seg) {
+			TEE_CloseObject(object);
+			continue;
+		}
+		/* Cut a torn tail so that new records follow valid ones */
+		res = TEE_TruncateObjectData(object, end);
+		if (res != TEE_SUCCESS) {
+			TEE_CloseObject(object);
+			goto err;
+		}
+		kv.active = object;
+		kv.active_size = end;
+	}
+
+	TEE_Free(scratch);
+	kv.is_open = true;
+	return TEE_SUCCESS;
+err:
+	TEE_Free(scratch);
+	index_clear();
+	return res;
+}
+
+void kv_close(void)
+{
+	if (!kv.is_open)
+		return;
+	TEE_CloseObject(kv.active);
+	kv.active = TEE_HANDLE_NULL;
+	index_clear();
+	kv.is_open = false;
+}
+
+/*
+ * Seal the active segment and continue in a new one. The new segment is
+ * created before the manifest points at it, so a crash in between only
+ * leaves an empty stray segment behind.
+ */
+static TEE_Result roll_segment(void)
+{
+	struct kv_manifest mf = kv.mf;
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	mf.active_seg++;
+	res = open_segment(mf.active_seg, TEE_DATA_FLAG_ACCESS_READ |
+			   TEE_DATA_FLAG_ACCESS_WRITE, true, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+	res = write_manifest(&mf);
+	if (res != TEE_SUCCESS) {
+		TEE_CloseAndDeletePersistentObject1(object);
+		return res;
+	}
+	TEE_CloseObject(kv.active);
+	kv.active = object;
+	kv.active_size = 0;
+	kv.mf = mf;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Write one record with a single TEE_WriteObjectData() call so that the
+ * storage layer commits it atomically. The checksum is computed over the
+ * copy in buf, which is what gets written, and not over the caller's
+ * buffers that may still change underneath.
+ */
+static TEE_Result write_record(TEE_ObjectHandle object, uint16_t type,
+			       const void *key, uint32_t key_len,
+			       const void *val, uint32_t val_len)
+{
+	struct kv_record rec;
+	TEE_Result res;
+	uint8_t *buf;
+
+	buf = TEE_Malloc(record_size(key_len, val_len), 0);
+	if (!buf)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(buf + sizeof(rec), key, key_len);
+	TEE_MemMove(buf + sizeof(rec) + key_len, val, val_len);
+
+	rec.magic = KV_RECORD_MAGIC;
+	rec.type = type;
+	rec.key_len = key_len;
+	rec.val_len = val_len;
+	rec.checksum = record_checksum(&rec, buf + sizeof(rec),
+				       buf + sizeof(rec) + key_len);
+	TEE_MemMove(buf, &rec, sizeof(rec));
+
+	res = TEE_SeekObjectData(object, 0, TEE_DATA_SEEK_END);
+	if (res == TEE_SUCCESS)
+		res = TEE_WriteObjectData(object, buf,
+					  record_size(key_len, val_len));
+	TEE_Free(buf);
+	return res;
+}
+
+static TEE_Result append(uint16_t type, const void *key, uint32_t key_len,
+			 const void *val, uint32_t val_len, uint32_t *offset)
+{
+	uint32_t sz = record_size(key_len, val_len);
+	TEE_Result res;
+
+	if (kv.active_size && kv.active_size + sz > KV_SEGMENT_SIZE) {
+		res = roll_segment();
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+	res = write_record(kv.active, type, key, key_len, val, val_len);
+	if (res != TEE_SUCCESS) {
+		EMSG("Failed to append kv record, res=0x%08x", res);
+		return res;
+	}
+	*offset = kv.active_size;
+	kv.active_size += sz;
+	kv.stats.total_bytes += sz;
+	return TEE_SUCCESS;
+}
+
+TEE_Result kv_put(const void *key, uint32_t key_len,
+		  const void *val, uint32_t val_len)
+{
+	TEE_Result res;
+	uint32_t offset;
+
+	if (!kv.is_open)
+		return TEE_ERROR_BAD_STATE;
+	if (!key_len || key_len > KV_MAX_KEY_SIZE ||
+	    val_len > KV_MAX_VALUE_SIZE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = append(KV_REC_PUT, key, key_len, val, val_len, &offset);
+	if (res != TEE_SUCCESS)
+		return res;
+	return index_set(key, key_len, kv.mf.active_seg, offset, val_len);
+}
+
+TEE_Result kv_delete(const void *key, uint32_t key_len)
+{
+	TEE_Result res;
+	uint32_t offset;
+
+	if (!kv.is_open)
+		return TEE_ERROR_BAD_STATE;
+	if (!*index_find(key, key_len))
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	res = append(KV_REC_DELETE, key, key_len, NULL, 0, &offset);
+	if (res != TEE_SUCCESS)
+		return res;
+	index_remove(key, key_len);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result read_value(struct kv_entry *e, void *val)
+{
+	TEE_ObjectHandle object = kv.active;
+	TEE_Result res;
+	uint32_t read_bytes;
+
+	/* The active segment is held open for writing, reuse its handle */
+	if (e->seg != kv.mf.active_seg) {
+		res = open_segment(e->seg, TEE_DATA_FLAG_ACCESS_READ |
+				   TEE_DATA_FLAG_SHARE_READ, false, &object);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	res = TEE_SeekObjectData(object, e->offset + sizeof(struct kv_record) +
+				 e->key_len, TEE_DATA_SEEK_SET);
+	if (res == TEE_SUCCESS)
+		res = TEE_ReadObjectData(object, val, e->val_len,
+					 &read_bytes);
+	if (res == TEE_SUCCESS && read_bytes != e->val_len)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+
+	if (object != kv.active)
+		TEE_CloseObject(object);
+	return res;
+}
+
+TEE_Result kv_get(const void *key, uint32_t key_len,
+		  void *val, uint32_t *val_len)
+{
+	struct kv_entry *e;
+	TEE_Result res;
+
+	if (!kv.is_open)
+		return TEE_ERROR_BAD_STATE;
+
+	e = *index_find(key, key_len);
+	if (!e)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+	if (*val_len < e->val_len) {
+		*val_len = e->val_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	res = read_value(e, val);
+	if (res == TEE_SUCCESS)
+		*val_len = e->val_len;
+	return res;
+}
+
+/*
+ * Rewrite every live record into fresh segments numbered after the active
+ * one, then switch the manifest over to them and delete the old segments.
+ * Until the manifest is written the old segments stay authoritative, so a
+ * crash or an error leaves the store as it was.
+ */
+TEE_Result kv_compact(void)
+{
+	struct kv_manifest mf = kv.mf;
+	struct kv_entry *e;
+	TEE_ObjectHandle out = TEE_HANDLE_NULL;
+	TEE_Result res;
+	uint8_t *val;
+	uint32_t out_size = 0;
+	uint32_t sz;
+	uint32_t seg;
+	size_t i;
+
+	if (!kv.is_open)
+		return TEE_ERROR_BAD_STATE;
+
+	val = TEE_Malloc(KV_MAX_VALUE_SIZE, 0);
+	if (!val)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	mf.first_seg = kv.mf.active_seg + 1;
+	mf.active_seg = mf.first_seg;
+	res = open_segment(mf.active_seg, TEE_DATA_FLAG_ACCESS_READ |
+			   TEE_DATA_FLAG_ACCESS_WRITE, true, &out);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	for (i = 0; i < KV_INDEX_BUCKETS; i++) {
+		for (e = kv.index[i]; e; e = e->next) {
+			sz = record_size(e->key_len, e->val_len);
+			if (out_size && out_size + sz > KV_SEGMENT_SIZE) {
+				TEE_CloseObject(out);
+				mf.active_seg++;
+				res = open_segment(mf.active_seg,
+						   TEE_DATA_FLAG_ACCESS_READ |
+						   TEE_DATA_FLAG_ACCESS_WRITE,
+						   true, &out);
+				if (res != TEE_SUCCESS) {
+					out = TEE_HANDLE_NULL;
+					goto err;
+				}
+				out_size = 0;
+			}
+			res = read_value(e, val);
+			if (res != TEE_SUCCESS)
+				goto err;
+			res = write_record(out, KV_REC_PUT, e->key, e->key_len,
+					   val, e->val_len);
+			if (res != TEE_SUCCESS)
+				goto err;
+			/*
+			 * The entry is relocated right away, read_value()
+			 * only needs it for the record being copied.
+			 */
+			e->seg = mf.active_seg;
+			e->offset = out_size;
+			out_size += sz;
+		}
+	}
+
+	res = write_manifest(&mf);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	TEE_CloseObject(kv.active);
+	for (seg = kv.mf.first_seg; seg <= kv.mf.active_seg; seg++)
+		delete_segment(seg);
+	kv.active = out;
+	kv.active_size = out_size;
+	kv.mf = mf;
+	kv.stats.total_bytes = kv.stats.live_bytes;
+	TEE_Free(val);
+	return TEE_SUCCESS;
+err:
+	EMSG("kv compaction failed, res=0x%08x", res);
+	if (out != TEE_HANDLE_NULL)
+		TEE_CloseObject(out);
+	for (seg = kv.mf.active_seg + 1; seg <= mf.active_seg; seg++)
+		delete_segment(seg);
+	TEE_Free(val);
+	/* Some entries already point at the new segments, rebuild the index */
+	kv_close();
+	kv_open();
+	return res;
+}
+
+void kv_get_stats(struct kv_stats *stats)
+{
+	*stats = kv.stats;
+	stats->first_seg = kv.mf.first_seg;
+	stats->active_seg = kv.mf.active_seg;
+}
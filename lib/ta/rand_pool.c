@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017, Linaro Limited
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <tee_internal_api.h>
+
+#include <rand_pool.h>
+
+static uint8_t rand_pool[RAND_POOL_SIZE];
+/* Offset of the first unused byte, the pool starts out empty */
+static uint32_t rand_pool_pos = RAND_POOL_SIZE;
+
+void rand_pool_get(void *buf, uint32_t len)
+{
+	/* Requests as large as the pool gain nothing from it */
+	if (len >= RAND_POOL_SIZE) {
+		TEE_GenerateRandom(buf, len);
+		return;
+	}
+
+	if (len > RAND_POOL_SIZE - rand_pool_pos) {
+		TEE_GenerateRandom(rand_pool, RAND_POOL_SIZE);
+		rand_pool_pos = 0;
+	}
+
+	TEE_MemMove(buf, rand_pool + rand_pool_pos, len);
+	TEE_MemFill(rand_pool + rand_pool_pos, 0, len);
+	rand_pool_pos += len;
+}
+
+void rand_pool_wipe(void)
+{
+	TEE_MemFill(rand_pool, 0, RAND_POOL_SIZE);
+	rand_pool_pos = RAND_POOL_SIZE;
+}
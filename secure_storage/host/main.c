@@ -168,8 +168,268 @@ TEEC_Result delete_secure_object(struct test_ctx *ctx, char *id)
 	return res;
 }
 
+TEEC_Result get_secure_object_size(struct test_ctx *ctx, char *id,
+			size_t *size)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_GET_SIZE,
+				 &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+		*size = op.params[1].value.a;
+		break;
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command GET_SIZE failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+/*
+ * Read data_len bytes at offset from an object. On return data_len holds
+ * the number of bytes read, which is short only at the end of the object.
+ */
+TEEC_Result read_secure_object_range(struct test_ctx *ctx, char *id,
+			size_t offset, char *data, size_t *data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = *data_len;
+
+	op.params[2].value.a = offset;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_READ_RANGE,
+				 &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+		*data_len = op.params[1].tmpref.size;
+		break;
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command READ_RANGE failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result write_secure_object_range(struct test_ctx *ctx, char *id,
+			size_t offset, char *data, size_t data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	size_t id_len = strlen(id);
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = id;
+	op.params[0].tmpref.size = id_len;
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = data_len;
+
+	op.params[2].value.a = offset;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_WRITE_RANGE,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command WRITE_RANGE failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+/*
+ * Stream a file into a secure object through a fixed size buffer, so
+ * neither side has to hold the whole object in memory.
+ */
+TEEC_Result stream_file_to_secure_object(struct test_ctx *ctx, char *id,
+			FILE *fp, char *buf, size_t buf_len)
+{
+	TEEC_Result res = TEEC_SUCCESS;
+	size_t offset = 0;
+	size_t n;
+
+	while ((n = fread(buf, 1, buf_len, fp)) > 0) {
+		res = write_secure_object_range(ctx, id, offset, buf, n);
+		if (res != TEEC_SUCCESS)
+			break;
+		offset += n;
+	}
+
+	return res;
+}
+
+/*
+ * Stream a secure object out to a file through a fixed size buffer.
+ */
+TEEC_Result stream_secure_object_to_file(struct test_ctx *ctx, char *id,
+			FILE *fp, char *buf, size_t buf_len)
+{
+	TEEC_Result res;
+	size_t offset = 0;
+	size_t n;
+
+	do {
+		n = buf_len;
+		res = read_secure_object_range(ctx, id, offset, buf, &n);
+		if (res != TEEC_SUCCESS)
+			break;
+		if (fwrite(buf, 1, n, fp) != n)
+			return TEEC_ERROR_GENERIC;
+		offset += n;
+	} while (n == buf_len);
+
+	return res;
+}
+
+TEEC_Result kv_put_secure_value(struct test_ctx *ctx, char *key,
+			char *data, size_t data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = key;
+	op.params[0].tmpref.size = strlen(key);
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = data_len;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_KV_PUT,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command KV_PUT failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+TEEC_Result kv_get_secure_value(struct test_ctx *ctx, char *key,
+			char *data, size_t data_len)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = key;
+	op.params[0].tmpref.size = strlen(key);
+
+	op.params[1].tmpref.buffer = data;
+	op.params[1].tmpref.size = data_len;
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_KV_GET,
+				 &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+	case TEEC_ERROR_SHORT_BUFFER:
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command KV_GET failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result kv_delete_secure_value(struct test_ctx *ctx, char *key)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
+
+	op.params[0].tmpref.buffer = key;
+	op.params[0].tmpref.size = strlen(key);
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_KV_DELETE,
+				 &op, &origin);
+	switch (res) {
+	case TEEC_SUCCESS:
+	case TEEC_ERROR_ITEM_NOT_FOUND:
+		break;
+	default:
+		printf("Command KV_DELETE failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+}
+
+TEEC_Result kv_compact_secure_store(struct test_ctx *ctx, uint32_t *before,
+			uint32_t *after)
+{
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_OUTPUT,
+					 TEEC_VALUE_OUTPUT,
+					 TEEC_NONE, TEEC_NONE);
+
+	res = TEEC_InvokeCommand(&ctx->sess,
+				 TA_SECURE_STORAGE_CMD_KV_COMPACT,
+				 &op, &origin);
+	if (res != TEEC_SUCCESS)
+		printf("Command KV_COMPACT failed: 0x%x / %u\n", res, origin);
+	*before = op.params[0].value.a;
+	*after = op.params[0].value.b;
+
+	return res;
+}
+
 #define TEST_OBJECT_SIZE	7000
 #define NUM_TESTS           100
+#define LARGE_OBJECT_SIZE	(256 * 1024)
+#define RANGE_SIZE		1024
+#define STREAM_BUFFER_SIZE	(16 * 1024)
 
 double avg(double* arr, size_t total_size)
 {
@@ -271,6 +531,122 @@ int main(void)
         t_delete_ns[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
     }
 
+    // Key/Value Store Benchmarking
+	printf("\nCSG-CSEM: Key/Value Store Benchmarking \"%s\"\n", obj1_id);
+
+    double t_create_kv[NUM_TESTS], t_read_kv[NUM_TESTS];
+    double t_delete_kv[NUM_TESTS], t_compact;
+    uint32_t kv_before, kv_after;
+    for (u_int32_t i = 0; i < NUM_TESTS; ++i) {
+        gettimeofday(&t1, NULL);
+        memset(obj1_data, 0xA1, sizeof(obj1_data));
+        res = kv_put_secure_value(&ctx, obj1_id,
+                      obj1_data, sizeof(obj1_data));
+        gettimeofday(&t2, NULL);
+        if (res != TEEC_SUCCESS)
+            errx(1, "Failed to put a value in the kv store");
+        t_create_kv[i] = (t2.tv_sec - t1.tv_sec) * 1000.0;
+        t_create_kv[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+        // Read
+        gettimeofday(&t1, NULL);
+        res = kv_get_secure_value(&ctx, obj1_id,
+                     read_data, sizeof(read_data));
+        gettimeofday(&t2, NULL);
+        t_read_kv[i] = (t2.tv_sec - t1.tv_sec) * 1000.0;
+        t_read_kv[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
+        if (res != TEEC_SUCCESS)
+            errx(1, "Failed to get a value from the kv store");
+        if (memcmp(obj1_data, read_data, sizeof(obj1_data)))
+            errx(1, "Unexpected content found in the kv store");
+
+        // Delete
+        gettimeofday(&t1, NULL);
+        res = kv_delete_secure_value(&ctx, obj1_id);
+        gettimeofday(&t2, NULL);
+        t_delete_kv[i] = (t2.tv_sec - t1.tv_sec) * 1000.0;
+        t_delete_kv[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
+        if (res != TEEC_SUCCESS)
+            errx(1, "Failed to delete the value: 0x%x", res);
+    }
+
+    // Every record above is dead by now, compaction drops all of them
+    gettimeofday(&t1, NULL);
+    res = kv_compact_secure_store(&ctx, &kv_before, &kv_after);
+    gettimeofday(&t2, NULL);
+    if (res != TEEC_SUCCESS)
+        errx(1, "Failed to compact the kv store: 0x%x", res);
+    t_compact = (t2.tv_sec - t1.tv_sec) * 1000.0;
+    t_compact += (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    // Ranged Access Benchmarking
+	printf("\nCSG-CSEM: Ranged Access Benchmarking \"%s\"\n", obj2_id);
+
+    double t_whole[NUM_TESTS], t_range[NUM_TESTS];
+    char *large_data = malloc(LARGE_OBJECT_SIZE);
+    char *stream_buf = malloc(STREAM_BUFFER_SIZE);
+    size_t obj_size = 0;
+    FILE *stream_fp = tmpfile();
+    if (!large_data || !stream_buf || !stream_fp)
+        errx(1, "Out of memory");
+    for (size_t off = 0; off < LARGE_OBJECT_SIZE; off += STREAM_BUFFER_SIZE)
+        memset(large_data + off, off / STREAM_BUFFER_SIZE, STREAM_BUFFER_SIZE);
+    if (fwrite(large_data, 1, LARGE_OBJECT_SIZE, stream_fp) !=
+            LARGE_OBJECT_SIZE)
+        errx(1, "Failed to write the object file");
+    rewind(stream_fp);
+    res = stream_file_to_secure_object(&ctx, obj2_id, stream_fp, stream_buf,
+                      STREAM_BUFFER_SIZE);
+    if (res != TEEC_SUCCESS)
+        errx(1, "Failed to stream an object into the secure storage");
+    res = get_secure_object_size(&ctx, obj2_id, &obj_size);
+    if (res != TEEC_SUCCESS || obj_size != LARGE_OBJECT_SIZE)
+        errx(1, "Unexpected object size %zu", obj_size);
+
+    for (u_int32_t i = 0; i < NUM_TESTS; ++i) {
+        size_t off = (rand() % (LARGE_OBJECT_SIZE / RANGE_SIZE)) * RANGE_SIZE;
+        size_t len = RANGE_SIZE;
+
+        // Whole object read to get at one record
+        gettimeofday(&t1, NULL);
+        res = read_secure_object(&ctx, obj2_id, large_data,
+                     LARGE_OBJECT_SIZE);
+        gettimeofday(&t2, NULL);
+        if (res != TEEC_SUCCESS)
+            errx(1, "Failed to read an object from the secure storage");
+        t_whole[i] = (t2.tv_sec - t1.tv_sec) * 1000.0;
+        t_whole[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+        // Ranged read of the same record
+        gettimeofday(&t1, NULL);
+        res = read_secure_object_range(&ctx, obj2_id, off, read_data, &len);
+        gettimeofday(&t2, NULL);
+        if (res != TEEC_SUCCESS || len != RANGE_SIZE)
+            errx(1, "Failed to read a range from the secure storage");
+        if (memcmp(large_data + off, read_data, RANGE_SIZE))
+            errx(1, "Unexpected content found in secure storage");
+        t_range[i] = (t2.tv_sec - t1.tv_sec) * 1000.0;
+        t_range[i] += (t2.tv_usec - t1.tv_usec) / 1000.0;
+    }
+
+    // Stream the object back out and check it against the file streamed in
+    rewind(stream_fp);
+    res = stream_secure_object_to_file(&ctx, obj2_id, stream_fp, stream_buf,
+                      STREAM_BUFFER_SIZE);
+    if (res != TEEC_SUCCESS)
+        errx(1, "Failed to stream an object out of the secure storage");
+    rewind(stream_fp);
+    for (size_t off = 0; off < LARGE_OBJECT_SIZE; off += STREAM_BUFFER_SIZE) {
+        if (fread(stream_buf, 1, STREAM_BUFFER_SIZE, stream_fp) !=
+                STREAM_BUFFER_SIZE ||
+                memcmp(stream_buf, large_data + off, STREAM_BUFFER_SIZE))
+            errx(1, "Unexpected content streamed out of secure storage");
+    }
+    fclose(stream_fp);
+    delete_secure_object(&ctx, obj2_id);
+    free(large_data);
+    free(stream_buf);
+
     // Print Times
     printf("\nSTORAGE BENCHMARKING (avg (ms), stdev): SECURE / NSECURE\n");
     printf("Create: \t %f, %f \t %f, %f \n",
@@ -288,6 +664,26 @@ int main(void)
             stdev(t_delete, sizeof(t_delete)),
             avg(t_delete_ns, sizeof(t_delete_ns)),
             stdev(t_delete_ns, sizeof(t_delete_ns)));
+    printf("\nKV STORE (avg (ms), stdev)\n");
+    printf("Put: \t\t %f, %f \n",
+            avg(t_create_kv, sizeof(t_create_kv)),
+            stdev(t_create_kv, sizeof(t_create_kv)));
+    printf("Get: \t\t %f, %f \n",
+            avg(t_read_kv, sizeof(t_read_kv)),
+            stdev(t_read_kv, sizeof(t_read_kv)));
+    printf("Delete: \t %f, %f \n",
+            avg(t_delete_kv, sizeof(t_delete_kv)),
+            stdev(t_delete_kv, sizeof(t_delete_kv)));
+    printf("Compact: \t %f (%u B -> %u B)\n", t_compact, kv_before,
+            kv_after);
+    printf("\nRANGED ACCESS (avg (ms), stdev): %i B out of a %i B object\n",
+            RANGE_SIZE, LARGE_OBJECT_SIZE);
+    printf("Whole object: \t %f, %f \n",
+            avg(t_whole, sizeof(t_whole)),
+            stdev(t_whole, sizeof(t_whole)));
+    printf("Range: \t\t %f, %f \n",
+            avg(t_range, sizeof(t_range)),
+            stdev(t_range, sizeof(t_range)));
     printf("---------------------------------------------------------\n");
 
 	printf("\nWe're done, close and release TEE resources\n");
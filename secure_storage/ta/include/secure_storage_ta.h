@@ -58,4 +58,77 @@
  */
 #define TA_SECURE_STORAGE_CMD_DELETE		2
 
+/*
+ * TA_SECURE_STORAGE_CMD_GET_SIZE - Get the data size of a persistent object
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (value) a: object data size in bytes, b: unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_GET_SIZE		3
+
+/*
+ * TA_SECURE_STORAGE_CMD_READ_RANGE - Read part of a persistent object
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (memref) Raw data read from the object, updated with the number
+ *	    of bytes read which is short only at the end of the object
+ * param[2] (value) a: offset in the object data, b: unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_READ_RANGE	4
+
+/*
+ * TA_SECURE_STORAGE_CMD_WRITE_RANGE - Write part of a persistent object,
+ * creating the object if it does not exist yet
+ * param[0] (memref) ID used the identify the persistent object
+ * param[1] (memref) Raw data to be written at the offset
+ * param[2] (value) a: offset in the object data, b: unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_WRITE_RANGE	5
+
+/*
+ * The TA_SECURE_STORAGE_CMD_KV_xxx commands store values as records of the
+ * log-structured store in kv_store.c instead of one persistent object per
+ * ID. Keys are at most 64 bytes and values at most 8 KiB.
+ */
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_PUT - Store a value in the kv store
+ * param[0] (memref) key
+ * param[1] (memref) value
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_PUT		6
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_GET - Read a value from the kv store
+ * param[0] (memref) key
+ * param[1] (memref) value, on TEE_ERROR_SHORT_BUFFER the size is updated
+ *	    with the size of the value
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_GET		7
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_DELETE - Delete a value from the kv store
+ * param[0] (memref) key
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_DELETE		8
+
+/*
+ * TA_SECURE_STORAGE_CMD_KV_COMPACT - Rewrite the live records of the kv
+ * store into fresh segments and drop the old ones
+ * param[0] (value) a: store bytes before, b: store bytes after compaction
+ * param[1] (value) a: number of live keys, b: number of segments in use
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SECURE_STORAGE_CMD_KV_COMPACT	9
+
 #endif /* __SECURE_STORAGE_H__ */
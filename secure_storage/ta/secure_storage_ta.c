@@ -25,6 +25,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <kv_store.h>
 #include <secure_storage_ta.h>
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
@@ -215,15 +216,267 @@ exit:
 	return res;
 }
 
+/*
+ * Open the object named by id_param for ranged access, creating it when
+ * create is set. The ID is copied into secure memory first, as the other
+ * commands do.
+ */
+static TEE_Result open_object(TEE_Param *id_param, uint32_t flags,
+			      bool create, TEE_ObjectHandle *object)
+{
+	TEE_Result res;
+	char *obj_id;
+	size_t obj_id_sz;
+
+	obj_id_sz = id_param->memref.size;
+	obj_id = TEE_Malloc(obj_id_sz, 0);
+	if (!obj_id)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	TEE_MemMove(obj_id, id_param->memref.buffer, obj_id_sz);
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					obj_id, obj_id_sz, flags, object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND && create)
+		res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+						obj_id, obj_id_sz,
+						flags |
+						TEE_DATA_FLAG_ACCESS_WRITE_META,
+						TEE_HANDLE_NULL,
+						NULL, 0, object);
+	if (res != TEE_SUCCESS)
+		EMSG("Failed to open persistent object, res=0x%08x", res);
+
+	TEE_Free(obj_id);
+	return res;
+}
+
+static TEE_Result get_object_size(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_ObjectInfo object_info;
+	TEE_Result res;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = open_object(&params[0], TEE_DATA_FLAG_ACCESS_READ |
+			  TEE_DATA_FLAG_SHARE_READ, false, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_GetObjectInfo1(object, &object_info);
+	if (res == TEE_SUCCESS)
+		params[1].value.a = object_info.dataSize;
+
+	TEE_CloseObject(object);
+	return res;
+}
+
+static TEE_Result read_object_range(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_Result res;
+	uint32_t read_bytes;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = open_object(&params[0], TEE_DATA_FLAG_ACCESS_READ |
+			  TEE_DATA_FLAG_SHARE_READ, false, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/*
+	 * Only the requested window is read, the object is never loaded
+	 * as a whole.
+	 */
+	res = TEE_SeekObjectData(object, params[2].value.a, TEE_DATA_SEEK_SET);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SeekObjectData failed 0x%08x", res);
+		goto exit;
+	}
+
+	res = TEE_ReadObjectData(object, params[1].memref.buffer,
+				 params[1].memref.size, &read_bytes);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_ReadObjectData failed 0x%08x", res);
+		goto exit;
+	}
+
+	/* Return the number of byte effectively filled */
+	params[1].memref.size = read_bytes;
+exit:
+	TEE_CloseObject(object);
+	return res;
+}
+
+static TEE_Result write_object_range(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_NONE);
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = open_object(&params[0], TEE_DATA_FLAG_ACCESS_READ |
+			  TEE_DATA_FLAG_ACCESS_WRITE, true, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Seeking past the end is allowed, the gap reads back as zeroes */
+	res = TEE_SeekObjectData(object, params[2].value.a, TEE_DATA_SEEK_SET);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_SeekObjectData failed 0x%08x", res);
+		goto exit;
+	}
+
+	res = TEE_WriteObjectData(object, params[1].memref.buffer,
+				  params[1].memref.size);
+	if (res != TEE_SUCCESS)
+		EMSG("TEE_WriteObjectData failed 0x%08x", res);
+exit:
+	TEE_CloseObject(object);
+	return res;
+}
+
+/*
+ * The kv store must only see TA private memory: a key or value still in
+ * shared memory could change between the checksum and the write, or
+ * between the index lookup and the update.
+ */
+static void *memref_dup(TEE_Param *param)
+{
+	void *buf;
+
+	buf = TEE_Malloc(param->memref.size, 0);
+	if (buf)
+		TEE_MemMove(buf, param->memref.buffer, param->memref.size);
+	return buf;
+}
+
+static TEE_Result kv_put_value(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_Result res;
+	void *key;
+	void *val;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	key = memref_dup(&params[0]);
+	val = memref_dup(&params[1]);
+	if (key && val)
+		res = kv_put(key, params[0].memref.size,
+			     val, params[1].memref.size);
+	else
+		res = TEE_ERROR_OUT_OF_MEMORY;
+	TEE_Free(key);
+	TEE_Free(val);
+	return res;
+}
+
+static TEE_Result kv_get_value(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_Result res;
+	uint32_t val_len;
+	void *key;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	key = memref_dup(&params[0]);
+	if (!key)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	val_len = params[1].memref.size;
+	res = kv_get(key, params[0].memref.size,
+		     params[1].memref.buffer, &val_len);
+	if (res == TEE_SUCCESS || res == TEE_ERROR_SHORT_BUFFER)
+		params[1].memref.size = val_len;
+	TEE_Free(key);
+	return res;
+}
+
+static TEE_Result kv_delete_value(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	TEE_Result res;
+	void *key;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	key = memref_dup(&params[0]);
+	if (!key)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	res = kv_delete(key, params[0].memref.size);
+	TEE_Free(key);
+	return res;
+}
+
+static TEE_Result kv_compact_store(uint32_t param_types, TEE_Param params[4])
+{
+	const uint32_t exp_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_NONE,
+				TEE_PARAM_TYPE_NONE);
+	struct kv_stats stats;
+	TEE_Result res;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	kv_get_stats(&stats);
+	params[0].value.a = stats.total_bytes;
+	res = kv_compact();
+	kv_get_stats(&stats);
+	params[0].value.b = stats.total_bytes;
+	params[1].value.a = stats.num_keys;
+	params[1].value.b = stats.active_seg - stats.first_seg + 1;
+	return res;
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
-	/* Nothing to do */
-	return TEE_SUCCESS;
+	/* Rebuild the kv store index from its segments */
+	return kv_open();
 }
 
 void TA_DestroyEntryPoint(void)
 {
-	/* Nothing to do */
+	kv_close();
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t __unused param_types,
@@ -251,6 +504,20 @@ TEE_Result TA_InvokeCommandEntryPoint(void __unused *session,
 		return read_raw_object(param_types, params);
 	case TA_SECURE_STORAGE_CMD_DELETE:
 		return delete_object(param_types, params);
+	case TA_SECURE_STORAGE_CMD_GET_SIZE:
+		return get_object_size(param_types, params);
+	case TA_SECURE_STORAGE_CMD_READ_RANGE:
+		return read_object_range(param_types, params);
+	case TA_SECURE_STORAGE_CMD_WRITE_RANGE:
+		return write_object_range(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_PUT:
+		return kv_put_value(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_GET:
+		return kv_get_value(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_DELETE:
+		return kv_delete_value(param_types, params);
+	case TA_SECURE_STORAGE_CMD_KV_COMPACT:
+		return kv_compact_store(param_types, params);
 	default:
 		EMSG("Command ID 0x%x is not supported", command);
 		return TEE_ERROR_NOT_SUPPORTED;
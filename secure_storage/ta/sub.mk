@@ -1,2 +1,4 @@
 global-incdirs-y += include
+global-incdirs-y += ../../lib/ta/include
 srcs-y += secure_storage_ta.c
+srcs-y += ../../lib/ta/kv_store.c
@@ -15,6 +15,8 @@
 
 #define OP_BENCHMARK        0
 #define TPUT_BENCHMARK      1
+#define ECHO_BENCHMARK      2
+#define ECHO_TIMEOUT        2000
 
 struct ta_ctx {
     TEEC_Context ctx;
@@ -26,8 +28,8 @@ struct socket_handle {
     char *addr;
     uint16_t tcp_port;
     uint16_t udp_port;
-    char *buf; // This buffer is used to store the TEE Socket Handle
-    size_t buffer_size;
+    uint32_t id; // Index of the socket in the TA session table
+    uint32_t error; // Protocol error of the last open
 };
 
 struct benchmark_times {
@@ -113,26 +115,24 @@ static TEEC_Result tee_socket_tcp_open(struct ta_ctx *t_ctx,
 {
     TEEC_Result res;
     TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
-    
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
     op.paramTypes = TEEC_PARAM_TYPES(
             TEEC_VALUE_INPUT,
             TEEC_MEMREF_TEMP_INPUT,
-            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT,
             TEEC_VALUE_OUTPUT);
 
     op.params[0].value.a = handle->ip_vers;
     op.params[0].value.b = handle->tcp_port;
     op.params[1].tmpref.buffer = (void *) handle->addr;
     op.params[1].tmpref.size = strlen(handle->addr) + 1;
-    op.params[2].tmpref.buffer = handle->buf;
-    op.params[2].tmpref.size = handle->buffer_size;
 
-    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, ret_orig);
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, &ret_orig);
 
-    handle->buffer_size = op.params[2].tmpref.size;
-    *error = op.params[3].value.a;
+    handle->id = op.params[2].value.a;
+    handle->error = op.params[3].value.a;
     return res;
 }
 
@@ -141,27 +141,25 @@ static TEEC_Result tee_socket_udp_open(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
+    uint32_t ret_orig;
 
+	memset(&op, 0, sizeof(op));
 	op.params[0].value.a = handle->ip_vers;
 	op.params[0].value.b = handle->udp_port;
 	op.params[1].tmpref.buffer = (void *) handle->addr;
 	op.params[1].tmpref.size = strlen(handle->addr) + 1;
-	op.params[2].tmpref.buffer = handle->buf;
-	op.params[2].tmpref.size = handle->buffer_size;
 
 	op.paramTypes = TEEC_PARAM_TYPES(
                         TEEC_VALUE_INPUT,
 					    TEEC_MEMREF_TEMP_INPUT,
-					    TEEC_MEMREF_TEMP_OUTPUT,
+					    TEEC_VALUE_OUTPUT,
 					    TEEC_VALUE_OUTPUT);
 
 	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_UDP_OPEN,
-				 &op, ret_orig);
+				 &op, &ret_orig);
 
-	handle->buffer_size = op.params[2].tmpref.size;
-	*error = op.params[3].value.a;
+	handle->id = op.params[2].value.a;
+	handle->error = op.params[3].value.a;
 	return res;
 }
 
@@ -171,69 +169,109 @@ static TEEC_Result tee_socket_send(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
     uint32_t timeout = 1000;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 	op.params[1].tmpref.buffer = (void *)data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_INPUT,
 					 TEEC_VALUE_INOUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, &ret_orig);
 
 	*dlen = op.params[2].value.b;
 	return res;
 }
 
-/*
-static TEEC_Result tee_socket_recv(TEEC_Session *session,
+static TEEC_Result tee_socket_recv(struct ta_ctx *t_ctx,
 			      struct socket_handle *handle,
-			      void *data, size_t *dlen,
-			      uint32_t timeout, uint32_t *ret_orig)
+			      void *data, size_t *dlen, uint32_t timeout)
 {
-	TEEC_Result res = TEEC_ERROR_GENERIC;
-	TEEC_Operation op = TEEC_OPERATION_INITIALIZER;
+	TEEC_Result res;
+	TEEC_Operation op;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->blen;
-	op.params[1].tmpref.buffer = (void *)data;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
+	op.params[1].tmpref.buffer = data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_OUTPUT,
 					 TEEC_VALUE_INPUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(session, TA_SOCKET_CMD_RECV, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_RECV, &op, &ret_orig);
 
 	*dlen = op.params[1].tmpref.size;
 	return res;
 }
 
-*/
+/*
+ * Wait for the echo of len bytes. A TCP echo may come back in several
+ * pieces, a UDP echo is one datagram.
+ */
+static TEEC_Result tee_socket_recv_echo(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, char *buf, size_t len, int udp)
+{
+    TEEC_Result res;
+    size_t got = 0;
+    size_t sz;
+
+    do
+    {
+        sz = len - got;
+        res = tee_socket_recv(t_ctx, handle, buf + got, &sz, ECHO_TIMEOUT);
+        if (res != TEEC_SUCCESS)
+            return res;
+        if (!sz)
+            return TEEC_ERROR_COMMUNICATION;
+        got += sz;
+    } while (!udp && got < len);
+    return TEEC_SUCCESS;
+}
 
 static TEEC_Result tee_socket_close(struct ta_ctx *t_ctx,
         struct socket_handle *handle)
 {
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
 
-	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, ret_orig);
+	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, &ret_orig);
+}
+
+/*
+ * REE counterpart of tee_socket_recv_echo()
+ */
+int ree_recv_echo(int sock, char *buf, size_t len, int udp)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    do
+    {
+        n = recv(sock, buf + got, len - got, 0);
+        if (n <= 0)
+            return 1;
+        got += n;
+    } while (!udp && got < len);
+    return 0;
 }
 
 int ree_tcp_socket_client(struct socket_handle *s_handle,
-        struct benchmark_times *times, char *data, int iter)
+        struct benchmark_times *times, char *data, int iter,
+        int benchmark_type)
 {
     int sock = 0;
     struct timeval t_ini, t_end, t_diff;
@@ -241,6 +279,7 @@ int ree_tcp_socket_client(struct socket_handle *s_handle,
     struct sockaddr_in serv_addr;
     int opt = 1;
     int addrlen = sizeof(address);
+    char echo[strlen(data)];
 
     gettimeofday(&t_ini, NULL);
     // Open + Connect
@@ -272,7 +311,15 @@ int ree_tcp_socket_client(struct socket_handle *s_handle,
     gettimeofday(&t_ini, NULL);
 
     for (unsigned int j = 0; j < times->num_send; ++j)
+    {
         send(sock, data, strlen(data), 0);
+        if (benchmark_type == ECHO_BENCHMARK &&
+                ree_recv_echo(sock, echo, strlen(data), 0))
+        {
+            printf("Error receiving the TCP echo!\n");
+            return 1;
+        }
+    }
 
     gettimeofday(&t_end, NULL);
     if (timeval_subtract(&t_diff, &t_end, &t_ini))
@@ -297,9 +344,12 @@ int ree_tcp_socket_client(struct socket_handle *s_handle,
 }
 
 int ree_udp_socket_client(struct socket_handle *s_handle,
-        struct benchmark_times *times, char *data, int iter)
+        struct benchmark_times *times, char *data, int iter,
+        int benchmark_type)
 {    
     int sockfd, n; 
+    char echo[strlen(data)];
+    struct timeval recv_timeout = { .tv_sec = ECHO_TIMEOUT / 1000 };
     struct timeval t_ini, t_end, t_diff;
     struct sockaddr_in servaddr; 
       
@@ -327,9 +377,20 @@ int ree_udp_socket_client(struct socket_handle *s_handle,
     // Send
     gettimeofday(&t_ini, NULL);
 
+    // A lost datagram must not block the echo benchmark forever
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout,
+            sizeof(recv_timeout));
     for (unsigned int j = 0; j < times->num_send; ++j)
+    {
         sendto(sockfd, data, strlen(data), 0, (struct sockaddr*) NULL,
                 sizeof(servaddr)); 
+        if (benchmark_type == ECHO_BENCHMARK &&
+                ree_recv_echo(sockfd, echo, strlen(data), 1))
+        {
+            printf("Error receiving the UDP echo!\n");
+            return 1;
+        }
+    }
 
     gettimeofday(&t_end, NULL);
     if (timeval_subtract(&t_diff, &t_end, &t_ini))
@@ -369,7 +430,8 @@ int ree_benchmark(struct benchmark_times *tcp_times,
     for (i = 0; i < tcp_times->num_tests; i++)
     {
         printf("Starting REE TCP test #%u!\n", i);
-        if (ree_tcp_socket_client(s_handle, tcp_times, data, i) != 0)
+        if (ree_tcp_socket_client(s_handle, tcp_times, data, i,
+                    benchmark_type) != 0)
         {
             printf("Error running REE TCP test!\n");
             return 1;
@@ -379,7 +441,8 @@ int ree_benchmark(struct benchmark_times *tcp_times,
     for (i = 0; i < udp_times->num_tests; i++)
     {
         printf("Starting REE UDP test #%u!\n", i);
-        if (ree_udp_socket_client(s_handle, udp_times, data, i) != 0)
+        if (ree_udp_socket_client(s_handle, udp_times, data, i,
+                    benchmark_type) != 0)
         {
             printf("Error running REE UDP test!\n");
             return 1;
@@ -399,13 +462,12 @@ int tee_benchmark(struct ta_ctx *t_ctx,
     memset((void *) data, 'A', 1 * 1024 * sizeof(char));
     data[1 * 1024] = "\0";
     size_t data_sz = strlen(data);
+    char *echo = (char *) malloc(data_sz);
     unsigned int i;
 
     for (i = 0; i < tcp_times->num_tests; i++)
     {
         printf("Starting TEE TCP test #%u!\n", i);
-        memset((void *) s_handle->buf, '\0', 1024 * sizeof(char));
-        s_handle->buffer_size = 1024;
 
         if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
         {
@@ -437,6 +499,13 @@ int tee_benchmark(struct ta_ctx *t_ctx,
                 printf("Error sending data from the TEE!\n");
                 return 1;
             }
+            if (benchmark_type == ECHO_BENCHMARK &&
+                tee_socket_recv_echo(t_ctx, s_handle, echo, data_sz, 0) !=
+                TEEC_SUCCESS)
+            {
+                printf("Error receiving the echo in the TEE!\n");
+                return 1;
+            }
         }
 
         gettimeofday(&t_end, NULL);
@@ -474,8 +543,6 @@ int tee_benchmark(struct ta_ctx *t_ctx,
     for (i = 0; i < tcp_times->num_tests; i++)
     {
         printf("Starting TEE UDP test #%u!\n", i);
-        memset((void *) s_handle->buf, '\0', 1024 * sizeof(char));
-        s_handle->buffer_size = 1024;
         //data_sz = strlen(data);
 
         if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
@@ -508,6 +575,13 @@ int tee_benchmark(struct ta_ctx *t_ctx,
                 printf("Error sending data from the TEE!\n");
                 return 1;
             }
+            if (benchmark_type == ECHO_BENCHMARK &&
+                tee_socket_recv_echo(t_ctx, s_handle, echo, data_sz, 1) !=
+                TEEC_SUCCESS)
+            {
+                printf("Error receiving the echo in the TEE!\n");
+                return 1;
+            }
         }
 
         gettimeofday(&t_end, NULL);
@@ -542,23 +616,25 @@ int tee_benchmark(struct ta_ctx *t_ctx,
 
     printf("Finished TEE UDP Benchmark!\n");
 
+    free(echo);
     return 0;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     TEEC_Result res;
     struct ta_ctx t_ctx;
-    char *buf;
-    buf = (char *) calloc(1024, sizeof(char));
+    // ./optee_socket_benchmark echo: each send waits for its echo
+    int benchmark_type = OP_BENCHMARK;
+
+    if (argc == 2 && !strcmp(argv[1], "echo"))
+        benchmark_type = ECHO_BENCHMARK;
 
     struct socket_handle s_handle = {
         .ip_vers = 0,
         .addr = "10.0.2.2", //"192.168.1.34",
         .tcp_port = 9999,
-        .udp_port = 9998,
-        .buf = buf,
-        .buffer_size = 1024
+        .udp_port = 9998
     };
 
     // Different operations benchmark
@@ -580,7 +656,7 @@ int main()
         .num_send = num_send
     };
     if (tee_benchmark(&t_ctx, &tee_tcp_times, &tee_udp_times, &s_handle,
-                      OP_BENCHMARK) != 0)
+                      benchmark_type) != 0)
     {
         printf("Error running the TEE benchmark! Exitting...\n");
         return 1;
@@ -602,14 +678,15 @@ int main()
         .num_send = num_send
     };
     if (ree_benchmark(&ree_tcp_times, &ree_udp_times, &s_handle,
-                      OP_BENCHMARK) != 0)
+                      benchmark_type) != 0)
     {
         printf("Error running the REE benchmark! Exitting...\n");
         return 1;
     }
     FILE *log_file;
     log_file = fopen("optee_socket_benchmark.log", "w+");
-    fprintf(log_file, "TEE (TCP/UDP) Times: Open/Send/Close -\n");
+    fprintf(log_file, "TEE (TCP/UDP) Times: Open/%s/Close -\n",
+            benchmark_type == ECHO_BENCHMARK ? "Send+Echo" : "Send");
     for (unsigned int i = 0; i < num_tests; i++)
     {
         fprintf(log_file, "%f,%f,%f\t%f,%f,%f\n",
@@ -620,7 +697,8 @@ int main()
             tee_udp_times.send_times[i],
             tee_udp_times.close_times[i]);
     }
-    fprintf(log_file, "REE (TCP/UDP) Times: Open/Send/Close -\n");
+    fprintf(log_file, "REE (TCP/UDP) Times: Open/%s/Close -\n",
+            benchmark_type == ECHO_BENCHMARK ? "Send+Echo" : "Send");
     for (unsigned int i = 0; i < num_tests; i++)
     {
         fprintf(log_file, "%f,%f,%f %f,%f,%f\n",
@@ -632,7 +710,8 @@ int main()
             ree_udp_times.close_times[i]);
     }
     fclose(log_file);
-    printf("TEE Average (TCP/UDP) Times: Open/Send/Close -\n");
+    printf("TEE Average (TCP/UDP) Times: Open/%s/Close -\n",
+            benchmark_type == ECHO_BENCHMARK ? "Send+Echo" : "Send");
     printf("%f,%f\t%f,%f\t%f,%f\n",
             avg(tee_tcp_times.open_times, num_tests),
             stdev(tee_tcp_times.open_times, num_tests),
@@ -647,7 +726,8 @@ int main()
             stdev(tee_udp_times.send_times, num_tests),
             avg(tee_udp_times.close_times, num_tests),
             stdev(tee_udp_times.close_times, num_tests));
-    printf("REE Average (TCP/UDP) Times: Open/Send/Close -\n");
+    printf("REE Average (TCP/UDP) Times: Open/%s/Close -\n",
+            benchmark_type == ECHO_BENCHMARK ? "Send+Echo" : "Send");
     printf("%f,%f\t%f,%f\t%f,%f\n",
             avg(ree_tcp_times.open_times, num_tests),
             stdev(ree_tcp_times.open_times, num_tests),
@@ -32,23 +32,30 @@
 			 0xa9, 0x37, 0xd0, 0xbf, 0x9c, 0x45, 0xc6, 0x1d } }
 
 /*
- * Opens a TCP socket and returns an opaque handle
+ * Sockets are kept in a table of the TA session, the client refers to them
+ * by their index in the table. A session holds at most
+ * TA_SOCKET_MAX_HANDLES open sockets.
+ */
+#define TA_SOCKET_MAX_HANDLES	16
+
+/*
+ * Opens a TCP socket and returns its handle
  *
  * [in]     params[0].value.a	ipVersion
  * [in]     params[0].value.b	server port
  * [in]     params[1].memref	server address
- * [out]    params[2].memref	handle
+ * [out]    params[2].value.a	handle
  * [out]    params[3].value.a	protocol error
  */
 #define TA_SOCKET_CMD_TCP_OPEN	0
 
 /*
- * Opens a UDP socket and returns an opaque handle
+ * Opens a UDP socket and returns its handle
  *
  * [in]     params[0].value.a	ipVersion
  * [in]     params[0].value.b	server port
  * [in]     params[1].memref	server address
- * [out]    params[2].memref	handle
+ * [out]    params[2].value.a	handle
  * [out]    params[3].value.a	protocol error
  */
 #define TA_SOCKET_CMD_UDP_OPEN	1
@@ -56,14 +63,14 @@
 /*
  * Closes a socket
  *
- * [in]     params[0].memref	handle
+ * [in]     params[0].value.a	handle
  */
 #define TA_SOCKET_CMD_CLOSE	2
 
 /*
  * Send data on socket
  *
- * [in]     params[0].memref	handle
+ * [in]     params[0].value.a	handle
  * [in]     params[1].memref	data
  * [in]     params[2].value.a	timeout
  * [out]    params[2].value.b	sent bytes
@@ -73,7 +80,7 @@
 /*
  * Receive data on socket
  *
- * [in]     params[0].memref	handle
+ * [in]     params[0].value.a	handle
  * [out]    params[1].memref	data
  * [in]     params[2].value.a	timeout
  */
@@ -82,7 +89,7 @@
 /*
  * Retrieve protocol error from socket
  *
- * [in]     params[0].memref	handle
+ * [in]     params[0].value.a	handle
  * [out]    params[1].value.a	error code
  */
 #define TA_SOCKET_CMD_ERROR	5
@@ -90,10 +97,139 @@
 /*
  * Ioctl on socket
  *
- * [in]     params[0].memref	handle
+ * [in]     params[0].value.a	handle
  * [in/out] params[1].memref	data
  * [in]     params[2].value.a	command code
  */
 #define TA_SOCKET_CMD_IOCTL	6
 
+/*
+ * Ioctl command codes, their data is a uint32_t in the byte order of the
+ * TA. TA_SOCKET_IOCTL_RCVBUF and _SNDBUF are TEE_TCP_SET_RECVBUF and
+ * _SENDBUF of the GP TCP socket, they size the kernel buffers of the socket
+ * in the normal world, and apply to a socket that is already connected.
+ * TCP_NODELAY has neither a GP code nor a supplicant command, so there is
+ * no ioctl for it. TA_SOCKET_IOCTL_SEND_TIMEOUT is handled by the TA: the
+ * timeout in milliseconds replaces the one of every send on the handle
+ * until an empty buffer clears it.
+ */
+#define TA_SOCKET_IOCTL_RCVBUF		0x65f00000
+#define TA_SOCKET_IOCTL_SNDBUF		0x65f00001
+#define TA_SOCKET_IOCTL_SEND_TIMEOUT	0x7a000001
+
+/*
+ * Send a list of messages on socket in one invocation. Each message is a
+ * uint32_t length, in the byte order of the TA, followed by its data. The
+ * first failed send ends the batch and its error is returned.
+ *
+ * [in]     params[0].value.a	handle
+ * [in]     params[0].value.b	timeout of each send
+ * [in]     params[1].memref	packed messages
+ * [out]    params[2].memref	uint32_t sent bytes of each message
+ * [out]    params[3].value.a	messages sent in full
+ * [out]    params[3].value.b	total sent bytes
+ */
+#define TA_SOCKET_CMD_SENDV	7
+
+/*
+ * Send a payload in a loop inside the TA, timing each send there, so that no
+ * world switch is part of the measurement. The loop stops after count sends
+ * or duration milliseconds, whichever comes first, a zero disables either
+ * limit. Latencies are counted in power of two buckets: bucket 0 counts
+ * sends under 1 us, bucket i those of 2^(i-1) to 2^i - 1 us and the last
+ * bucket all longer ones. A failed send ends the loop and its error is
+ * returned together with the results of the sends completed before it.
+ *
+ * [in]     params[0].value.a	handle
+ * [in]     params[0].value.b	payload size, up to TA_SOCKET_BENCH_MAX_PAYLOAD
+ * [in]     params[1].value.a	number of sends
+ * [in]     params[1].value.b	duration in milliseconds
+ * [out]    params[1].value.a	number of sends completed
+ * [out]    params[2].memref	uint32_t histogram of TA_SOCKET_BENCH_BUCKETS
+ * [out]    params[3].value.a	sent bytes
+ * [out]    params[3].value.b	elapsed microseconds
+ */
+#define TA_SOCKET_CMD_SEND_BENCH	8
+#define TA_SOCKET_BENCH_BUCKETS		24
+/*
+ * The payload is allocated on the TA heap, TA_DATA_SIZE (32 KiB), next to
+ * the socket table and the connection pool
+ */
+#define TA_SOCKET_BENCH_MAX_PAYLOAD	(16 * 1024)
+
+/*
+ * Send data on socket and wait for the peer to echo it back, the round trip
+ * is timed inside the TA. A TCP echo is read until all bytes are back, a UDP
+ * echo is the next datagram.
+ *
+ * [in]     params[0].value.a	handle
+ * [in]     params[0].value.b	timeout of the send and of each receive
+ * [in]     params[1].memref	data
+ * [out]    params[2].memref	echoed data, at least as large as data
+ * [out]    params[3].value.a	received bytes
+ * [out]    params[3].value.b	round trip time in microseconds
+ */
+#define TA_SOCKET_CMD_ECHO	9
+
+/*
+ * Wait until one of a set of sockets has data, or for the timeout, and read
+ * what is queued on all of them without blocking. Each read is written to
+ * the output as a record: uint32_t handle, uint32_t length, then the data.
+ * A UDP record is one datagram, truncated to the space left, and a TCP
+ * record of length 0 is the end of the stream. Reading stops when the
+ * output is full, the rest stays queued. A socket is writable while it is
+ * open and its receive does not fail, TA_SOCKET_CMD_ERROR gives the reason
+ * of a failure.
+ *
+ * [in]     params[0].value.a	timeout in milliseconds, 0 for a single pass
+ * [in]     params[1].memref	uint32_t handles, at most TA_SOCKET_MAX_HANDLES
+ * [out]    params[2].memref	records
+ * [out]    params[3].value.a	readable handles, bit n for handle n
+ * [out]    params[3].value.b	writable handles, bit n for handle n
+ */
+#define TA_SOCKET_CMD_POLL	10
+
+/*
+ * Opens a socket from the connection pool of the TA instance, which
+ * outlives sessions. An idle connection of the same address, port, IP
+ * version and protocol is reused if it was used in the last
+ * TA_SOCKET_POOL_IDLE_MS and, for TCP, the peer neither closed it nor sent
+ * anything since. Otherwise a new connection is opened and kept, replacing
+ * the least recently used idle one when the pool is full. TA_SOCKET_CMD_CLOSE
+ * and the end of the session give a pooled socket back to the pool instead
+ * of closing it, unless TA_SOCKET_CMD_IOCTL changed its options. When all
+ * TA_SOCKET_POOL_SIZE connections are busy the socket is opened outside
+ * the pool.
+ *
+ * [in]     params[0].value.a	ipVersion
+ * [in]     params[0].value.b	server port
+ * [in]     params[1].memref	server address, shorter than
+ *				TA_SOCKET_POOL_ADDR_LEN
+ * [out]    params[2].value.a	handle
+ * [out]    params[2].value.b	1 if an idle connection was reused
+ * [in]     params[3].value.a	TA_SOCKET_PROTO_TCP/_UDP
+ * [out]    params[3].value.b	protocol error
+ */
+#define TA_SOCKET_CMD_POOL_OPEN	11
+#define TA_SOCKET_POOL_SIZE	8
+#define TA_SOCKET_POOL_ADDR_LEN	64
+#define TA_SOCKET_POOL_IDLE_MS	60000
+#define TA_SOCKET_PROTO_TCP	0
+#define TA_SOCKET_PROTO_UDP	1
+
+/*
+ * Send a list of datagrams on a UDP socket in one invocation, packed as for
+ * TA_SOCKET_CMD_SENDV, one datagram per message. A datagram that fails or
+ * goes out in part is counted as dropped and the batch goes on.
+ *
+ * [in]     params[0].value.a	handle of a UDP socket
+ * [in]     params[0].value.b	timeout of each send
+ * [in]     params[1].memref	packed datagrams
+ * [out]    params[2].memref	uint32_t sent bytes of each datagram, 0 if
+ *				dropped
+ * [out]    params[3].value.a	datagrams sent
+ * [out]    params[3].value.b	datagrams dropped
+ */
+#define TA_SOCKET_CMD_SENDV_UDP	12
+
 #endif /* __SECURE_STORAGE_H__ */
@@ -35,6 +35,64 @@
 #include <tee_udpsocket.h>
 #include <trace.h>
 
+struct pool_conn;
+
+struct sock_handle {
+	TEE_iSocketHandle ctx;
+	TEE_iSocket *socket;		/* NULL while the entry is free */
+	struct pool_conn *pooled;	/* pool entry lent to the session */
+	uint32_t send_timeout;		/* see TA_SOCKET_IOCTL_SEND_TIMEOUT */
+	bool send_timeout_set;
+};
+
+/*
+ * Sockets opened by a session. The client only sees indexes into this
+ * table, so it never holds pointers into the TA.
+ */
+struct sock_session {
+	struct sock_handle socks[TA_SOCKET_MAX_HANDLES];
+};
+
+/*
+ * Connections kept by the TA instance across sessions, see
+ * TA_SOCKET_CMD_POOL_OPEN. An entry lent to a session is busy until the
+ * session closes its handle.
+ */
+struct pool_conn {
+	char addr[TA_SOCKET_POOL_ADDR_LEN];
+	uint32_t ip_vers;
+	uint32_t port;
+	uint32_t proto;
+	TEE_iSocketHandle ctx;
+	TEE_iSocket *socket;		/* NULL while the entry is free */
+	bool busy;
+	bool options_set;		/* a borrower changed socket options */
+	TEE_Time last_use;
+};
+
+static struct pool_conn pool[TA_SOCKET_POOL_SIZE];
+
+static void pool_drop(struct pool_conn *c)
+{
+	c->socket->close(c->ctx);
+	TEE_MemFill(c, 0, sizeof(*c));
+}
+
+/*
+ * The socket layer cannot read options back, so a connection whose buffer
+ * sizes or other options a borrower changed is closed rather than lent
+ * with them to the next session
+ */
+static void pool_release(struct pool_conn *c)
+{
+	if (c->options_set) {
+		pool_drop(c);
+		return;
+	}
+	c->busy = false;
+	TEE_GetSystemTime(&c->last_use);
+}
+
 TEE_Result TA_CreateEntryPoint(void)
 {
 	return TEE_SUCCESS;
@@ -42,37 +100,98 @@ TEE_Result TA_CreateEntryPoint(void)
 
 void TA_DestroyEntryPoint(void)
 {
+	size_t n = 0;
+
+	for (n = 0; n < TA_SOCKET_POOL_SIZE; n++)
+		if (pool[n].socket)
+			pool_drop(&pool[n]);
 }
 
 TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 				    TEE_Param params[4],
 				    void **session_ctx)
 {
+	struct sock_session *sess = NULL;
+
 	(void)param_types;
 	(void)params;
-	(void)session_ctx;
+
+	sess = TEE_Malloc(sizeof(*sess), TEE_MALLOC_FILL_ZERO);
+	if (!sess)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	*session_ctx = sess;
 	return TEE_SUCCESS;
 }
 
 void TA_CloseSessionEntryPoint(void *session_ctx)
 {
-	(void)session_ctx;
+	struct sock_session *sess = session_ctx;
+	size_t n = 0;
+
+	/*
+	 * Sockets the client did not close go away with the session, pooled
+	 * ones go back to the pool
+	 */
+	for (n = 0; n < TA_SOCKET_MAX_HANDLES; n++) {
+		if (sess->socks[n].pooled)
+			pool_release(sess->socks[n].pooled);
+		else if (sess->socks[n].socket)
+			sess->socks[n].socket->close(sess->socks[n].ctx);
+	}
+	TEE_Free(sess);
+}
+
+/*
+ * Free entry of the table, or NULL when all TA_SOCKET_MAX_HANDLES are in use
+ */
+static struct sock_handle *alloc_handle(struct sock_session *sess,
+					uint32_t *id)
+{
+	uint32_t n = 0;
+
+	for (n = 0; n < TA_SOCKET_MAX_HANDLES; n++) {
+		if (!sess->socks[n].socket) {
+			*id = n;
+			return &sess->socks[n];
+		}
+	}
+	return NULL;
 }
 
-struct sock_handle {
-	TEE_iSocketHandle ctx;
-	TEE_iSocket *socket;
-};
+/*
+ * Open socket of handle id, or NULL if id is not one
+ */
+static struct sock_handle *get_handle(struct sock_session *sess, uint32_t id)
+{
+	if (id >= TA_SOCKET_MAX_HANDLES || !sess->socks[id].socket) {
+		EMSG("invalid socket handle %u", id);
+		return NULL;
+	}
+	return &sess->socks[id];
+}
 
-static TEE_Result ta_entry_tcp_open(uint32_t param_types, TEE_Param params[4])
+/*
+ * Timeout of a send on h, the one set on the handle replaces the one of
+ * the command
+ */
+static uint32_t send_timeout(struct sock_handle *h, uint32_t timeout)
+{
+	if (h->send_timeout_set)
+		return h->send_timeout;
+	return timeout;
+}
+
+static TEE_Result ta_entry_tcp_open(struct sock_session *sess,
+				    uint32_t param_types, TEE_Param params[4])
 {
 	TEE_Result res = TEE_ERROR_GENERIC;
-	struct sock_handle h = { };
+	struct sock_handle *h = NULL;
 	TEE_tcpSocket_Setup setup = { };
 	uint32_t req_param_types =
 		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_MEMREF_INPUT,
-				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
 				TEE_PARAM_TYPE_VALUE_OUTPUT);
 
 	if (param_types != req_param_types) {
@@ -81,10 +200,9 @@ static TEE_Result ta_entry_tcp_open(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[2].memref.size < sizeof(struct sock_handle)) {
-		params[2].memref.size = sizeof(struct sock_handle);
-		return TEE_ERROR_SHORT_BUFFER;
-	}
+	h = alloc_handle(sess, &params[2].value.a);
+	if (!h)
+		return TEE_ERROR_OUT_OF_MEMORY;
 
 	setup.ipVersion = params[0].value.a;
 	setup.server_port = params[0].value.b;
@@ -93,26 +211,24 @@ static TEE_Result ta_entry_tcp_open(uint32_t param_types, TEE_Param params[4])
 	if (!setup.server_addr)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
-	h.socket = TEE_tcpSocket;
     // Error: 0xffff000e (TEE_ERROR_COMMUNICATION)
-	res = h.socket->open(&h.ctx, &setup, &params[3].value.a);
+	res = TEE_tcpSocket->open(&h->ctx, &setup, &params[3].value.a);
 	free(setup.server_addr);
-	if (res == TEE_SUCCESS) {
-		memcpy(params[2].memref.buffer, &h, sizeof(h));
-		params[2].memref.size = sizeof(h);
-	}
+	if (res == TEE_SUCCESS)
+		h->socket = TEE_tcpSocket;
 	return res;
 }
 
-static TEE_Result ta_entry_udp_open(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_udp_open(struct sock_session *sess,
+				    uint32_t param_types, TEE_Param params[4])
 {
 	TEE_Result res = TEE_ERROR_GENERIC;
-	struct sock_handle h = { };
+	struct sock_handle *h = NULL;
 	TEE_udpSocket_Setup setup = { };
 	uint32_t req_param_types =
 		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_MEMREF_INPUT,
-				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
 				TEE_PARAM_TYPE_VALUE_OUTPUT);
 
 	if (param_types != req_param_types) {
@@ -121,10 +237,9 @@ static TEE_Result ta_entry_udp_open(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[2].memref.size < sizeof(struct sock_handle)) {
-		params[2].memref.size = sizeof(struct sock_handle);
-		return TEE_ERROR_SHORT_BUFFER;
-	}
+	h = alloc_handle(sess, &params[2].value.a);
+	if (!h)
+		return TEE_ERROR_OUT_OF_MEMORY;
 
 	setup.ipVersion = params[0].value.a;
 	setup.server_port = params[0].value.b;
@@ -133,21 +248,20 @@ static TEE_Result ta_entry_udp_open(uint32_t param_types, TEE_Param params[4])
 	if (!setup.server_addr)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
-	h.socket = TEE_udpSocket;
-	res = h.socket->open(&h.ctx, &setup, &params[3].value.a);
+	res = TEE_udpSocket->open(&h->ctx, &setup, &params[3].value.a);
 	free(setup.server_addr);
-	if (res == TEE_SUCCESS) {
-		memcpy(params[2].memref.buffer, &h, sizeof(h));
-		params[2].memref.size = sizeof(h);
-	}
+	if (res == TEE_SUCCESS)
+		h->socket = TEE_udpSocket;
 	return res;
 }
 
-static TEE_Result ta_entry_close(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_close(struct sock_session *sess,
+				 uint32_t param_types, TEE_Param params[4])
 {
 	struct sock_handle *h = NULL;
+	TEE_Result res = TEE_SUCCESS;
 	uint32_t req_param_types =
-		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE,
 				TEE_PARAM_TYPE_NONE);
 
@@ -157,18 +271,28 @@ static TEE_Result ta_entry_close(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[0].memref.size != sizeof(struct sock_handle))
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	h = params[0].memref.buffer;
-	return h->socket->close(h->ctx);
+	/* The socket context is released even if the close fails */
+	if (h->pooled)
+		pool_release(h->pooled);
+	else
+		res = h->socket->close(h->ctx);
+	h->socket = NULL;
+	h->ctx = NULL;
+	h->pooled = NULL;
+	h->send_timeout_set = false;
+	return res;
 }
 
-static TEE_Result ta_entry_send(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_send(struct sock_session *sess,
+				uint32_t param_types, TEE_Param params[4])
 {
 	struct sock_handle *h = NULL;
 	uint32_t req_param_types =
-		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_MEMREF_INPUT,
 				TEE_PARAM_TYPE_VALUE_INOUT,
 				TEE_PARAM_TYPE_NONE);
@@ -179,20 +303,22 @@ static TEE_Result ta_entry_send(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[0].memref.size != sizeof(*h))
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	h = params[0].memref.buffer;
 	params[2].value.b = params[1].memref.size;
 	return h->socket->send(h->ctx, params[1].memref.buffer,
-			       &params[2].value.b, params[2].value.a);
+			       &params[2].value.b,
+			       send_timeout(h, params[2].value.a));
 }
 
-static TEE_Result ta_entry_recv(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_recv(struct sock_session *sess,
+				uint32_t param_types, TEE_Param params[4])
 {
 	struct sock_handle *h = NULL;
 	uint32_t req_param_types =
-		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_MEMREF_OUTPUT,
 				TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_NONE);
@@ -203,19 +329,20 @@ static TEE_Result ta_entry_recv(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[0].memref.size != sizeof(struct sock_handle))
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	h = params[0].memref.buffer;
 	return h->socket->recv(h->ctx, params[1].memref.buffer,
 			       &params[1].memref.size, params[2].value.a);
 }
 
-static TEE_Result ta_entry_error(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_error(struct sock_session *sess,
+				 uint32_t param_types, TEE_Param params[4])
 {
 	struct sock_handle *h = NULL;
 	uint32_t req_param_types =
-		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_VALUE_OUTPUT,
 				TEE_PARAM_TYPE_NONE,
 				TEE_PARAM_TYPE_NONE);
@@ -226,19 +353,20 @@ static TEE_Result ta_entry_error(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[0].memref.size != sizeof(struct sock_handle))
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	h = params[0].memref.buffer;
 	params[1].value.a = h->socket->error(h->ctx);
 	return TEE_SUCCESS;
 }
 
-static TEE_Result ta_entry_ioctl(uint32_t param_types, TEE_Param params[4])
+static TEE_Result ta_entry_ioctl(struct sock_session *sess,
+				 uint32_t param_types, TEE_Param params[4])
 {
 	struct sock_handle *h = NULL;
 	uint32_t req_param_types =
-		TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_MEMREF_INOUT,
 				TEE_PARAM_TYPE_VALUE_INPUT,
 				TEE_PARAM_TYPE_NONE);
@@ -249,38 +377,603 @@ static TEE_Result ta_entry_ioctl(uint32_t param_types, TEE_Param params[4])
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
 
-	if (params[0].memref.size != sizeof(struct sock_handle))
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	h = params[0].memref.buffer;
+	/* The socket layer has no send timeout, the TA keeps it */
+	if (params[2].value.a == TA_SOCKET_IOCTL_SEND_TIMEOUT) {
+		if (!params[1].memref.size) {
+			h->send_timeout_set = false;
+			return TEE_SUCCESS;
+		}
+		if (params[1].memref.size != sizeof(h->send_timeout))
+			return TEE_ERROR_BAD_PARAMETERS;
+		TEE_MemMove(&h->send_timeout, params[1].memref.buffer,
+			    sizeof(h->send_timeout));
+		h->send_timeout_set = true;
+		return TEE_SUCCESS;
+	}
+
+	if (h->pooled)
+		h->pooled->options_set = true;
 	return h->socket->ioctl(h->ctx, params[2].value.a,
 				params[1].memref.buffer,
 				&params[1].memref.size);
 }
 
+/*
+ * Number of messages of a packed list (see TA_SOCKET_CMD_SENDV), checked
+ * as a whole before the first message goes out
+ */
+static TEE_Result count_msgs(const uint8_t *msgs, uint32_t msgs_sz,
+			     uint32_t *num_msgs)
+{
+	uint32_t off = 0;
+	uint32_t len = 0;
+
+	*num_msgs = 0;
+	for (off = 0; off < msgs_sz; off += sizeof(len) + len) {
+		if (msgs_sz - off < sizeof(len))
+			return TEE_ERROR_BAD_PARAMETERS;
+		TEE_MemMove(&len, msgs + off, sizeof(len));
+		if (len > msgs_sz - off - sizeof(len))
+			return TEE_ERROR_BAD_PARAMETERS;
+		(*num_msgs)++;
+	}
+	return TEE_SUCCESS;
+}
+
+/*
+ * Send the message list of TA_SOCKET_CMD_SENDV or _SENDV_UDP. Without
+ * keep_going a failed send ends the batch, as later messages would no
+ * longer follow the stream; params[3] then counts the messages and bytes
+ * sent. With keep_going, for datagram sockets only, a failed message is
+ * recorded as 0 bytes sent and params[3] counts the messages sent and
+ * failed.
+ */
+static TEE_Result sendv(struct sock_session *sess, uint32_t param_types,
+			TEE_Param params[4], bool keep_going)
+{
+	struct sock_handle *h = NULL;
+	TEE_Result res = TEE_SUCCESS;
+	uint8_t *msgs = NULL;
+	uint32_t msgs_sz = 0;
+	uint8_t *counts = NULL;
+	uint32_t num_msgs = 0;
+	uint32_t off = 0;
+	uint32_t len = 0;
+	uint32_t sent = 0;
+	uint32_t n = 0;
+	uint32_t req_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT);
+
+	if (param_types != req_param_types) {
+		EMSG("got param_types 0x%x, expected 0x%x",
+			param_types, req_param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	msgs = params[1].memref.buffer;
+	msgs_sz = params[1].memref.size;
+	counts = params[2].memref.buffer;
+
+	/* Skipping a failed message is only safe between datagrams */
+	h = get_handle(sess, params[0].value.a);
+	if (!h || (keep_going && h->socket != TEE_udpSocket))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = count_msgs(msgs, msgs_sz, &num_msgs);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (params[2].memref.size < num_msgs * sizeof(sent)) {
+		params[2].memref.size = num_msgs * sizeof(sent);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	params[2].memref.size = num_msgs * sizeof(sent);
+	params[3].value.a = 0;
+	params[3].value.b = 0;
+
+	/*
+	 * The list is in shared memory, lengths are checked again as they
+	 * are read
+	 */
+	for (off = 0, n = 0; n < num_msgs; n++, off += sizeof(len) + len) {
+		if (msgs_sz - off < sizeof(len))
+			return TEE_ERROR_BAD_PARAMETERS;
+		TEE_MemMove(&len, msgs + off, sizeof(len));
+		if (len > msgs_sz - off - sizeof(len))
+			return TEE_ERROR_BAD_PARAMETERS;
+
+		sent = len;
+		res = h->socket->send(h->ctx, msgs + off + sizeof(len), &sent,
+				      send_timeout(h, params[0].value.b));
+		if (!keep_going) {
+			TEE_MemMove(counts + n * sizeof(sent), &sent,
+				    sizeof(sent));
+			params[3].value.b += sent;
+			if (res != TEE_SUCCESS)
+				return res;
+			params[3].value.a = n + 1;
+			continue;
+		}
+		if (res != TEE_SUCCESS || sent != len) {
+			sent = 0;
+			params[3].value.b++;
+		} else {
+			params[3].value.a++;
+		}
+		TEE_MemMove(counts + n * sizeof(sent), &sent, sizeof(sent));
+	}
+	return TEE_SUCCESS;
+}
+
+static TEE_Result ta_entry_sendv(struct sock_session *sess,
+				 uint32_t param_types, TEE_Param params[4])
+{
+	return sendv(sess, param_types, params, false);
+}
+
+static TEE_Result ta_entry_sendv_udp(struct sock_session *sess,
+				     uint32_t param_types, TEE_Param params[4])
+{
+	return sendv(sess, param_types, params, true);
+}
+
+#define BENCH_SEND_TIMEOUT	1000	/* ms, for each send of the benchmark */
+
+/*
+ * Microseconds of a free running counter. The CPU generic timer is read
+ * directly where it is available, TEE_GetSystemTime() only has millisecond
+ * resolution.
+ */
+static uint64_t bench_time_us(void)
+{
+#if defined(__aarch64__)
+	uint64_t cnt = 0;
+	uint64_t frq = 0;
+
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (cnt));
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r" (frq));
+	return cnt / frq * 1000000 + cnt % frq * 1000000 / frq;
+#elif defined(__arm__)
+	uint64_t cnt = 0;
+	uint32_t frq = 0;
+
+	__asm__ volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r" (cnt));
+	__asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (frq));
+	return cnt / frq * 1000000 + cnt % frq * 1000000 / frq;
+#else
+	TEE_Time t = { };
+
+	TEE_GetSystemTime(&t);
+	return (uint64_t)t.seconds * 1000000 + t.millis * 1000;
+#endif
+}
+
+static TEE_Result ta_entry_send_bench(struct sock_session *sess,
+				      uint32_t param_types, TEE_Param params[4])
+{
+	struct sock_handle *h = NULL;
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t hist[TA_SOCKET_BENCH_BUCKETS] = { };
+	uint32_t payload_sz = 0;
+	uint32_t count = 0;
+	uint64_t duration = 0;
+	uint64_t bytes = 0;
+	uint64_t t_start = 0;
+	uint64_t t_send = 0;
+	uint64_t t_now = 0;
+	uint64_t lat = 0;
+	uint32_t sent = 0;
+	uint32_t n = 0;
+	uint32_t b = 0;
+	void *payload = NULL;
+	uint32_t req_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_VALUE_INOUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT);
+
+	if (param_types != req_param_types) {
+		EMSG("got param_types 0x%x, expected 0x%x",
+			param_types, req_param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	payload_sz = params[0].value.b;
+	count = params[1].value.a;
+	duration = params[1].value.b * 1000ULL;
+	/* No send completed until the loop says otherwise */
+	params[1].value.a = 0;
+
+	h = get_handle(sess, params[0].value.a);
+	if (!h)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!payload_sz || payload_sz > TA_SOCKET_BENCH_MAX_PAYLOAD ||
+	    (!count && !duration))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[2].memref.size < sizeof(hist)) {
+		params[2].memref.size = sizeof(hist);
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	payload = TEE_Malloc(payload_sz, TEE_MALLOC_NO_FILL);
+	if (!payload)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemFill(payload, 'A', payload_sz);
+
+	/* The byte count is returned in 32 bits, the run stops before it wraps */
+	t_start = bench_time_us();
+	t_now = t_start;
+	for (n = 0; (!count || n < count) &&
+		    (!duration || t_now - t_start < duration) &&
+		    bytes + payload_sz <= UINT32_MAX; n++) {
+		sent = payload_sz;
+		t_send = t_now;
+		res = h->socket->send(h->ctx, payload, &sent,
+				      send_timeout(h, BENCH_SEND_TIMEOUT));
+		t_now = bench_time_us();
+		if (res != TEE_SUCCESS)
+			break;
+
+		bytes += sent;
+		lat = t_now - t_send;
+		for (b = 0; b < TA_SOCKET_BENCH_BUCKETS - 1 && lat >> b; b++)
+			;
+		hist[b]++;
+	}
+	TEE_Free(payload);
+
+	/* A failed send still returns what the completed ones measured */
+	TEE_MemMove(params[2].memref.buffer, hist, sizeof(hist));
+	params[2].memref.size = sizeof(hist);
+	params[1].value.a = n;
+	params[3].value.a = bytes;
+	if (t_now - t_start > UINT32_MAX)
+		params[3].value.b = UINT32_MAX;
+	else
+		params[3].value.b = t_now - t_start;
+	return res;
+}
+
+static TEE_Result ta_entry_echo(struct sock_session *sess,
+			       uint32_t param_types, TEE_Param params[4])
+{
+	struct sock_handle *h = NULL;
+	TEE_Result res = TEE_SUCCESS;
+	uint8_t *echo = NULL;
+	uint32_t len = 0;
+	uint32_t timeout = 0;
+	uint32_t got = 0;
+	uint32_t sz = 0;
+	uint64_t t_start = 0;
+	uint32_t req_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT);
+
+	if (param_types != req_param_types) {
+		EMSG("got param_types 0x%x, expected 0x%x",
+			param_types, req_param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	echo = params[2].memref.buffer;
+	len = params[1].memref.size;
+	timeout = params[0].value.b;
+
+	h = get_handle(sess, params[0].value.a);
+	if (!h || !len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (params[2].memref.size < len) {
+		params[2].memref.size = len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	t_start = bench_time_us();
+	sz = len;
+	res = h->socket->send(h->ctx, params[1].memref.buffer, &sz,
+			      send_timeout(h, timeout));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* A TCP echo may come back in pieces, a UDP echo is one datagram */
+	do {
+		sz = len - got;
+		res = h->socket->recv(h->ctx, echo + got, &sz, timeout);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (!sz)
+			return TEE_ERROR_COMMUNICATION;
+		got += sz;
+	} while (h->socket == TEE_tcpSocket && got < len);
+
+	params[2].memref.size = got;
+	params[3].value.a = got;
+	params[3].value.b = bench_time_us() - t_start;
+	return TEE_SUCCESS;
+}
+
+#define POLL_INTERVAL		1	/* ms between two passes of a poll */
+
+/*
+ * Read what is queued on a socket into the records of out, starting at
+ * *off, without waiting. *readable is set when a record was written.
+ */
+static TEE_Result poll_drain(struct sock_handle *h, uint32_t id,
+			     TEE_Param *out, uint32_t *off, bool *readable)
+{
+	uint8_t *buf = out->memref.buffer;
+	uint32_t hdr[2] = { id, 0 };
+	uint32_t data_off = 0;
+	uint32_t sz = 0;
+	TEE_Result res = TEE_SUCCESS;
+
+	while (out->memref.size - *off > sizeof(hdr)) {
+		data_off = *off + sizeof(hdr);
+		sz = out->memref.size - data_off;
+		res = h->socket->recv(h->ctx, buf + data_off, &sz, 0);
+		if (res == TEE_ISOCKET_ERROR_TIMEOUT && !sz)
+			return TEE_SUCCESS;	/* nothing queued */
+		if (res != TEE_SUCCESS && res != TEE_ISOCKET_ERROR_TIMEOUT)
+			return res;
+
+		hdr[1] = sz;
+		TEE_MemMove(buf + *off, hdr, sizeof(hdr));
+		*off = data_off + sz;
+		*readable = true;
+		/* End of a TCP stream, or an empty datagram */
+		if (!sz)
+			return TEE_SUCCESS;
+	}
+	return TEE_SUCCESS;
+}
+
+static TEE_Result ta_entry_poll(struct sock_session *sess,
+				uint32_t param_types, TEE_Param params[4])
+{
+	uint32_t ids[TA_SOCKET_MAX_HANDLES] = { };
+	uint32_t num_ids = params[1].memref.size / sizeof(uint32_t);
+	uint64_t timeout = params[0].value.a * 1000ULL;
+	uint64_t t_start = 0;
+	uint32_t readable = 0;
+	uint32_t writable = 0;
+	uint32_t off = 0;
+	uint32_t n = 0;
+	bool ready = false;
+	uint32_t req_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT);
+
+	if (param_types != req_param_types) {
+		EMSG("got param_types 0x%x, expected 0x%x",
+			param_types, req_param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (params[1].memref.size % sizeof(uint32_t) || !num_ids ||
+	    num_ids > TA_SOCKET_MAX_HANDLES)
+		return TEE_ERROR_BAD_PARAMETERS;
+	TEE_MemMove(ids, params[1].memref.buffer, params[1].memref.size);
+	for (n = 0; n < num_ids; n++)
+		if (!get_handle(sess, ids[n]))
+			return TEE_ERROR_BAD_PARAMETERS;
+
+	t_start = bench_time_us();
+	while (true) {
+		writable = 0;
+		for (n = 0; n < num_ids; n++) {
+			ready = false;
+			if (poll_drain(&sess->socks[ids[n]], ids[n], &params[2],
+				       &off, &ready) != TEE_SUCCESS)
+				continue;
+			writable |= 1 << ids[n];
+			if (ready)
+				readable |= 1 << ids[n];
+		}
+		if (readable || bench_time_us() - t_start >= timeout)
+			break;
+		TEE_Wait(POLL_INTERVAL);
+	}
+
+	params[2].memref.size = off;
+	params[3].value.a = readable;
+	params[3].value.b = writable;
+	return TEE_SUCCESS;
+}
+
+static uint32_t pool_idle_ms(struct pool_conn *c)
+{
+	TEE_Time now = { };
+
+	TEE_GetSystemTime(&now);
+	return (now.seconds - c->last_use.seconds) * 1000 + now.millis -
+	       c->last_use.millis;
+}
+
+/*
+ * An idle TCP connection is reused if the peer did not close it and sent
+ * nothing since, which a receive without waiting tells
+ */
+static bool pool_healthy(struct pool_conn *c)
+{
+	uint8_t probe = 0;
+	uint32_t sz = sizeof(probe);
+	TEE_Result res = TEE_SUCCESS;
+
+	if (pool_idle_ms(c) > TA_SOCKET_POOL_IDLE_MS)
+		return false;
+	if (c->proto == TA_SOCKET_PROTO_UDP)
+		return true;
+
+	res = c->socket->recv(c->ctx, &probe, &sz, 0);
+	return res == TEE_ISOCKET_ERROR_TIMEOUT && !sz;
+}
+
+static TEE_Result pool_connect(struct pool_conn *c, uint32_t *proto_err)
+{
+	TEE_tcpSocket_Setup tcp_setup = { };
+	TEE_udpSocket_Setup udp_setup = { };
+
+	if (c->proto == TA_SOCKET_PROTO_UDP) {
+		udp_setup.ipVersion = c->ip_vers;
+		udp_setup.server_port = c->port;
+		udp_setup.server_addr = c->addr;
+		c->socket = TEE_udpSocket;
+		return c->socket->open(&c->ctx, &udp_setup, proto_err);
+	}
+
+	tcp_setup.ipVersion = c->ip_vers;
+	tcp_setup.server_port = c->port;
+	tcp_setup.server_addr = c->addr;
+	c->socket = TEE_tcpSocket;
+	return c->socket->open(&c->ctx, &tcp_setup, proto_err);
+}
+
+static TEE_Result ta_entry_pool_open(struct sock_session *sess,
+				     uint32_t param_types, TEE_Param params[4])
+{
+	struct sock_handle *h = NULL;
+	struct pool_conn key = { };
+	struct pool_conn *c = NULL;
+	struct pool_conn *lru = NULL;
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t n = 0;
+	uint32_t req_param_types =
+		TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				TEE_PARAM_TYPE_MEMREF_INPUT,
+				TEE_PARAM_TYPE_VALUE_OUTPUT,
+				TEE_PARAM_TYPE_VALUE_INOUT);
+
+	if (param_types != req_param_types) {
+		EMSG("got param_types 0x%x, expected 0x%x",
+			param_types, req_param_types);
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (!params[1].memref.size ||
+	    params[1].memref.size >= TA_SOCKET_POOL_ADDR_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (params[3].value.a != TA_SOCKET_PROTO_TCP &&
+	    params[3].value.a != TA_SOCKET_PROTO_UDP)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	TEE_MemMove(key.addr, params[1].memref.buffer, params[1].memref.size);
+	key.ip_vers = params[0].value.a;
+	key.port = params[0].value.b;
+	key.proto = params[3].value.a;
+
+	h = alloc_handle(sess, &params[2].value.a);
+	if (!h)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	params[2].value.b = 0;
+	params[3].value.b = 0;
+
+	/*
+	 * Only idle connections of the same key are probed, the others are
+	 * dropped once they have been idle for too long
+	 */
+	for (n = 0; n < TA_SOCKET_POOL_SIZE; n++) {
+		if (!pool[n].socket || pool[n].busy)
+			continue;
+		if (pool[n].ip_vers != key.ip_vers || pool[n].port != key.port ||
+		    pool[n].proto != key.proto ||
+		    strcmp(pool[n].addr, key.addr)) {
+			if (pool_idle_ms(&pool[n]) > TA_SOCKET_POOL_IDLE_MS)
+				pool_drop(&pool[n]);
+			continue;
+		}
+		if (!pool_healthy(&pool[n])) {
+			pool_drop(&pool[n]);
+			continue;
+		}
+		c = &pool[n];
+		params[2].value.b = 1;
+		break;
+	}
+
+	if (!c) {
+		/* A free entry, or else the least recently used idle one */
+		for (n = 0; n < TA_SOCKET_POOL_SIZE && !c; n++) {
+			if (!pool[n].socket)
+				c = &pool[n];
+			else if (!pool[n].busy &&
+				 (!lru || pool_idle_ms(&pool[n]) >
+					  pool_idle_ms(lru)))
+				lru = &pool[n];
+		}
+		if (!c && lru) {
+			pool_drop(lru);
+			c = lru;
+		}
+		/* All entries are busy, the socket stays out of the pool */
+		if (!c)
+			c = &key;
+
+		*c = key;
+		res = pool_connect(c, &params[3].value.b);
+		if (res != TEE_SUCCESS) {
+			TEE_MemFill(c, 0, sizeof(*c));
+			return res;
+		}
+	}
+
+	h->ctx = c->ctx;
+	h->socket = c->socket;
+	if (c != &key) {
+		c->busy = true;
+		h->pooled = c;
+	}
+	return TEE_SUCCESS;
+}
+
 
 
 TEE_Result TA_InvokeCommandEntryPoint(void *session_ctx,
 				      uint32_t cmd_id, uint32_t param_types,
 				      TEE_Param params[4])
 {
-	(void)session_ctx;
+	struct sock_session *sess = session_ctx;
 
 	switch (cmd_id) {
 	case TA_SOCKET_CMD_TCP_OPEN:
-		return ta_entry_tcp_open(param_types, params);
+		return ta_entry_tcp_open(sess, param_types, params);
 	case TA_SOCKET_CMD_UDP_OPEN:
-		return ta_entry_udp_open(param_types, params);
+		return ta_entry_udp_open(sess, param_types, params);
 	case TA_SOCKET_CMD_CLOSE:
-		return ta_entry_close(param_types, params);
+		return ta_entry_close(sess, param_types, params);
 	case TA_SOCKET_CMD_SEND:
-		return ta_entry_send(param_types, params);
+		return ta_entry_send(sess, param_types, params);
 	case TA_SOCKET_CMD_RECV:
-		return ta_entry_recv(param_types, params);
+		return ta_entry_recv(sess, param_types, params);
 	case TA_SOCKET_CMD_ERROR:
-		return ta_entry_error(param_types, params);
+		return ta_entry_error(sess, param_types, params);
 	case TA_SOCKET_CMD_IOCTL:
-		return ta_entry_ioctl(param_types, params);
+		return ta_entry_ioctl(sess, param_types, params);
+	case TA_SOCKET_CMD_SENDV:
+		return ta_entry_sendv(sess, param_types, params);
+	case TA_SOCKET_CMD_SEND_BENCH:
+		return ta_entry_send_bench(sess, param_types, params);
+	case TA_SOCKET_CMD_ECHO:
+		return ta_entry_echo(sess, param_types, params);
+	case TA_SOCKET_CMD_POLL:
+		return ta_entry_poll(sess, param_types, params);
+	case TA_SOCKET_CMD_POOL_OPEN:
+		return ta_entry_pool_open(sess, param_types, params);
+	case TA_SOCKET_CMD_SENDV_UDP:
+		return ta_entry_sendv_udp(sess, param_types, params);
 	default:
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
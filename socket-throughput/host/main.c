@@ -2,6 +2,7 @@
 #include <fcntl.h> // for open
 #include <math.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +16,17 @@
 
 #define OP_BENCHMARK        0
 #define TPUT_BENCHMARK      1
+#define ECHO_BENCHMARK      2
+#define ECHO_TIMEOUT        2000
+#define ECHO_NUM_RTT        200
+#define BATCH_NUM_MSGS      128
+#define BATCH_MSG_SIZE      1024
+#define LOOP_NUM_SEND       1024
+#define POLL_MSG_SIZE       1024
+#define POLL_BUF_SIZE       (64 * 1024)
+#define UDP_SINK_PORT       9997
+#define UDP_NUM_DGRAMS      4096
+#define SHM_NUM_SLOTS       4
 
 struct ta_ctx {
     TEEC_Context ctx;
@@ -26,8 +38,8 @@ struct socket_handle {
     char *addr;
     uint16_t tcp_port;
     uint16_t udp_port;
-    char *buf; // This buffer is used to store the TEE Socket Handle
-    size_t buffer_size;
+    uint32_t id; // Index of the socket in the TA session table
+    uint32_t error; // Protocol error of the last open
 };
 
 struct benchmark_times {
@@ -113,26 +125,24 @@ static TEEC_Result tee_socket_tcp_open(struct ta_ctx *t_ctx,
 {
     TEEC_Result res;
     TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
-    
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
     op.paramTypes = TEEC_PARAM_TYPES(
             TEEC_VALUE_INPUT,
             TEEC_MEMREF_TEMP_INPUT,
-            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT,
             TEEC_VALUE_OUTPUT);
 
     op.params[0].value.a = handle->ip_vers;
     op.params[0].value.b = handle->tcp_port;
     op.params[1].tmpref.buffer = (void *) handle->addr;
     op.params[1].tmpref.size = strlen(handle->addr) + 1;
-    op.params[2].tmpref.buffer = handle->buf;
-    op.params[2].tmpref.size = handle->buffer_size;
 
-    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, ret_orig);
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, &ret_orig);
 
-    handle->buffer_size = op.params[2].tmpref.size;
-    *error = op.params[3].value.a;
+    handle->id = op.params[2].value.a;
+    handle->error = op.params[3].value.a;
     return res;
 }
 
@@ -141,27 +151,25 @@ static TEEC_Result tee_socket_udp_open(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
+    uint32_t ret_orig;
 
+	memset(&op, 0, sizeof(op));
 	op.params[0].value.a = handle->ip_vers;
 	op.params[0].value.b = handle->udp_port;
 	op.params[1].tmpref.buffer = (void *) handle->addr;
 	op.params[1].tmpref.size = strlen(handle->addr) + 1;
-	op.params[2].tmpref.buffer = handle->buf;
-	op.params[2].tmpref.size = handle->buffer_size;
 
 	op.paramTypes = TEEC_PARAM_TYPES(
                         TEEC_VALUE_INPUT,
 					    TEEC_MEMREF_TEMP_INPUT,
-					    TEEC_MEMREF_TEMP_OUTPUT,
+					    TEEC_VALUE_OUTPUT,
 					    TEEC_VALUE_OUTPUT);
 
 	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_UDP_OPEN,
-				 &op, ret_orig);
+				 &op, &ret_orig);
 
-	handle->buffer_size = op.params[2].tmpref.size;
-	*error = op.params[3].value.a;
+	handle->id = op.params[2].value.a;
+	handle->error = op.params[3].value.a;
 	return res;
 }
 
@@ -171,65 +179,387 @@ static TEEC_Result tee_socket_send(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
     uint32_t timeout = 1000;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 	op.params[1].tmpref.buffer = (void *)data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_INPUT,
 					 TEEC_VALUE_INOUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, &ret_orig);
 
 	*dlen = op.params[2].value.b;
 	return res;
 }
 
 /*
-static TEEC_Result tee_socket_recv(TEEC_Session *session,
+ * tee_socket_send() of *dlen bytes at offset of a shared memory region
+ * registered with TEEC_RegisterSharedMemory(). The TA reads the payload
+ * from the region, no temporary buffer is allocated nor copied for the
+ * invocation. *dlen is updated with the bytes sent.
+ */
+static TEEC_Result tee_socket_send_shm(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, TEEC_SharedMemory *shm, size_t offset,
+        size_t *dlen)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+    uint32_t timeout = 1000;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_PARTIAL_INPUT,
+            TEEC_VALUE_INOUT,
+            TEEC_NONE);
+
+    op.params[0].value.a = handle->id;
+    op.params[1].memref.parent = shm;
+    op.params[1].memref.offset = offset;
+    op.params[1].memref.size = *dlen;
+    op.params[2].value.a = timeout;
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, &ret_orig);
+
+    *dlen = op.params[2].value.b;
+    return res;
+}
+
+static TEEC_Result tee_socket_recv(struct ta_ctx *t_ctx,
 			      struct socket_handle *handle,
-			      void *data, size_t *dlen,
-			      uint32_t timeout, uint32_t *ret_orig)
+			      void *data, size_t *dlen, uint32_t timeout)
 {
-	TEEC_Result res = TEEC_ERROR_GENERIC;
-	TEEC_Operation op = TEEC_OPERATION_INITIALIZER;
+	TEEC_Result res;
+	TEEC_Operation op;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->blen;
-	op.params[1].tmpref.buffer = (void *)data;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
+	op.params[1].tmpref.buffer = data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_OUTPUT,
 					 TEEC_VALUE_INPUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(session, TA_SOCKET_CMD_RECV, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_RECV, &op, &ret_orig);
 
 	*dlen = op.params[1].tmpref.size;
 	return res;
 }
 
-*/
+/*
+ * Wait for the echo of len bytes. A TCP echo may come back in several
+ * pieces, a UDP echo is one datagram.
+ */
+static TEEC_Result tee_socket_recv_echo(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, char *buf, size_t len, int udp)
+{
+    TEEC_Result res;
+    size_t got = 0;
+    size_t sz;
+
+    do
+    {
+        sz = len - got;
+        res = tee_socket_recv(t_ctx, handle, buf + got, &sz, ECHO_TIMEOUT);
+        if (res != TEEC_SUCCESS)
+            return res;
+        if (!sz)
+            return TEEC_ERROR_COMMUNICATION;
+        got += sz;
+    } while (!udp && got < len);
+    return TEEC_SUCCESS;
+}
 
 static TEEC_Result tee_socket_close(struct ta_ctx *t_ctx,
         struct socket_handle *handle)
 {
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
 
-	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, ret_orig);
+	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, &ret_orig);
+}
+
+/*
+ * Ioctl with a uint32_t argument, see TA_SOCKET_IOCTL_*
+ */
+static TEEC_Result tee_socket_ioctl(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, uint32_t cmd, uint32_t val)
+{
+    TEEC_Operation op;
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INOUT,
+            TEEC_VALUE_INPUT,
+            TEEC_NONE);
+    op.params[0].value.a = handle->id;
+    op.params[1].tmpref.buffer = &val;
+    op.params[1].tmpref.size = sizeof(val);
+    op.params[2].value.a = cmd;
+
+    return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_IOCTL, &op,
+            &ret_orig);
+}
+
+/*
+ * Send num_msgs packed messages (see TA_SOCKET_CMD_SENDV) in one invocation.
+ * counts receives the bytes sent of each message, *num_sent the number of
+ * messages sent in full.
+ */
+static TEEC_Result tee_socket_sendv(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, const void *msgs, size_t msgs_sz,
+        uint32_t *counts, size_t num_msgs, uint32_t *num_sent)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+    uint32_t timeout = 1000;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT);
+
+    op.params[0].value.a = handle->id;
+    op.params[0].value.b = timeout;
+    op.params[1].tmpref.buffer = (void *) msgs;
+    op.params[1].tmpref.size = msgs_sz;
+    op.params[2].tmpref.buffer = counts;
+    op.params[2].tmpref.size = num_msgs * sizeof(*counts);
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SENDV, &op, &ret_orig);
+
+    *num_sent = op.params[3].value.a;
+    return res;
+}
+
+/*
+ * Send num_msgs packed datagrams (see TA_SOCKET_CMD_SENDV_UDP) in one
+ * invocation. *num_sent and *num_dropped receive the datagrams sent and
+ * dropped by the socket layer.
+ */
+static TEEC_Result tee_socket_sendv_udp(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, const void *msgs, size_t msgs_sz,
+        uint32_t *counts, size_t num_msgs, uint32_t *num_sent,
+        uint32_t *num_dropped)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+    uint32_t timeout = 1000;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT);
+
+    op.params[0].value.a = handle->id;
+    op.params[0].value.b = timeout;
+    op.params[1].tmpref.buffer = (void *) msgs;
+    op.params[1].tmpref.size = msgs_sz;
+    op.params[2].tmpref.buffer = counts;
+    op.params[2].tmpref.size = num_msgs * sizeof(*counts);
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SENDV_UDP, &op,
+            &ret_orig);
+
+    *num_sent = op.params[3].value.a;
+    *num_dropped = op.params[3].value.b;
+    return res;
+}
+
+/*
+ * Run TA_SOCKET_CMD_SEND_BENCH: count sends of payload_sz bytes timed inside
+ * the TA. hist receives TA_SOCKET_BENCH_BUCKETS counters and *num_sends the
+ * number of sends completed, also when one of them failed.
+ */
+static TEEC_Result tee_socket_send_bench(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, uint32_t payload_sz, uint32_t count,
+        uint32_t *hist, uint32_t *num_sends, uint32_t *bytes,
+        uint32_t *elapsed_us)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_VALUE_INOUT,
+            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT);
+
+    op.params[0].value.a = handle->id;
+    op.params[0].value.b = payload_sz;
+    op.params[1].value.a = count;
+    op.params[1].value.b = 0;
+    op.params[2].tmpref.buffer = hist;
+    op.params[2].tmpref.size = TA_SOCKET_BENCH_BUCKETS * sizeof(*hist);
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND_BENCH, &op,
+            &ret_orig);
+
+    // Outside the TA nothing ran and the outputs are not set
+    if (ret_orig != TEEC_ORIGIN_TRUSTED_APP)
+        memset(&op.params[1], 0, sizeof(op.params[1]));
+    *num_sends = op.params[1].value.a;
+    *bytes = op.params[3].value.a;
+    *elapsed_us = op.params[3].value.b;
+    return res;
+}
+
+/*
+ * Run TA_SOCKET_CMD_ECHO, ta_rtt_us receives the round trip timed in the TA
+ */
+static TEEC_Result tee_socket_echo(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, const void *data, size_t dlen,
+        void *echo, uint32_t *ta_rtt_us)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT);
+
+    op.params[0].value.a = handle->id;
+    op.params[0].value.b = ECHO_TIMEOUT;
+    op.params[1].tmpref.buffer = (void *) data;
+    op.params[1].tmpref.size = dlen;
+    op.params[2].tmpref.buffer = echo;
+    op.params[2].tmpref.size = dlen;
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_ECHO, &op, &ret_orig);
+
+    *ta_rtt_us = op.params[3].value.b;
+    return res;
+}
+
+/*
+ * Run TA_SOCKET_CMD_POLL on num_ids handles, *rec_sz receives the size of
+ * the records written to recs
+ */
+static TEEC_Result tee_socket_poll(struct ta_ctx *t_ctx, const uint32_t *ids,
+        size_t num_ids, uint32_t timeout, void *recs, size_t *rec_sz,
+        uint32_t *readable, uint32_t *writable)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT);
+
+    op.params[0].value.a = timeout;
+    op.params[1].tmpref.buffer = (void *) ids;
+    op.params[1].tmpref.size = num_ids * sizeof(*ids);
+    op.params[2].tmpref.buffer = recs;
+    op.params[2].tmpref.size = *rec_sz;
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_POLL, &op, &ret_orig);
+
+    *rec_sz = op.params[2].tmpref.size;
+    *readable = op.params[3].value.a;
+    *writable = op.params[3].value.b;
+    return res;
+}
+
+/*
+ * Open a socket from the connection pool of the TA instance, *reused tells
+ * whether an idle connection was picked up
+ */
+static TEEC_Result tee_socket_pool_open(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, int udp, uint32_t *reused)
+{
+    TEEC_Result res;
+    TEEC_Operation op;
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
+    op.paramTypes = TEEC_PARAM_TYPES(
+            TEEC_VALUE_INPUT,
+            TEEC_MEMREF_TEMP_INPUT,
+            TEEC_VALUE_OUTPUT,
+            TEEC_VALUE_INOUT);
+
+    op.params[0].value.a = handle->ip_vers;
+    op.params[0].value.b = udp ? handle->udp_port : handle->tcp_port;
+    op.params[1].tmpref.buffer = (void *) handle->addr;
+    op.params[1].tmpref.size = strlen(handle->addr) + 1;
+    op.params[3].value.a = udp ? TA_SOCKET_PROTO_UDP : TA_SOCKET_PROTO_TCP;
+
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_POOL_OPEN, &op,
+            &ret_orig);
+
+    handle->id = op.params[2].value.a;
+    *reused = op.params[2].value.b;
+    handle->error = op.params[3].value.b;
+    return res;
+}
+
+/*
+ * Pack num copies of data in the TA_SOCKET_CMD_SENDV layout, returns the
+ * packed size
+ */
+size_t pack_messages(char *dst, const char *data, uint32_t data_sz, int num)
+{
+    size_t off = 0;
+
+    for (int i = 0; i < num; i++)
+    {
+        memcpy(dst + off, &data_sz, sizeof(data_sz));
+        memcpy(dst + off + sizeof(data_sz), data, data_sz);
+        off += sizeof(data_sz) + data_sz;
+    }
+    return off;
+}
+
+/*
+ * REE counterpart of tee_socket_recv_echo()
+ */
+int ree_recv_echo(int sock, char *buf, size_t len, int udp)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    do
+    {
+        n = recv(sock, buf + got, len - got, 0);
+        if (n <= 0)
+            return 1;
+        got += n;
+    } while (!udp && got < len);
+    return 0;
 }
 
 int ree_tcp_socket_client(struct socket_handle *s_handle,
@@ -404,8 +734,6 @@ int tee_benchmark(struct ta_ctx *t_ctx,
     for (i = 0; i < tcp_times->num_tests; i++)
     {
         //printf("Starting TEE TCP test #%u!\n", i);
-        memset((void *) s_handle->buf, '\0', 1024 * sizeof(char));
-        s_handle->buffer_size = 1024;
 
         if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
         {
@@ -473,8 +801,6 @@ int tee_benchmark(struct ta_ctx *t_ctx,
     for (i = 0; i < tcp_times->num_tests; i++)
     {
         //printf("Starting TEE UDP test #%u!\n", i);
-        memset((void *) s_handle->buf, '\0', 1024 * sizeof(char));
-        s_handle->buffer_size = 1024;
         //data_sz = strlen(data);
 
         if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
@@ -541,22 +867,1127 @@ int tee_benchmark(struct ta_ctx *t_ctx,
     return 0;
 }
 
-int main()
+/*
+ * Send BATCH_NUM_MSGS messages of BATCH_MSG_SIZE bytes over a TEE socket,
+ * one SEND invocation per message (batch 0 in the output) and then through
+ * SENDV with a growing number of messages per invocation. Times are the
+ * milliseconds taken by all messages.
+ */
+int batch_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        int num_tests)
+{
+    struct timeval t_ini, t_end, t_diff;
+    int batch_sizes[] = {0, 1, 4, 16, 64, BATCH_NUM_MSGS};
+    const int num_batch_sizes = sizeof(batch_sizes) / sizeof(batch_sizes[0]);
+    double *times = calloc(num_tests, sizeof(double));
+    char *data = malloc(BATCH_MSG_SIZE);
+    char *msgs = malloc(BATCH_NUM_MSGS * (sizeof(uint32_t) + BATCH_MSG_SIZE));
+    uint32_t counts[BATCH_NUM_MSGS];
+    uint32_t num_sent;
+    size_t msgs_sz, data_sz;
+    TEEC_Result res;
+    double mean;
+
+    if (!times || !data || !msgs)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', BATCH_MSG_SIZE);
+
+    printf("---- BATCH SWEEP: %i x %i B, %i runs ----\n", BATCH_NUM_MSGS,
+            BATCH_MSG_SIZE, num_tests);
+    printf("proto\tbatch\tavg ms\tstdev\tmsg/s\tMB/s\n");
+    for (int udp = 0; udp < 2; udp++)
+    {
+        for (int b = 0; b < num_batch_sizes; b++)
+        {
+            int batch = batch_sizes[b];
+
+            for (int i = 0; i < num_tests; i++)
+            {
+                if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+                    return 1;
+                res = udp ? tee_socket_udp_open(t_ctx, s_handle) :
+                    tee_socket_tcp_open(t_ctx, s_handle);
+                if (res != TEEC_SUCCESS)
+                {
+                    printf("Error opening socket in the TEE: 0x%x\n", res);
+                    return 1;
+                }
+
+                gettimeofday(&t_ini, NULL);
+                for (int sent = 0; sent < BATCH_NUM_MSGS; )
+                {
+                    if (!batch)
+                    {
+                        data_sz = BATCH_MSG_SIZE;
+                        res = tee_socket_send(t_ctx, s_handle, data, &data_sz);
+                        if (res != TEEC_SUCCESS)
+                        {
+                            printf("SEND failed 0x%x after %i messages\n", res,
+                                    sent);
+                            return 1;
+                        }
+                        sent++;
+                        continue;
+                    }
+                    int num = MIN(batch, BATCH_NUM_MSGS - sent);
+                    msgs_sz = pack_messages(msgs, data, BATCH_MSG_SIZE, num);
+                    res = tee_socket_sendv(t_ctx, s_handle, msgs, msgs_sz,
+                            counts, num, &num_sent);
+                    if (res != TEEC_SUCCESS || num_sent != num)
+                    {
+                        printf("SENDV failed 0x%x after %u messages\n", res,
+                                num_sent);
+                        return 1;
+                    }
+                    sent += num;
+                }
+                gettimeofday(&t_end, NULL);
+                timeval_subtract(&t_diff, &t_end, &t_ini);
+                times[i] = t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0;
+
+                tee_socket_close(t_ctx, s_handle);
+                terminate_tee_session(t_ctx);
+            }
+            mean = avg(times, num_tests);
+            printf("%s\t%i\t%f\t%f\t%.0f\t%.2f\n", udp ? "UDP" : "TCP", batch,
+                    mean, stdev(times, num_tests),
+                    BATCH_NUM_MSGS * 1000.0 / mean,
+                    BATCH_NUM_MSGS * BATCH_MSG_SIZE / (mean * 1000.0));
+        }
+    }
+
+    free(times);
+    free(data);
+    free(msgs);
+    return 0;
+}
+
+/*
+ * Send LOOP_NUM_SEND payloads of several sizes, once with one SEND
+ * invocation per payload as tee_benchmark() does and once with the whole
+ * loop inside the TA (TA_SOCKET_CMD_SEND_BENCH). The difference of the
+ * per-send times is the cost of the invocation, the in-TA time is the cost
+ * of the socket RPC to the supplicant.
+ */
+int loop_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle)
+{
+    struct timeval t_ini, t_end, t_diff;
+    uint32_t payload_sizes[] = {64, 1024, 16 * 1024};
+    const int num_sizes = sizeof(payload_sizes) / sizeof(payload_sizes[0]);
+    uint32_t hist[TA_SOCKET_BENCH_BUCKETS];
+    uint32_t num_sends, bytes, elapsed_us;
+    char *data = malloc(TA_SOCKET_BENCH_MAX_PAYLOAD);
+    size_t data_sz;
+    double host_us;
+    TEEC_Result res;
+
+    if (!data)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', TA_SOCKET_BENCH_MAX_PAYLOAD);
+
+    printf("---- SEND LOOP: %i sends, host loop vs TA loop ----\n",
+            LOOP_NUM_SEND);
+    for (int udp = 0; udp < 2; udp++)
+    {
+        for (int s = 0; s < num_sizes; s++)
+        {
+            if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+                return 1;
+            res = udp ? tee_socket_udp_open(t_ctx, s_handle) :
+                tee_socket_tcp_open(t_ctx, s_handle);
+            if (res != TEEC_SUCCESS)
+            {
+                printf("Error opening socket in the TEE: 0x%x\n", res);
+                return 1;
+            }
+
+            gettimeofday(&t_ini, NULL);
+            for (int i = 0; i < LOOP_NUM_SEND; i++)
+            {
+                data_sz = payload_sizes[s];
+                if (tee_socket_send(t_ctx, s_handle, data, &data_sz) !=
+                        TEEC_SUCCESS)
+                {
+                    printf("Error sending data from the TEE!\n");
+                    return 1;
+                }
+            }
+            gettimeofday(&t_end, NULL);
+            timeval_subtract(&t_diff, &t_end, &t_ini);
+            host_us = t_diff.tv_sec * 1000000.0 + t_diff.tv_usec;
+
+            memset(hist, 0, sizeof(hist));
+            res = tee_socket_send_bench(t_ctx, s_handle, payload_sizes[s],
+                    LOOP_NUM_SEND, hist, &num_sends, &bytes, &elapsed_us);
+            if (res != TEEC_SUCCESS)
+                printf("Error running the TA send loop: 0x%x after %u sends\n",
+                        res, num_sends);
+
+            tee_socket_close(t_ctx, s_handle);
+            terminate_tee_session(t_ctx);
+
+            if (!num_sends)
+                continue;
+            // A failed TA loop is reported over the sends it completed
+            printf("%s %u B: host loop %.1f us/send, TA loop %.1f us/send, "
+                    "invocation %.1f us/send, TA loop %.2f MB/s\n",
+                    udp ? "UDP" : "TCP", payload_sizes[s],
+                    host_us / LOOP_NUM_SEND,
+                    (double) elapsed_us / num_sends,
+                    host_us / LOOP_NUM_SEND - (double) elapsed_us / num_sends,
+                    elapsed_us ? (double) bytes / elapsed_us : 0.0);
+            for (int b = 0; b < TA_SOCKET_BENCH_BUCKETS; b++)
+            {
+                if (!hist[b])
+                    continue;
+                if (b == TA_SOCKET_BENCH_BUCKETS - 1)
+                    printf("\t>= %u us\t%u\n", 1u << (b - 1), hist[b]);
+                else
+                    printf("\t< %u us\t%u\n", 1u << b, hist[b]);
+            }
+        }
+    }
+
+    free(data);
+    return 0;
+}
+
+int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Sort rtts and print their percentiles, in microseconds
+ */
+void print_rtt(const char *mode, int udp, size_t size, double *rtts, int n)
+{
+    qsort(rtts, n, sizeof(double), cmp_double);
+    printf("%s\t%s\t%zu\t%.1f\t%.1f\t%.1f\t%.1f\n", mode, udp ? "UDP" : "TCP",
+            size, rtts[n / 2], rtts[n * 90 / 100], rtts[n * 99 / 100],
+            rtts[n - 1]);
+}
+
+/*
+ * ECHO_NUM_RTT round trips of one payload on a REE socket
+ */
+int ree_echo(struct socket_handle *s_handle, int udp, char *data, size_t len,
+        char *echo, double *rtts)
+{
+    struct timeval t_ini, t_end, t_diff;
+    struct timeval recv_timeout = { .tv_sec = ECHO_TIMEOUT / 1000 };
+    struct sockaddr_in serv_addr;
+    int sock;
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(udp ? s_handle->udp_port : s_handle->tcp_port);
+    if (inet_pton(AF_INET, s_handle->addr, &serv_addr.sin_addr) <= 0)
+    {
+        printf("Invalid address/ Address not supported\n");
+        return 1;
+    }
+    sock = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (sock < 0 ||
+            connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    {
+        printf("Error connecting to the echo server\n");
+        return 1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout,
+            sizeof(recv_timeout));
+
+    for (int i = 0; i < ECHO_NUM_RTT; i++)
+    {
+        gettimeofday(&t_ini, NULL);
+        if (send(sock, data, len, 0) != (ssize_t) len ||
+                ree_recv_echo(sock, echo, len, udp))
+        {
+            printf("Error receiving the REE echo\n");
+            close(sock);
+            return 1;
+        }
+        gettimeofday(&t_end, NULL);
+        timeval_subtract(&t_diff, &t_end, &t_ini);
+        rtts[i] = t_diff.tv_sec * 1000000.0 + t_diff.tv_usec;
+    }
+    close(sock);
+    return 0;
+}
+
+/*
+ * ECHO_NUM_RTT round trips of one payload on a TEE socket, with
+ * TA_SOCKET_CMD_ECHO timed by the host (cmd_rtts) and by the TA (ta_rtts),
+ * then with one SEND and RECV invocations (split_rtts)
+ */
+int tee_echo(struct ta_ctx *t_ctx, struct socket_handle *s_handle, int udp,
+        char *data, size_t len, char *echo, double *cmd_rtts, double *ta_rtts,
+        double *split_rtts)
+{
+    struct timeval t_ini, t_end, t_diff;
+    uint32_t ta_rtt_us;
+    size_t data_sz;
+    TEEC_Result res;
+
+    if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+        return 1;
+    res = udp ? tee_socket_udp_open(t_ctx, s_handle) :
+        tee_socket_tcp_open(t_ctx, s_handle);
+    if (res != TEEC_SUCCESS)
+    {
+        printf("Error opening socket in the TEE: 0x%x\n", res);
+        return 1;
+    }
+
+    for (int i = 0; i < ECHO_NUM_RTT; i++)
+    {
+        gettimeofday(&t_ini, NULL);
+        res = tee_socket_echo(t_ctx, s_handle, data, len, echo, &ta_rtt_us);
+        gettimeofday(&t_end, NULL);
+        if (res != TEEC_SUCCESS)
+        {
+            printf("Error running the TEE echo: 0x%x\n", res);
+            return 1;
+        }
+        timeval_subtract(&t_diff, &t_end, &t_ini);
+        cmd_rtts[i] = t_diff.tv_sec * 1000000.0 + t_diff.tv_usec;
+        ta_rtts[i] = ta_rtt_us;
+    }
+
+    for (int i = 0; i < ECHO_NUM_RTT; i++)
+    {
+        data_sz = len;
+        gettimeofday(&t_ini, NULL);
+        if (tee_socket_send(t_ctx, s_handle, data, &data_sz) != TEEC_SUCCESS ||
+                tee_socket_recv_echo(t_ctx, s_handle, echo, len, udp) !=
+                TEEC_SUCCESS)
+        {
+            printf("Error receiving the echo in the TEE!\n");
+            return 1;
+        }
+        gettimeofday(&t_end, NULL);
+        timeval_subtract(&t_diff, &t_end, &t_ini);
+        split_rtts[i] = t_diff.tv_sec * 1000000.0 + t_diff.tv_usec;
+    }
+
+    tee_socket_close(t_ctx, s_handle);
+    terminate_tee_session(t_ctx);
+    return 0;
+}
+
+/*
+ * Round trip percentiles against the echo servers of host/server, for TCP
+ * and UDP, TEE and REE sockets and several payload sizes
+ */
+int echo_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle)
+{
+    size_t sizes[] = {64, 1024, 8 * 1024};
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    double cmd_rtts[ECHO_NUM_RTT], ta_rtts[ECHO_NUM_RTT];
+    double split_rtts[ECHO_NUM_RTT], ree_rtts[ECHO_NUM_RTT];
+    char *data = malloc(sizes[num_sizes - 1]);
+    char *echo = malloc(sizes[num_sizes - 1]);
+
+    if (!data || !echo)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', sizes[num_sizes - 1]);
+
+    printf("---- ECHO: %i round trips, times in us ----\n", ECHO_NUM_RTT);
+    printf("mode\t\tproto\tsize\tp50\tp90\tp99\tmax\n");
+    for (int udp = 0; udp < 2; udp++)
+    {
+        for (int s = 0; s < num_sizes; s++)
+        {
+            if (tee_echo(t_ctx, s_handle, udp, data, sizes[s], echo, cmd_rtts,
+                        ta_rtts, split_rtts) ||
+                    ree_echo(s_handle, udp, data, sizes[s], echo, ree_rtts))
+                return 1;
+            print_rtt("REE\t", udp, sizes[s], ree_rtts, ECHO_NUM_RTT);
+            print_rtt("TEE echo", udp, sizes[s], cmd_rtts, ECHO_NUM_RTT);
+            print_rtt("TEE in TA", udp, sizes[s], ta_rtts, ECHO_NUM_RTT);
+            print_rtt("TEE send+recv", udp, sizes[s], split_rtts,
+                    ECHO_NUM_RTT);
+        }
+    }
+
+    free(data);
+    free(echo);
+    return 0;
+}
+
+/*
+ * Open num_socks TEE sockets to the echo servers, send POLL_MSG_SIZE bytes
+ * on each and collect the echoes, once with a blocking RECV per socket and
+ * once with TA_SOCKET_CMD_POLL. Times are milliseconds per round.
+ */
+int poll_round(struct ta_ctx *t_ctx, struct socket_handle *s_handle, int udp,
+        int num_socks, int use_poll, char *data, char *recs, double *time_ms,
+        int *num_invokes)
+{
+    struct timeval t_ini, t_end, t_diff;
+    struct socket_handle socks[TA_SOCKET_MAX_HANDLES];
+    uint32_t ids[TA_SOCKET_MAX_HANDLES];
+    uint32_t readable, writable, rec_len;
+    size_t data_sz, rec_sz, got = 0;
+    TEEC_Result res;
+
+    for (int i = 0; i < num_socks; i++)
+    {
+        socks[i] = *s_handle;
+        res = udp ? tee_socket_udp_open(t_ctx, &socks[i]) :
+            tee_socket_tcp_open(t_ctx, &socks[i]);
+        if (res != TEEC_SUCCESS)
+        {
+            printf("Error opening socket in the TEE: 0x%x\n", res);
+            return 1;
+        }
+        ids[i] = socks[i].id;
+    }
+
+    gettimeofday(&t_ini, NULL);
+    for (int i = 0; i < num_socks; i++)
+    {
+        data_sz = POLL_MSG_SIZE;
+        if (tee_socket_send(t_ctx, &socks[i], data, &data_sz) != TEEC_SUCCESS)
+        {
+            printf("Error sending data from the TEE!\n");
+            return 1;
+        }
+    }
+    *num_invokes = 0;
+    if (!use_poll)
+    {
+        for (int i = 0; i < num_socks; i++, (*num_invokes)++)
+        {
+            if (tee_socket_recv_echo(t_ctx, &socks[i], recs, POLL_MSG_SIZE,
+                        udp) != TEEC_SUCCESS)
+            {
+                printf("Error receiving the echo in the TEE!\n");
+                return 1;
+            }
+        }
+    }
+    while (use_poll && got < (size_t) num_socks * POLL_MSG_SIZE)
+    {
+        rec_sz = POLL_BUF_SIZE;
+        res = tee_socket_poll(t_ctx, ids, num_socks, ECHO_TIMEOUT, recs,
+                &rec_sz, &readable, &writable);
+        (*num_invokes)++;
+        if (res != TEEC_SUCCESS || !readable)
+        {
+            printf("Error polling the TEE sockets: 0x%x\n", res);
+            return 1;
+        }
+        for (size_t off = 0; off < rec_sz; off += 2 * sizeof(uint32_t) + rec_len)
+        {
+            memcpy(&rec_len, recs + off + sizeof(uint32_t), sizeof(rec_len));
+            got += rec_len;
+        }
+    }
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_ini);
+    *time_ms = t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0;
+
+    for (int i = 0; i < num_socks; i++)
+        tee_socket_close(t_ctx, &socks[i]);
+    return 0;
+}
+
+int poll_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        int num_tests)
+{
+    int num_socks[] = {1, 4, 8};
+    const int num_configs = sizeof(num_socks) / sizeof(num_socks[0]);
+    double recv_times[num_tests], poll_times[num_tests];
+    int recv_invokes, poll_invokes;
+    char *data = malloc(POLL_MSG_SIZE);
+    char *recs = malloc(POLL_BUF_SIZE);
+
+    if (!data || !recs)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', POLL_MSG_SIZE);
+
+    printf("---- POLL: echo of %i B on each socket, times in ms ----\n",
+            POLL_MSG_SIZE);
+    printf("proto\tsockets\trecv avg\tstdev\tinvokes\tpoll avg\tstdev\tinvokes\n");
+    for (int udp = 0; udp < 2; udp++)
+    {
+        for (int c = 0; c < num_configs; c++)
+        {
+            for (int i = 0; i < num_tests; i++)
+            {
+                if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+                    return 1;
+                if (poll_round(t_ctx, s_handle, udp, num_socks[c], 0, data,
+                            recs, &recv_times[i], &recv_invokes) ||
+                        poll_round(t_ctx, s_handle, udp, num_socks[c], 1, data,
+                            recs, &poll_times[i], &poll_invokes))
+                    return 1;
+                terminate_tee_session(t_ctx);
+            }
+            printf("%s\t%i\t%f\t%f\t%i\t%f\t%f\t%i\n", udp ? "UDP" : "TCP",
+                    num_socks[c], avg(recv_times, num_tests),
+                    stdev(recv_times, num_tests), recv_invokes,
+                    avg(poll_times, num_tests), stdev(poll_times, num_tests),
+                    poll_invokes);
+        }
+    }
+
+    free(data);
+    free(recs);
+    return 0;
+}
+
+/*
+ * Open a socket, send one 1 KiB message and close it in a new session per
+ * test, with a fresh socket each time and with the TA connection pool.
+ * Times are the milliseconds of the open and of the whole test.
+ */
+int pool_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        int num_tests)
+{
+    struct timeval t_ini, t_open, t_end, t_diff;
+    double open_times[num_tests], total_times[num_tests];
+    char data[1024];
+    size_t data_sz;
+    uint32_t reused;
+    int num_reused;
+    TEEC_Result res;
+
+    memset(data, 'A', sizeof(data));
+
+    printf("---- POOL: open, send 1 KiB, close, %i runs ----\n", num_tests);
+    printf("proto\tmode\topen avg\tstdev\ttotal avg\tstdev\treused\n");
+    for (int udp = 0; udp < 2; udp++)
+    {
+        for (int pooled = 0; pooled < 2; pooled++)
+        {
+            num_reused = 0;
+            for (int i = 0; i < num_tests; i++)
+            {
+                if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+                    return 1;
+                gettimeofday(&t_ini, NULL);
+                if (pooled)
+                    res = tee_socket_pool_open(t_ctx, s_handle, udp, &reused);
+                else
+                    res = udp ? tee_socket_udp_open(t_ctx, s_handle) :
+                        tee_socket_tcp_open(t_ctx, s_handle);
+                gettimeofday(&t_open, NULL);
+                if (res != TEEC_SUCCESS)
+                {
+                    printf("Error opening socket in the TEE: 0x%x\n", res);
+                    return 1;
+                }
+                data_sz = sizeof(data);
+                if (tee_socket_send(t_ctx, s_handle, data, &data_sz) !=
+                        TEEC_SUCCESS ||
+                        tee_socket_close(t_ctx, s_handle) != TEEC_SUCCESS)
+                {
+                    printf("Error using the TEE socket!\n");
+                    return 1;
+                }
+                gettimeofday(&t_end, NULL);
+                terminate_tee_session(t_ctx);
+
+                timeval_subtract(&t_diff, &t_open, &t_ini);
+                open_times[i] = t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0;
+                timeval_subtract(&t_diff, &t_end, &t_ini);
+                total_times[i] = t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0;
+                num_reused += pooled && reused;
+            }
+            printf("%s\t%s\t%f\t%f\t%f\t%f\t%i\n", udp ? "UDP" : "TCP",
+                    pooled ? "pooled" : "fresh",
+                    avg(open_times, num_tests), stdev(open_times, num_tests),
+                    avg(total_times, num_tests), stdev(total_times, num_tests),
+                    num_reused);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Socket options of a row of the options benchmark, a zero keeps the
+ * default of the socket
+ */
+struct sock_opts {
+    const char *name;
+    int nodelay;
+    uint32_t buf_size;      // SO_SNDBUF and SO_RCVBUF, in bytes
+    uint32_t send_timeout;  // in milliseconds
+};
+
+static const struct sock_opts opts_matrix[] = {
+    { "default", 0, 0, 0 },
+    { "nodelay", 1, 0, 0 },
+    { "buf-4K", 0, 4 * 1024, 0 },
+    { "buf-256K", 0, 256 * 1024, 0 },
+    { "nodelay+buf-256K", 1, 256 * 1024, 0 },
+    { "timeout-100ms", 0, 0, 100 },
+};
+
+/*
+ * Apply opts to a connected TEE socket, but nodelay that the TEE socket
+ * cannot set. Returns 1 when the supplicant does not implement one of them.
+ */
+int tee_set_opts(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        const struct sock_opts *opts)
+{
+    TEEC_Result res = TEEC_SUCCESS;
+
+    if (opts->buf_size)
+        res = tee_socket_ioctl(t_ctx, s_handle, TA_SOCKET_IOCTL_SNDBUF,
+                opts->buf_size);
+    if (res == TEEC_SUCCESS && opts->buf_size)
+        res = tee_socket_ioctl(t_ctx, s_handle, TA_SOCKET_IOCTL_RCVBUF,
+                opts->buf_size);
+    if (res == TEEC_SUCCESS && opts->send_timeout)
+        res = tee_socket_ioctl(t_ctx, s_handle, TA_SOCKET_IOCTL_SEND_TIMEOUT,
+                opts->send_timeout);
+    return res != TEEC_SUCCESS;
+}
+
+int ree_set_opts(int sock, const struct sock_opts *opts)
+{
+    struct timeval timeout = {
+        .tv_sec = opts->send_timeout / 1000,
+        .tv_usec = (opts->send_timeout % 1000) * 1000
+    };
+    int buf_size = opts->buf_size;
+    int one = 1;
+
+    if (opts->nodelay &&
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+        return 1;
+    if (opts->buf_size &&
+            (setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf_size,
+                        sizeof(buf_size)) ||
+             setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf_size,
+                 sizeof(buf_size))))
+        return 1;
+    if (opts->send_timeout &&
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                sizeof(timeout)))
+        return 1;
+    return 0;
+}
+
+/*
+ * Time num_send TCP sends of size bytes with opts on a TEE socket, the
+ * result is in milliseconds per send. Returns -1 on error and 1 when an
+ * option is not supported.
+ */
+int tee_opts_run(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        const struct sock_opts *opts, char *data, size_t size, int num_send,
+        double *ms_per_send)
+{
+    struct timeval t_ini, t_end, t_diff;
+    size_t data_sz;
+    int res = 0;
+
+    if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+        return -1;
+    if (tee_socket_tcp_open(t_ctx, s_handle) != TEEC_SUCCESS)
+    {
+        printf("Error opening socket in the TEE!\n");
+        terminate_tee_session(t_ctx);
+        return -1;
+    }
+    if (tee_set_opts(t_ctx, s_handle, opts))
+        res = 1;
+
+    gettimeofday(&t_ini, NULL);
+    for (int i = 0; !res && i < num_send; i++)
+    {
+        data_sz = size;
+        if (tee_socket_send(t_ctx, s_handle, data, &data_sz) != TEEC_SUCCESS
+                || data_sz != size)
+        {
+            printf("Error sending data from the TEE!\n");
+            res = -1;
+        }
+    }
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_ini);
+    *ms_per_send = (t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0) / num_send;
+
+    tee_socket_close(t_ctx, s_handle);
+    terminate_tee_session(t_ctx);
+    return res;
+}
+
+int ree_opts_run(struct socket_handle *s_handle, const struct sock_opts *opts,
+        char *data, size_t size, int num_send, double *ms_per_send)
+{
+    struct timeval t_ini, t_end, t_diff;
+    struct sockaddr_in serv_addr;
+    int res = 0;
+    int sock;
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(s_handle->tcp_port);
+    if (inet_pton(AF_INET, s_handle->addr, &serv_addr.sin_addr) <= 0)
+    {
+        printf("Invalid address/ Address not supported\n");
+        return -1;
+    }
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+    {
+        printf("Error creating Socket!\n");
+        return -1;
+    }
+    // Options go on once connected, the only time the TEE socket takes them
+    if (connect(sock, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0)
+    {
+        printf("Connection Failed\n");
+        res = -1;
+    }
+    else if (ree_set_opts(sock, opts))
+        res = 1;
+
+    gettimeofday(&t_ini, NULL);
+    for (int i = 0; !res && i < num_send; i++)
+    {
+        if (send(sock, data, size, 0) != (ssize_t) size)
+        {
+            printf("Error sending data from the REE!\n");
+            res = -1;
+        }
+    }
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_ini);
+    *ms_per_send = (t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0) / num_send;
+
+    close(sock);
+    return res;
+}
+
+/*
+ * Sweep the socket options of opts_matrix against message size and number
+ * of sends, on TEE and REE TCP sockets. Each cell is num_tests runs on a
+ * fresh connection. The TEE socket has no TCP_NODELAY, its nodelay rows are
+ * skipped.
+ */
+int options_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        int num_tests)
+{
+    const int num_opts = sizeof(opts_matrix) / sizeof(opts_matrix[0]);
+    size_t sizes[] = {64, 1024, 16 * 1024};
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    int num_sends[] = {16, 256};
+    const int num_counts = sizeof(num_sends) / sizeof(num_sends[0]);
+    double *times = calloc(num_tests, sizeof(double));
+    char *data = malloc(16 * 1024);
+    int res = 0;
+
+    if (!times || !data)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', 16 * 1024);
+
+    printf("---- SOCKET OPTIONS: TCP, ms per send, %i runs ----\n", num_tests);
+    printf("World\tOptions\tSize\tSends\tAvg\tStdev\tMB/s\n");
+    for (int ree = 0; ree < 2; ree++)
+    {
+        for (int o = 0; o < num_opts; o++)
+        {
+            if (!ree && opts_matrix[o].nodelay)
+                continue;
+            for (int s = 0; s < num_sizes; s++)
+            {
+                for (int c = 0; c < num_counts; c++)
+                {
+                    for (int i = 0; i < num_tests; i++)
+                    {
+                        res = ree ?
+                            ree_opts_run(s_handle, &opts_matrix[o], data,
+                                    sizes[s], num_sends[c], &times[i]) :
+                            tee_opts_run(t_ctx, s_handle, &opts_matrix[o],
+                                    data, sizes[s], num_sends[c], &times[i]);
+                        if (res)
+                            break;
+                    }
+                    if (res < 0)
+                        return 1;
+                    if (res)
+                    {
+                        printf("%s\t%s\tnot supported\n",
+                                ree ? "REE" : "TEE", opts_matrix[o].name);
+                        break;
+                    }
+                    printf("%s\t%s\t%zu\t%i\t%f\t%f\t%.2f\n",
+                            ree ? "REE" : "TEE", opts_matrix[o].name,
+                            sizes[s], num_sends[c], avg(times, num_tests),
+                            stdev(times, num_tests),
+                            sizes[s] / (avg(times, num_tests) * 1000.0));
+                }
+                if (res)
+                    break;
+            }
+        }
+    }
+
+    free(times);
+    free(data);
+    return 0;
+}
+
+/*
+ * Ask the counting sink (server/udp_count_sink.py) for the datagrams it got
+ * since the previous query, which also resets its counters. Returns -1 when
+ * the sink does not answer.
+ */
+long sink_count(struct socket_handle *s_handle)
+{
+    struct timeval recv_timeout = { .tv_sec = 1 };
+    struct sockaddr_in serv_addr;
+    char reply[64];
+    ssize_t len;
+    long datagrams = -1;
+    int sock;
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(UDP_SINK_PORT);
+    if (inet_pton(AF_INET, s_handle->addr, &serv_addr.sin_addr) <= 0)
+        return -1;
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        return -1;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout,
+            sizeof(recv_timeout));
+    if (sendto(sock, "COUNT", 5, 0, (struct sockaddr *) &serv_addr,
+                sizeof(serv_addr)) == 5)
+    {
+        len = recv(sock, reply, sizeof(reply) - 1, 0);
+        if (len > 0)
+        {
+            reply[len] = '\0';
+            datagrams = strtol(reply, NULL, 10);
+        }
+    }
+    close(sock);
+    return datagrams;
+}
+
+/*
+ * Send UDP_NUM_DGRAMS datagrams of size bytes to the counting sink, batch at
+ * a time: from the REE when batch is 0, with one TA_SOCKET_CMD_SEND per
+ * datagram when it is 1 and with TA_SOCKET_CMD_SENDV_UDP otherwise.
+ * *dropped receives the datagrams the sending side failed.
+ */
+int udp_run(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        size_t size, int batch, char *data, char *msgs, uint32_t *counts,
+        double *secs, long *dropped)
+{
+    struct timeval t_ini, t_end, t_diff;
+    struct sockaddr_in serv_addr;
+    uint32_t num_sent, num_dropped;
+    size_t msgs_sz, data_sz;
+    int sock = -1;
+    int ret = 0;
+
+    *dropped = 0;
+    if (!batch)
+    {
+        memset(&serv_addr, 0, sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(s_handle->udp_port);
+        if (inet_pton(AF_INET, s_handle->addr, &serv_addr.sin_addr) <= 0 ||
+                (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+                connect(sock, (struct sockaddr *) &serv_addr,
+                    sizeof(serv_addr)) < 0)
+        {
+            printf("Error opening the REE socket\n");
+            return 1;
+        }
+    }
+    else
+    {
+        if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+            return 1;
+        if (tee_socket_udp_open(t_ctx, s_handle) != TEEC_SUCCESS)
+        {
+            printf("Error opening socket in the TEE!\n");
+            terminate_tee_session(t_ctx);
+            return 1;
+        }
+        msgs_sz = pack_messages(msgs, data, size, batch);
+    }
+
+    gettimeofday(&t_ini, NULL);
+    for (int i = 0; !ret && i < UDP_NUM_DGRAMS; i += batch ? batch : 1)
+    {
+        if (!batch)
+        {
+            *dropped += send(sock, data, size, 0) != (ssize_t) size;
+        }
+        else if (batch == 1)
+        {
+            data_sz = size;
+            *dropped += tee_socket_send(t_ctx, s_handle, data, &data_sz) !=
+                TEEC_SUCCESS || data_sz != size;
+        }
+        else
+        {
+            if (tee_socket_sendv_udp(t_ctx, s_handle, msgs, msgs_sz, counts,
+                        batch, &num_sent, &num_dropped) != TEEC_SUCCESS)
+            {
+                printf("Error sending the datagram batch!\n");
+                ret = 1;
+                break;
+            }
+            *dropped += num_dropped;
+        }
+    }
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_ini);
+    *secs = t_diff.tv_sec + t_diff.tv_usec / 1000000.0;
+
+    if (!batch)
+    {
+        close(sock);
+    }
+    else
+    {
+        tee_socket_close(t_ctx, s_handle);
+        terminate_tee_session(t_ctx);
+    }
+    return ret;
+}
+
+/*
+ * Datagram rate and drop rate of UDP sends, from the REE, one invocation
+ * per datagram and TA_SOCKET_CMD_SENDV_UDP batches, against the counting
+ * sink. Drops are those of the sender plus the datagrams the sink missed.
+ */
+int udp_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle)
+{
+    struct socket_handle sink = *s_handle;
+    size_t sizes[] = {64, 512, 1400};
+    const int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+    int batches[] = {0, 1, 16, 64};
+    const int num_batches = sizeof(batches) / sizeof(batches[0]);
+    const int max_batch = 64;
+    char *data = malloc(1400);
+    char *msgs = malloc(max_batch * (sizeof(uint32_t) + 1400));
+    uint32_t *counts = malloc(max_batch * sizeof(uint32_t));
+    double secs;
+    long dropped, received;
+    int num_dgrams;
+    int ret = 1;
+
+    if (!data || !msgs || !counts)
+    {
+        printf("Out of memory!\n");
+        goto out;
+    }
+    memset(data, 'A', 1400);
+    sink.udp_port = UDP_SINK_PORT;
+
+    if (sink_count(&sink) < 0)
+    {
+        printf("The counting sink does not answer on port %i\n",
+                UDP_SINK_PORT);
+        goto out;
+    }
+
+    printf("---- UDP BATCH: %i datagrams to the counting sink ----\n",
+            UDP_NUM_DGRAMS);
+    printf("Mode\tSize\tBatch\tDgram/s\tSender drops\tDrop rate\n");
+    for (int s = 0; s < num_sizes; s++)
+    {
+        for (int b = 0; b < num_batches; b++)
+        {
+            if (udp_run(t_ctx, &sink, sizes[s], batches[b], data, msgs,
+                        counts, &secs, &dropped))
+                goto out;
+            // Let the last datagrams reach the sink before asking
+            usleep(200 * 1000);
+            received = sink_count(&sink);
+            num_dgrams = UDP_NUM_DGRAMS;
+            if (batches[b] > 1)
+                num_dgrams = (UDP_NUM_DGRAMS + batches[b] - 1) / batches[b]
+                    * batches[b];
+            printf("%s\t%zu\t%i\t%.0f\t%li\t%.2f%%\n",
+                    batches[b] ? "TEE" : "REE", sizes[s], batches[b],
+                    num_dgrams / secs, dropped,
+                    received < 0 ? -1.0 :
+                    100.0 * (num_dgrams - received) / num_dgrams);
+        }
+    }
+    ret = 0;
+
+out:
+    free(data);
+    free(msgs);
+    free(counts);
+    return ret;
+}
+
+/*
+ * TCP send throughput with the payload passed as a temporary memory
+ * reference, mapped and copied by each invocation, against a partial
+ * reference into one shared memory region registered up front. The region
+ * holds SHM_NUM_SLOTS payloads of the largest size, is registered once for
+ * every size and run, and the sends of both kinds cycle through its slots.
+ */
+int shm_benchmark(struct ta_ctx *t_ctx, struct socket_handle *s_handle,
+        int num_tests)
+{
+    struct timeval t_ini, t_end, t_diff;
+    size_t payload_sizes[] = {1024, 16 * 1024, 64 * 1024};
+    const int num_sizes = sizeof(payload_sizes) / sizeof(payload_sizes[0]);
+    const size_t region_sz = SHM_NUM_SLOTS * 64 * 1024;
+    TEEC_SharedMemory shm;
+    double *times = calloc(num_tests, sizeof(double));
+    char *data = malloc(region_sz);
+    size_t data_sz;
+    size_t offset;
+    TEEC_Result res;
+    int ret = 1;
+
+    if (!times || !data)
+    {
+        printf("Out of memory!\n");
+        return 1;
+    }
+    memset(data, 'A', region_sz);
+
+    if (prepare_tee_session(t_ctx) != TEEC_SUCCESS)
+        return 1;
+    memset(&shm, 0, sizeof(shm));
+    shm.buffer = data;
+    shm.size = region_sz;
+    shm.flags = TEEC_MEM_INPUT;
+    if (TEEC_RegisterSharedMemory(&t_ctx->ctx, &shm) != TEEC_SUCCESS)
+    {
+        printf("Error registering the shared memory region\n");
+        terminate_tee_session(t_ctx);
+        return 1;
+    }
+
+    printf("---- SHARED MEMORY SEND: %i sends, %i runs ----\n",
+            LOOP_NUM_SEND, num_tests);
+    printf("Size\tMemref\tms/send (avg, stdev)\tMB/s\n");
+    for (int s = 0; s < num_sizes; s++)
+    {
+        for (int partial = 0; partial < 2; partial++)
+        {
+            for (int t = 0; t < num_tests; t++)
+            {
+                if (tee_socket_tcp_open(t_ctx, s_handle) != TEEC_SUCCESS)
+                {
+                    printf("Error opening socket in the TEE!\n");
+                    goto out;
+                }
+
+                gettimeofday(&t_ini, NULL);
+                for (int i = 0; i < LOOP_NUM_SEND; i++)
+                {
+                    data_sz = payload_sizes[s];
+                    offset = (i % SHM_NUM_SLOTS) * payload_sizes[s];
+                    if (partial)
+                        res = tee_socket_send_shm(t_ctx, s_handle, &shm,
+                                offset, &data_sz);
+                    else
+                        res = tee_socket_send(t_ctx, s_handle,
+                                data + offset, &data_sz);
+                    if (res != TEEC_SUCCESS || data_sz != payload_sizes[s])
+                    {
+                        printf("Error sending data from the TEE: 0x%x, "
+                                "%zu of %zu bytes\n", res, data_sz,
+                                payload_sizes[s]);
+                        tee_socket_close(t_ctx, s_handle);
+                        goto out;
+                    }
+                }
+                gettimeofday(&t_end, NULL);
+                timeval_subtract(&t_diff, &t_end, &t_ini);
+                times[t] = (t_diff.tv_sec * 1000 + t_diff.tv_usec / 1000.0)
+                    / LOOP_NUM_SEND;
+
+                tee_socket_close(t_ctx, s_handle);
+            }
+            printf("%zu\t%s\t%f %f\t%.2f\n", payload_sizes[s],
+                    partial ? "partial" : "tmpref",
+                    avg(times, num_tests), stdev(times, num_tests),
+                    payload_sizes[s] / (avg(times, num_tests) * 1000.0));
+        }
+    }
+    ret = 0;
+
+out:
+    TEEC_ReleaseSharedMemory(&shm);
+    terminate_tee_session(t_ctx);
+    free(times);
+    free(data);
+    return ret;
+}
+
+int main(int argc, char *argv[])
 {
     TEEC_Result res;
     struct ta_ctx t_ctx;
-    char *buf;
-    buf = (char *) calloc(1024, sizeof(char));
 
     struct socket_handle s_handle = {
         .ip_vers = 0,
         .addr = "192.168.1.34",
         .tcp_port = 9999,
-        .udp_port = 9998,
-        .buf = buf,
-        .buffer_size = 1024
+        .udp_port = 9998
     };
 
+    // ./optee_socket_throughput batch
+    if (argc == 2 && !strcmp(argv[1], "batch"))
+        return batch_benchmark(&t_ctx, &s_handle, 10);
+
+    // ./optee_socket_throughput loop
+    if (argc == 2 && !strcmp(argv[1], "loop"))
+        return loop_benchmark(&t_ctx, &s_handle);
+
+    // ./optee_socket_throughput echo, against the echo servers
+    if (argc == 2 && !strcmp(argv[1], "echo"))
+        return echo_benchmark(&t_ctx, &s_handle);
+
+    // ./optee_socket_throughput poll, against the echo servers
+    if (argc == 2 && !strcmp(argv[1], "poll"))
+        return poll_benchmark(&t_ctx, &s_handle, 10);
+
+    // ./optee_socket_throughput pool
+    if (argc == 2 && !strcmp(argv[1], "pool"))
+        return pool_benchmark(&t_ctx, &s_handle, 10);
+
+    // ./optee_socket_throughput options
+    if (argc == 2 && !strcmp(argv[1], "options"))
+        return options_benchmark(&t_ctx, &s_handle, 10);
+
+    // ./optee_socket_throughput udp, against server/udp_count_sink.py
+    if (argc == 2 && !strcmp(argv[1], "udp"))
+        return udp_benchmark(&t_ctx, &s_handle);
+
+    // ./optee_socket_throughput shm
+    if (argc == 2 && !strcmp(argv[1], "shm"))
+        return shm_benchmark(&t_ctx, &s_handle, 10);
+
     // Different operations benchmark
     int num_tests = 10;
     int num_send[6] = {1, 512, 1024, 2 * 1024, 128 * 1024};
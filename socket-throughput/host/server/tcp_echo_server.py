@@ -0,0 +1,40 @@
+import socket, threading
+class ClientThread(threading.Thread):
+
+    def __init__(self, address, socket):
+        threading.Thread.__init__(self)
+        self.csocket = socket
+        self.address = address
+        print ("New connection added: ", address)
+
+    def run(self):
+        print ("Connection from : ", self.address)
+        # Round trip benchmarks wait for every byte, send it back at once
+        self.csocket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        while True:
+            try:
+                data = self.csocket.recv(64 * 1024)
+                if data:
+                    self.csocket.sendall(data)
+                else:
+                    print("client disconnected")
+                    self.csocket.close()
+                    break
+            except OSError:
+                print("client disconnected")
+                self.csocket.close()
+                break
+
+LOCALHOST = "192.168.1.34"
+#LOCALHOST = "127.0.0.1"
+PORT = 9999
+server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind((LOCALHOST, PORT))
+print("Echo server started on {} port {}".format(LOCALHOST, PORT))
+print("Waiting for client request..")
+while True:
+    server.listen(1)
+    clientsock, clientAddress = server.accept()
+    newthread = ClientThread(clientAddress, clientsock)
+    newthread.start()
@@ -0,0 +1,26 @@
+# udp_count_sink.py
+import socket
+
+# Create a UDP/IP socket
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+
+# Bind the socket to the port
+server_address = ('192.168.1.34', 9997)
+#server_address = ('127.0.0.1', 9997)
+print('starting up UDP counting sink on {} port {}'.format(*server_address))
+sock.bind(server_address)
+
+datagrams = 0
+total_bytes = 0
+while True:
+    data, client_address = sock.recvfrom(64 * 1024)
+    # A COUNT query gets the counters since the previous one, and resets them
+    if data == b'COUNT':
+        reply = '{} {}'.format(datagrams, total_bytes)
+        sock.sendto(reply.encode(), client_address)
+        datagrams = 0
+        total_bytes = 0
+        continue
+    datagrams += 1
+    total_bytes += len(data)
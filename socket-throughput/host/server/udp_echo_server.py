@@ -0,0 +1,16 @@
+# udp_echo_server.py
+import socket
+
+# Create a UDP/IP socket
+sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+
+# Bind the socket to the port
+server_address = ('192.168.1.34', 9998)
+#server_address = ('127.0.0.1', 9998)
+print('starting up UDP echo server on {} port {}'.format(*server_address))
+sock.bind(server_address)
+
+while True:
+    # Send every datagram back to its sender
+    data, client_address = sock.recvfrom(64 * 1024)
+    sock.sendto(data, client_address)
@@ -33,6 +33,10 @@
 
 #define TA_UUID TA_SOCKET_UUID
 
+/*
+ * One instance per session so that clients do not serialize on each other,
+ * the connection pool is therefore per session
+ */
 #define TA_FLAGS ( TA_FLAG_EXEC_DDR | TA_FLAG_MULTI_SESSION)
 #define TA_STACK_SIZE (2 * 1024)
 #define TA_DATA_SIZE (32 * 1024)
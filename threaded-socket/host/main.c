@@ -16,6 +16,8 @@
 
 #define OP_BENCHMARK        0
 #define TPUT_BENCHMARK      1
+#define ECHO_BENCHMARK      2
+#define ECHO_TIMEOUT        2000
 #define NUM_THREADS         4
 
 struct ta_ctx {
@@ -28,8 +30,8 @@ struct socket_handle {
     char *addr;
     uint16_t tcp_port;
     uint16_t udp_port;
-    char *buf; // This buffer is used to store the TEE Socket Handle
-    size_t buffer_size;
+    uint32_t id; // Index of the socket in the TA session table
+    uint32_t error; // Protocol error of the last open
 };
 
 struct benchmark_times {
@@ -45,6 +47,7 @@ struct thread_args {
     char *data;
     size_t data_sz;
     int threadID;
+    int benchmark_type; // ECHO_BENCHMARK waits for the echo of each send
 };
 
 double avg(double *arr, int num_elements)
@@ -122,26 +125,24 @@ static TEEC_Result tee_socket_tcp_open(struct ta_ctx *t_ctx,
 {
     TEEC_Result res;
     TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
-    
+    uint32_t ret_orig;
+
+    memset(&op, 0, sizeof(op));
     op.paramTypes = TEEC_PARAM_TYPES(
             TEEC_VALUE_INPUT,
             TEEC_MEMREF_TEMP_INPUT,
-            TEEC_MEMREF_TEMP_OUTPUT,
+            TEEC_VALUE_OUTPUT,
             TEEC_VALUE_OUTPUT);
 
     op.params[0].value.a = handle->ip_vers;
     op.params[0].value.b = handle->tcp_port;
     op.params[1].tmpref.buffer = (void *) handle->addr;
     op.params[1].tmpref.size = strlen(handle->addr) + 1;
-    op.params[2].tmpref.buffer = handle->buf;
-    op.params[2].tmpref.size = handle->buffer_size;
 
-    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, ret_orig);
+    res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_TCP_OPEN, &op, &ret_orig);
 
-    handle->buffer_size = op.params[2].tmpref.size;
-    *error = op.params[3].value.a;
+    handle->id = op.params[2].value.a;
+    handle->error = op.params[3].value.a;
     return res;
 }
 
@@ -150,27 +151,25 @@ static TEEC_Result tee_socket_udp_open(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
-    uint32_t *error;
+    uint32_t ret_orig;
 
+	memset(&op, 0, sizeof(op));
 	op.params[0].value.a = handle->ip_vers;
 	op.params[0].value.b = handle->udp_port;
 	op.params[1].tmpref.buffer = (void *) handle->addr;
 	op.params[1].tmpref.size = strlen(handle->addr) + 1;
-	op.params[2].tmpref.buffer = handle->buf;
-	op.params[2].tmpref.size = handle->buffer_size;
 
 	op.paramTypes = TEEC_PARAM_TYPES(
                         TEEC_VALUE_INPUT,
 					    TEEC_MEMREF_TEMP_INPUT,
-					    TEEC_MEMREF_TEMP_OUTPUT,
+					    TEEC_VALUE_OUTPUT,
 					    TEEC_VALUE_OUTPUT);
 
 	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_UDP_OPEN,
-				 &op, ret_orig);
+				 &op, &ret_orig);
 
-	handle->buffer_size = op.params[2].tmpref.size;
-	*error = op.params[3].value.a;
+	handle->id = op.params[2].value.a;
+	handle->error = op.params[3].value.a;
 	return res;
 }
 
@@ -180,71 +179,111 @@ static TEEC_Result tee_socket_send(struct ta_ctx *t_ctx,
 {
 	TEEC_Result res;
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
     uint32_t timeout = 1200;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 	op.params[1].tmpref.buffer = (void *)data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_INPUT,
 					 TEEC_VALUE_INOUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_SEND, &op, &ret_orig);
 
 	*dlen = op.params[2].value.b;
 	return res;
 }
 
-/*
-static TEEC_Result tee_socket_recv(TEEC_Session *session,
+static TEEC_Result tee_socket_recv(struct ta_ctx *t_ctx,
 			      struct socket_handle *handle,
-			      void *data, size_t *dlen,
-			      uint32_t timeout, uint32_t *ret_orig)
+			      void *data, size_t *dlen, uint32_t timeout)
 {
-	TEEC_Result res = TEEC_ERROR_GENERIC;
-	TEEC_Operation op = TEEC_OPERATION_INITIALIZER;
+	TEEC_Result res;
+	TEEC_Operation op;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->blen;
-	op.params[1].tmpref.buffer = (void *)data;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
+	op.params[1].tmpref.buffer = data;
 	op.params[1].tmpref.size = *dlen;
 	op.params[2].value.a = timeout;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_MEMREF_TEMP_OUTPUT,
 					 TEEC_VALUE_INPUT, TEEC_NONE);
 
-	res = TEEC_InvokeCommand(session, TA_SOCKET_CMD_RECV, &op, ret_orig);
+	res = TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_RECV, &op, &ret_orig);
 
 	*dlen = op.params[1].tmpref.size;
 	return res;
 }
 
-*/
+/*
+ * Wait for the echo of len bytes. A TCP echo may come back in several
+ * pieces, a UDP echo is one datagram.
+ */
+static TEEC_Result tee_socket_recv_echo(struct ta_ctx *t_ctx,
+        struct socket_handle *handle, char *buf, size_t len, int udp)
+{
+    TEEC_Result res;
+    size_t got = 0;
+    size_t sz;
+
+    do
+    {
+        sz = len - got;
+        res = tee_socket_recv(t_ctx, handle, buf + got, &sz, ECHO_TIMEOUT);
+        if (res != TEEC_SUCCESS)
+            return res;
+        if (!sz)
+            return TEEC_ERROR_COMMUNICATION;
+        got += sz;
+    } while (!udp && got < len);
+    return TEEC_SUCCESS;
+}
 
 static TEEC_Result tee_socket_close(struct ta_ctx *t_ctx,
         struct socket_handle *handle)
 {
 	TEEC_Operation op;
-    uint32_t *ret_orig;
+    uint32_t ret_orig;
 
-	op.params[0].tmpref.buffer = handle->buf;
-	op.params[0].tmpref.size = handle->buffer_size;
+	memset(&op, 0, sizeof(op));
+	op.params[0].value.a = handle->id;
 
-	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_VALUE_INPUT,
 					 TEEC_NONE, TEEC_NONE, TEEC_NONE);
 
-	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, ret_orig);
+	return TEEC_InvokeCommand(&t_ctx->sess, TA_SOCKET_CMD_CLOSE, &op, &ret_orig);
+}
+
+/*
+ * REE counterpart of tee_socket_recv_echo()
+ */
+int ree_recv_echo(int sock, char *buf, size_t len, int udp)
+{
+    size_t got = 0;
+    ssize_t n;
+
+    do
+    {
+        n = recv(sock, buf + got, len - got, 0);
+        if (n <= 0)
+            return 1;
+        got += n;
+    } while (!udp && got < len);
+    return 0;
 }
 
 int ree_tcp_socket_client(struct socket_handle *s_handle, int num_send,
-                          char *data, int iter)
+                          char *data, int iter, int benchmark_type)
 {
     int sock = 0;
+    char echo[strlen(data)];
     struct sockaddr_in serv_addr;
     // Open + Connect
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) { 
@@ -266,16 +305,27 @@ int ree_tcp_socket_client(struct socket_handle *s_handle, int num_send,
     } 
     // Send
     for (unsigned int j = 0; j < num_send; ++j)
+    {
         send(sock, data, strlen(data), 0);
+        if (benchmark_type == ECHO_BENCHMARK &&
+                ree_recv_echo(sock, echo, strlen(data), 0))
+        {
+            printf("Error receiving the TCP echo!\n");
+            close(sock);
+            return 1;
+        }
+    }
     // Close
     close(sock);
     return 0;
 }
 
 int ree_udp_socket_client(struct socket_handle *s_handle, int num_send, 
-                          char *data, int iter)
+                          char *data, int iter, int benchmark_type)
 {    
     int sockfd; 
+    char echo[strlen(data)];
+    struct timeval recv_timeout = { .tv_sec = ECHO_TIMEOUT / 1000 };
     struct sockaddr_in servaddr; 
     // Open: Create + Connect
     bzero(&servaddr, sizeof(servaddr)); 
@@ -289,9 +339,21 @@ int ree_udp_socket_client(struct socket_handle *s_handle, int num_send,
         return 1;
     } 
     // Send
+    // A lost datagram must not block the echo benchmark forever
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout,
+               sizeof(recv_timeout));
     for (unsigned int j = 0; j < num_send; ++j)
+    {
         sendto(sockfd, data, strlen(data), 0, (struct sockaddr*) NULL,
                sizeof(servaddr)); 
+        if (benchmark_type == ECHO_BENCHMARK &&
+                ree_recv_echo(sockfd, echo, strlen(data), 1))
+        {
+            printf("Error receiving the UDP echo!\n");
+            close(sockfd);
+            return 1;
+        }
+    }
     // Close
     close(sockfd); 
     return 0;
@@ -305,7 +367,8 @@ void *ree_tcp_benchmark(void *thread_args)
     {
         //printf("Starting REE TCP test #%i from thread %i!\n", i, thread_data->threadID);
         if (ree_tcp_socket_client(thread_data->handle, thread_data->num_send,
-                                  thread_data->data, i) != 0)
+                                  thread_data->data, i,
+                                  thread_data->benchmark_type) != 0)
         {
             printf("Error running REE TCP test!\n");
             return;
@@ -322,7 +385,8 @@ void *ree_udp_benchmark(void *thread_args)
     {
         //printf("Starting REE UDP test #%u!\n", i);
         if (ree_udp_socket_client(thread_data->handle, thread_data->num_send, 
-                                  thread_data->data, i) != 0)
+                                  thread_data->data, i,
+                                  thread_data->benchmark_type) != 0)
         {
             printf("Error running REE UDP test!\n");
             return;
@@ -336,32 +400,40 @@ void *tee_tcp_benchmark(void *thread_args)
     struct ta_ctx t_ctx;
     struct thread_args *thread_data;
     thread_data = (struct thread_args *) thread_args;
+    // Socket ids are per thread, only the address is shared
+    struct socket_handle handle = *thread_data->handle;
+    char echo[thread_data->data_sz];
     for (unsigned int i = 0; i < thread_data->num_tests; i++)
     {
         //printf("Starting TEE TCP test #%u!\n", i);
-        memset((void *) thread_data->handle->buf, '\0', 1024 * sizeof(char));
-        thread_data->handle->buffer_size = 1024;
         if (prepare_tee_session(&t_ctx) != TEEC_SUCCESS)
         {
             printf("Error initializing TEE Session!\n");
             return;
         }
-        if (tee_socket_tcp_open(&t_ctx, thread_data->handle) != TEEC_SUCCESS)
+        if (tee_socket_tcp_open(&t_ctx, &handle) != TEEC_SUCCESS)
         {
             printf("Error opneing TCP Socket in the TEE!\n");
             return;
         }
         for (unsigned int j = 0; j < thread_data->num_send; j++)
         {
-            if (tee_socket_send(&t_ctx, thread_data->handle,
+            if (tee_socket_send(&t_ctx, &handle,
                                 thread_data->data,
                                 &thread_data->data_sz) != TEEC_SUCCESS)
             {
                 printf("Error sending data from the TEE!\n");
                 return;
             }
+            if (thread_data->benchmark_type == ECHO_BENCHMARK &&
+                tee_socket_recv_echo(&t_ctx, &handle, echo,
+                                     thread_data->data_sz, 0) != TEEC_SUCCESS)
+            {
+                printf("Error receiving the echo in the TEE!\n");
+                return NULL;
+            }
         }
-        if (tee_socket_close(&t_ctx, thread_data->handle) != TEEC_SUCCESS)
+        if (tee_socket_close(&t_ctx, &handle) != TEEC_SUCCESS)
         {
             printf("Error closing TCP Socket in the TEE!\n");
             return;
@@ -379,32 +451,40 @@ void *tee_udp_benchmark(void *thread_args)
     struct ta_ctx t_ctx;
     struct thread_args *thread_data;
     thread_data = (struct thread_args *) thread_args;
+    // Socket ids are per thread, only the address is shared
+    struct socket_handle handle = *thread_data->handle;
+    char echo[thread_data->data_sz];
     for (unsigned int i = 0; i < thread_data->num_tests; i++)
     {
         //printf("Starting TEE UDP test #%u!\n", i);
-        memset((void *) thread_data->handle->buf, '\0', 1024 * sizeof(char));
-        thread_data->handle->buffer_size = 1024;
         if (prepare_tee_session(&t_ctx) != TEEC_SUCCESS)
         {
             printf("Error initializing TEE Session!\n");
             return;
         }
-        if (tee_socket_udp_open(&t_ctx, thread_data->handle) != TEEC_SUCCESS)
+        if (tee_socket_udp_open(&t_ctx, &handle) != TEEC_SUCCESS)
         {
             printf("Error opneing TCP Socket in the TEE!\n");
             return;
         }
         for (unsigned int j = 0; j < thread_data->num_send; j++)
         {
-            if (tee_socket_send(&t_ctx, thread_data->handle,
+            if (tee_socket_send(&t_ctx, &handle,
                                 thread_data->data,
                                 &thread_data->data_sz) != TEEC_SUCCESS)
             {
                 printf("Error sending data from the TEE!\n");
                 return;
             }
+            if (thread_data->benchmark_type == ECHO_BENCHMARK &&
+                tee_socket_recv_echo(&t_ctx, &handle, echo,
+                                     thread_data->data_sz, 1) != TEEC_SUCCESS)
+            {
+                printf("Error receiving the echo in the TEE!\n");
+                return NULL;
+            }
         }
-        if (tee_socket_close(&t_ctx, thread_data->handle) != TEEC_SUCCESS)
+        if (tee_socket_close(&t_ctx, &handle) != TEEC_SUCCESS)
         {
             printf("Error closing TCP Socket in the TEE!\n");
             return;
@@ -418,18 +498,19 @@ void *tee_udp_benchmark(void *thread_args)
     return;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    // ./optee_threaded_socket echo: each send waits for its echo
+    int benchmark_type = OP_BENCHMARK;
+    if (argc == 2 && !strcmp(argv[1], "echo"))
+        benchmark_type = ECHO_BENCHMARK;
+
     // Data & Param Initialization
-    char *buf;
-    buf = (char *) calloc(1024, sizeof(char));
     struct socket_handle s_handle = {
         .ip_vers = 0,
         .addr = "192.168.1.34",
         .tcp_port = 9999,
-        .udp_port = 9998,
-        .buf = buf,
-        .buffer_size = 1024
+        .udp_port = 9998
     };
     char *data = (char *) calloc(1 * 1024 + 1, sizeof(char));
     memset((void *) data, 'A', 1 * 1024 * sizeof(char));
@@ -462,7 +543,8 @@ int main()
                     .num_send = num_send[j],
                     .data = data,
                     .data_sz = data_sz,
-                    .threadID = i
+                    .threadID = i,
+                    .benchmark_type = benchmark_type
                 };
             }
             pthread_t threads[num_threads[j]];